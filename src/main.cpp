@@ -1,7 +1,14 @@
+#include <string.h>
+
 #include "test/test.h"
 
 using namespace Ant::Test;
 
-int main() {
+int main(int argc, char **argv) {
+  if(argc > 1 && !strcmp(argv[1], "bench")) {
+    benchAntOS();
+    return 0;
+  }
+
   return !int(testAntOS());
 }
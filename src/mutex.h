@@ -0,0 +1,55 @@
+#ifndef __MUTEX_INCLUDED__
+#define __MUTEX_INCLUDED__
+
+#include <pthread.h>
+
+namespace Ant {
+
+  class Mutex {
+    friend class Condition;
+  public:
+    Mutex() { pthread_mutex_init(&mutex, NULL); }
+    ~Mutex() { pthread_mutex_destroy(&mutex); }
+
+    void lock() { pthread_mutex_lock(&mutex); }
+    void unlock() { pthread_mutex_unlock(&mutex); }
+
+  protected:
+    Mutex(const Mutex &);
+    Mutex &operator=(const Mutex &);
+
+    pthread_mutex_t mutex;
+  };
+
+  class Condition {
+  public:
+    Condition() { pthread_cond_init(&cond, NULL); }
+    ~Condition() { pthread_cond_destroy(&cond); }
+
+    // mutex must be locked by the calling thread
+    void wait(Mutex &mutex) { pthread_cond_wait(&cond, &mutex.mutex); }
+    void signal() { pthread_cond_signal(&cond); }
+    void broadcast() { pthread_cond_broadcast(&cond); }
+
+  protected:
+    Condition(const Condition &);
+    Condition &operator=(const Condition &);
+
+    pthread_cond_t cond;
+  };
+
+  class MutexLock {
+  public:
+    MutexLock(Mutex &mutex) : mutex(mutex) { mutex.lock(); }
+    ~MutexLock() { mutex.unlock(); }
+
+  protected:
+    MutexLock(const MutexLock &);
+    MutexLock &operator=(const MutexLock &);
+
+    Mutex &mutex;
+  };
+
+}
+
+#endif // __MUTEX_INCLUDED__
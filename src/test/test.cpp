@@ -31,5 +31,9 @@ namespace Ant {
       return passed;
     }
 
+    void benchAntOS() {
+      Ant::VM::Test::benchVM();
+    }
+
   }
 }
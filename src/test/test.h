@@ -31,6 +31,7 @@ namespace Ant {
     bool testString();
 
     bool testAntOS();
+    void benchAntOS();
 
   }
 }
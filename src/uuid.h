@@ -12,11 +12,12 @@ namespace Ant {
   class UUID {
   public:
     UUID() { memset(dat, 0, sizeof(dat)); }
+    explicit UUID(const unsigned char *data) { memcpy(dat, data, sizeof(dat)); }
 
     const unsigned char *data() const { return dat; }
 
     bool operator<(const UUID &uuid) const {
-      return memcmp(dat, uuid.dat, sizeof(dat));
+      return memcmp(dat, uuid.dat, sizeof(dat)) < 0;
     }
 
     UUID &generate();
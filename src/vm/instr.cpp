@@ -1,4 +1,4 @@
-#include <sstream>
+#include <algorithm>
 
 #include "../exception.h"
 #include "../util.h"
@@ -21,130 +21,264 @@ namespace Ant {
       copy(code, code + size, &op);
     }
 
-#define VIRTUAL_CASE(op, left, mod, call) \
-    case OPCODE_##op: { const char *opcode = STRZ(op); \
-      left static_cast<mod op##Instr&>(*this).call; } break;
-
-#define VIRTUAL_CALL(left, mod, call, def) \
-    switch(op) { \
-      VIRTUAL_CASE(INC, left, mod, call); \
-      VIRTUAL_CASE(DEC, left, mod, call); \
-      VIRTUAL_CASE(ADD, left, mod, call); \
-      VIRTUAL_CASE(SUB, left, mod, call); \
-      VIRTUAL_CASE(MUL, left, mod, call); \
-      VIRTUAL_CASE(JNZ, left, mod, call); \
-      VIRTUAL_CASE(JG, left, mod, call); \
-      VIRTUAL_CASE(JNG, left, mod, call); \
-      VIRTUAL_CASE(JE, left, mod, call); \
-      VIRTUAL_CASE(CPI1, left, mod, call); \
-      VIRTUAL_CASE(CPI2, left, mod, call); \
-      VIRTUAL_CASE(CPI4, left, mod, call); \
-      VIRTUAL_CASE(CPI8, left, mod, call); \
-      VIRTUAL_CASE(PUSH, left, mod, call); \
-      VIRTUAL_CASE(PUSHR, left, mod, call); \
-      VIRTUAL_CASE(PUSHH, left, mod, call); \
-      VIRTUAL_CASE(POP, left, mod, call); \
-      VIRTUAL_CASE(JMP, left, mod, call); \
-      VIRTUAL_CASE(CPB, left, mod, call); \
-      VIRTUAL_CASE(LDE, left, mod, call); \
-      VIRTUAL_CASE(LDB, left, mod, call); \
-      VIRTUAL_CASE(LDR, left, mod, call); \
-      VIRTUAL_CASE(STE, left, mod, call); \
-      VIRTUAL_CASE(STB, left, mod, call); \
-      VIRTUAL_CASE(STR, left, mod, call); \
-      VIRTUAL_CASE(CALL, left, mod, call); \
-      VIRTUAL_CASE(THROW, left, mod, call); \
-      VIRTUAL_CASE(RET, left, mod, call); \
-      default: left def; \
+    void Instr::set(VMCode code, VMCode end) {
+      VMCodeByte buf[MAX_INSTR_SIZE] = { 0 };
+      copy(code, code + min(end - code, ptrdiff_t(sizeof(buf))), buf);
+      size_t size = reinterpret_cast<const Instr*>(buf)->size();
+
+      if(!size || size > size_t(end - code))
+        throw EncodingException();
+
+      copy(buf, buf + size, &op);
+    }
+
+#define INSTR_SPEC(op, branches, count, kind1, kind2, kind3) \
+    { STRZ(op), count, { PKIND_##kind1, PKIND_##kind2, PKIND_##kind3 }, \
+      branches, &Instr::assertConsistencyOf<op##Instr> }
+
+    // must be ordered as OpCode enumeration
+    const Instr::Spec Instr::specs[] = {
+      { "ILL", 0, { PKIND_NONE, PKIND_NONE, PKIND_NONE }, false, NULL },
+      INSTR_SPEC(INC, false, 1, REG, NONE, NONE),
+      INSTR_SPEC(DEC, false, 1, REG, NONE, NONE),
+      INSTR_SPEC(ADD, false, 3, REG, REG, REG),
+      INSTR_SPEC(SUB, false, 3, REG, REG, REG),
+      INSTR_SPEC(MUL, false, 3, REG, REG, REG),
+      INSTR_SPEC(JNZ, true, 2, REG, OFFSET, NONE),
+      INSTR_SPEC(JG, true, 3, REG, REG, OFFSET),
+      INSTR_SPEC(JNG, true, 3, REG, REG, OFFSET),
+      INSTR_SPEC(JE, true, 3, REG, REG, OFFSET),
+      INSTR_SPEC(CPI1, false, 2, IMM1, REG, NONE),
+      INSTR_SPEC(CPI2, false, 2, IMM2, REG, NONE),
+      INSTR_SPEC(CPI4, false, 2, IMM4, REG, NONE),
+      INSTR_SPEC(CPI8, false, 2, IMM8, REG, NONE),
+      INSTR_SPEC(PUSH, false, 1, REG, NONE, NONE),
+      INSTR_SPEC(PUSHR, false, 1, REG, NONE, NONE),
+      INSTR_SPEC(PUSHH, true, 1, OFFSET, NONE, NONE),
+      INSTR_SPEC(POP, false, 0, NONE, NONE, NONE),
+      INSTR_SPEC(JMP, true, 1, OFFSET, NONE, NONE),
+      INSTR_SPEC(CPB, false, 2, REG, REG, NONE),
+      INSTR_SPEC(LDE, false, 3, REG, REG, REG),
+      INSTR_SPEC(LDB, false, 3, REG, UINT, REG),
+      INSTR_SPEC(LDR, false, 3, REG, UINT, REG),
+      INSTR_SPEC(STE, false, 3, REG, REG, REG),
+      INSTR_SPEC(STB, false, 3, REG, REG, UINT),
+      INSTR_SPEC(STR, false, 3, REG, REG, UINT),
+      INSTR_SPEC(CALL, false, 1, PROC, NONE, NONE),
+      INSTR_SPEC(THROW, false, 0, NONE, NONE, NONE),
+      INSTR_SPEC(RET, true, 0, NONE, NONE, NONE),
+      INSTR_SPEC(AADD, false, 3, REG, REG, REG),
+      INSTR_SPEC(ASUB, false, 3, REG, REG, REG),
+      INSTR_SPEC(AMUL, false, 3, REG, REG, REG),
+      INSTR_SPEC(AMIN, false, 3, REG, REG, REG),
+      INSTR_SPEC(AMAX, false, 3, REG, REG, REG),
+      INSTR_SPEC(ACMPE, false, 3, REG, REG, REG),
+      INSTR_SPEC(ACMPG, false, 3, REG, REG, REG),
+      INSTR_SPEC(ARSUM, false, 2, REG, REG, NONE),
+      INSTR_SPEC(ARMIN, false, 2, REG, REG, NONE),
+      INSTR_SPEC(ARMAX, false, 2, REG, REG, NONE),
+      INSTR_SPEC(AFILL, false, 2, REG, REG, NONE),
+      INSTR_SPEC(ADD1, false, 3, REG, REG, REG),
+      INSTR_SPEC(ADD2, false, 3, REG, REG, REG),
+      INSTR_SPEC(ADD4, false, 3, REG, REG, REG),
+      INSTR_SPEC(SUB1, false, 3, REG, REG, REG),
+      INSTR_SPEC(SUB2, false, 3, REG, REG, REG),
+      INSTR_SPEC(SUB4, false, 3, REG, REG, REG),
+      INSTR_SPEC(MUL1, false, 3, REG, REG, REG),
+      INSTR_SPEC(MUL2, false, 3, REG, REG, REG),
+      INSTR_SPEC(MUL4, false, 3, REG, REG, REG),
+      INSTR_SPEC(SDIV1, false, 3, REG, REG, REG),
+      INSTR_SPEC(SDIV2, false, 3, REG, REG, REG),
+      INSTR_SPEC(SDIV4, false, 3, REG, REG, REG),
+      INSTR_SPEC(SDIV8, false, 3, REG, REG, REG),
+      INSTR_SPEC(UDIV1, false, 3, REG, REG, REG),
+      INSTR_SPEC(UDIV2, false, 3, REG, REG, REG),
+      INSTR_SPEC(UDIV4, false, 3, REG, REG, REG),
+      INSTR_SPEC(UDIV8, false, 3, REG, REG, REG),
+      INSTR_SPEC(SREM1, false, 3, REG, REG, REG),
+      INSTR_SPEC(SREM2, false, 3, REG, REG, REG),
+      INSTR_SPEC(SREM4, false, 3, REG, REG, REG),
+      INSTR_SPEC(SREM8, false, 3, REG, REG, REG),
+      INSTR_SPEC(UREM1, false, 3, REG, REG, REG),
+      INSTR_SPEC(UREM2, false, 3, REG, REG, REG),
+      INSTR_SPEC(UREM4, false, 3, REG, REG, REG),
+      INSTR_SPEC(UREM8, false, 3, REG, REG, REG),
+      INSTR_SPEC(SHL1, false, 3, REG, REG, REG),
+      INSTR_SPEC(SHL2, false, 3, REG, REG, REG),
+      INSTR_SPEC(SHL4, false, 3, REG, REG, REG),
+      INSTR_SPEC(SHL8, false, 3, REG, REG, REG),
+      INSTR_SPEC(SHR1, false, 3, REG, REG, REG),
+      INSTR_SPEC(SHR2, false, 3, REG, REG, REG),
+      INSTR_SPEC(SHR4, false, 3, REG, REG, REG),
+      INSTR_SPEC(SHR8, false, 3, REG, REG, REG),
+      INSTR_SPEC(SAR1, false, 3, REG, REG, REG),
+      INSTR_SPEC(SAR2, false, 3, REG, REG, REG),
+      INSTR_SPEC(SAR4, false, 3, REG, REG, REG),
+      INSTR_SPEC(SAR8, false, 3, REG, REG, REG),
+      INSTR_SPEC(AND1, false, 3, REG, REG, REG),
+      INSTR_SPEC(AND2, false, 3, REG, REG, REG),
+      INSTR_SPEC(AND4, false, 3, REG, REG, REG),
+      INSTR_SPEC(AND8, false, 3, REG, REG, REG),
+      INSTR_SPEC(OR1, false, 3, REG, REG, REG),
+      INSTR_SPEC(OR2, false, 3, REG, REG, REG),
+      INSTR_SPEC(OR4, false, 3, REG, REG, REG),
+      INSTR_SPEC(OR8, false, 3, REG, REG, REG),
+      INSTR_SPEC(XOR1, false, 3, REG, REG, REG),
+      INSTR_SPEC(XOR2, false, 3, REG, REG, REG),
+      INSTR_SPEC(XOR4, false, 3, REG, REG, REG),
+      INSTR_SPEC(XOR8, false, 3, REG, REG, REG),
+      INSTR_SPEC(FADD4, false, 3, REG, REG, REG),
+      INSTR_SPEC(FADD8, false, 3, REG, REG, REG),
+      INSTR_SPEC(FSUB4, false, 3, REG, REG, REG),
+      INSTR_SPEC(FSUB8, false, 3, REG, REG, REG),
+      INSTR_SPEC(FMUL4, false, 3, REG, REG, REG),
+      INSTR_SPEC(FMUL8, false, 3, REG, REG, REG),
+      INSTR_SPEC(FDIV4, false, 3, REG, REG, REG),
+      INSTR_SPEC(FDIV8, false, 3, REG, REG, REG),
+      INSTR_SPEC(JEI, true, 3, REG, INT, OFFSET),
+      INSTR_SPEC(JGI, true, 3, REG, INT, OFFSET),
+      INSTR_SPEC(JNGI, true, 3, REG, INT, OFFSET),
+      INSTR_SPEC(ADDI, false, 3, REG, INT, REG),
+      INSTR_SPEC(SUBI, false, 3, REG, INT, REG),
+      INSTR_SPEC(MULI, false, 3, REG, INT, REG)
+    };
+
+    // compile-time check that every opcode has its specification
+    typedef char InstrSpecsCheck[sizeof(Instr::specs) / sizeof(Instr::Spec) ==
+                                 OPCODE_COUNT ? 1 : -1];
+
+    namespace {
+
+      struct ParamCounts {
+        ParamCounts() {
+          fill(counts, counts + 256, MB_SCAN_BAD_OPCODE);
+          for(int op = OPCODE_ILL + 1; op < OPCODE_COUNT; op++)
+            counts[op] = Instr::specs[op].paramCount;
+        }
+
+        uint8_t counts[256];
+      };
+
+    }
+
+    void Instr::scanOffsets(VMCode code, size_t size,
+                            vector<size_t> &offsets) {
+      static const ParamCounts paramCounts;
+      scanInstrOffsets(code, size, paramCounts.counts, offsets);
     }
 
     size_t Instr::size() const {
-      VIRTUAL_CALL(return, const, size(), 0);
+      if(op == OPCODE_ILL || op >= OPCODE_COUNT)
+        return 0;
+
+      const uint8_t *in = dat, *end = dat + sizeof(dat);
+      for(int i = 0; i < spec(opcode()).paramCount; i++)
+        in += skipMB(in, end);
+
+      return 1 + (in - dat);
+    }
+
+    size_t Instr::branchIndex(size_t index) const {
+      if(!branches())
+        return 0;
+
+      uint64_t params[INSTR_PARAMS_MAX];
+      decodeParams(params);
+      return branchIndex(index, params);
+    }
+
+    size_t Instr::branchIndex(size_t index, const uint64_t *params) const {
+      const Spec &spec = Instr::spec(opcode());
+
+      for(int i = 0; i < spec.paramCount; i++)
+        if(spec.paramKinds[i] == PKIND_OFFSET)
+          return size_t(ptrdiff_t(index) + ptrdiff_t(int64_t(params[i])));
+
+      return index + 1;
     }
 
     void Instr::setParam(uint64_t p) {
-      ostringstream out;
-      writeMBUInt(p, out);
-      string str = out.str();
-      copy(str.begin(), str.end(), dat);
+      writeMBUInt(p, dat);
     }
 
     void Instr::setParam2(int64_t p) {
-      ostringstream out;
-      writeMBInt(p, out);
-      string str = out.str();
-      copy(str.begin(), str.end(), dat);
+      writeMBInt(p, dat);
     }
 
     void Instr::set2Params(uint64_t p1, uint64_t p2) {
-      ostringstream out;
-      writeMBUInt(p1, out);
+      uint8_t *out = dat;
+      out += writeMBUInt(p1, out);
       writeMBUInt(p2, out);
-      string str = out.str();
-      copy(str.begin(), str.end(), dat);
     }
 
     void Instr::set2Params2(uint64_t p1, int64_t p2) {
-      ostringstream out;
-      writeMBUInt(p1, out);
+      uint8_t *out = dat;
+      out += writeMBUInt(p1, out);
       writeMBInt(p2, out);
-      string str = out.str();
-      copy(str.begin(), str.end(), dat);
     }
 
     void Instr::set3Params(uint64_t p1, uint64_t p2, uint64_t p3) {
-      ostringstream out;
-      writeMBUInt(p1, out);
-      writeMBUInt(p2, out);
+      uint8_t *out = dat;
+      out += writeMBUInt(p1, out);
+      out += writeMBUInt(p2, out);
       writeMBUInt(p3, out);
-      string str = out.str();
-      copy(str.begin(), str.end(), dat);
     }
 
     void Instr::set3Params2(uint64_t p1, uint64_t p2, int64_t p3) {
-      ostringstream out;
-      writeMBUInt(p1, out);
-      writeMBUInt(p2, out);
+      uint8_t *out = dat;
+      out += writeMBUInt(p1, out);
+      out += writeMBUInt(p2, out);
       writeMBInt(p3, out);
-      string str = out.str();
-      copy(str.begin(), str.end(), dat);
     }
 
-#define INSTR_ISSTREAM(in) \
-    const char *buf = reinterpret_cast<const char*>(dat); \
-    istringstream in(string(buf, MAX_INSTR_SIZE - 1));
-
-    size_t Instr::size(int paramCount) const {
-      INSTR_ISSTREAM(in);
-      size_t size = 1;
-      uint64_t val;
-
-      for(int i = 0; i < paramCount; i++)
-        size += readMBUInt(in, val);
+    void Instr::set3ParamsI(uint64_t p1, int64_t p2, uint64_t p3) {
+      uint8_t *out = dat;
+      out += writeMBUInt(p1, out);
+      out += writeMBInt(p2, out);
+      writeMBUInt(p3, out);
+    }
 
-      return size;
+    void Instr::set3ParamsI2(uint64_t p1, int64_t p2, int64_t p3) {
+      uint8_t *out = dat;
+      out += writeMBUInt(p1, out);
+      out += writeMBInt(p2, out);
+      writeMBInt(p3, out);
     }
 
     uint64_t Instr::getParam(int index) const {
-      INSTR_ISSTREAM(in);
+      const uint8_t *in = dat, *end = dat + sizeof(dat);
       uint64_t val;
 
       for(int i = 0; i <= index; i++)
-        readMBUInt(in, val);
+        in += readMBUInt(in, end, val);
 
       return val;
     }
 
     int64_t Instr::getParam2(int index) const {
-      INSTR_ISSTREAM(in);
+      const uint8_t *in = dat, *end = dat + sizeof(dat);
       int64_t val;
 
       for(int i = 0; i <= index; i++)
-        readMBInt(in, val);
+        in += readMBInt(in, end, val);
 
       return val;
     }
 
+    void Instr::decodeParams(uint64_t *params) const {
+      const Spec &spec = Instr::spec(opcode());
+      const uint8_t *in = dat, *end = dat + sizeof(dat);
+      int64_t val;
+
+      for(int i = 0; i < spec.paramCount; i++)
+        if(spec.paramKinds[i] == PKIND_OFFSET ||
+           spec.paramKinds[i] == PKIND_INT) {
+          in += readMBInt(in, end, val);
+          params[i] = uint64_t(val);
+        }
+        else in += readMBUInt(in, end, params[i]);
+    }
+
     void Instr::assertRegExists(const ModuleBuilder &mbuilder, RegId reg) {
       mbuilder.assertRegExists(reg);
     }
@@ -168,6 +302,20 @@ namespace Ant {
         throw TypeException();
     }
 
+    // elements of word arrays are 8-byte integers, nothing else
+    void Instr::assertWordArray(const ModuleBuilder &mbuilder, ProcId proc,
+                                RegId reg) {
+      assertRegAllocated(mbuilder, proc, FT_REG, reg);
+
+      VarSpec vspec;
+      mbuilder.regById(reg, vspec);
+      VarType vtype;
+      mbuilder.varTypeById(vspec.vtype, vtype);
+
+      if(vtype.bytes != 8 || !vtype.vrefs.empty() || !vtype.prefs.empty())
+        throw TypeException();
+    }
+
     void Instr::assertSameVarType(VarTypeId vtype1, VarTypeId vtype2) {
       if(vtype1 != vtype2)
         throw TypeException();
@@ -232,19 +380,24 @@ namespace Ant {
     }
 
     void Instr::assertConsistency(ModuleBuilder &mbuilder, ProcId proc) const {
-      VIRTUAL_CALL(, const, assertConsistency(mbuilder, proc), );
-    }
+      const Spec &spec = Instr::spec(opcode());
 
-    bool Instr::branches() const {
-      VIRTUAL_CALL(return, const, branches(), false);
-    }
+      if(!spec.assertConsistency)
+        throw EncodingException();
 
-    size_t Instr::branchIndex(size_t index) const {
-      VIRTUAL_CALL(return, const, branchIndex(index), 0);
+      spec.assertConsistency(*this, mbuilder, proc);
     }
 
-    const char *Instr::mnemonic() const {
-      VIRTUAL_CALL(return, const, dummy(opcode), "ILL");
+    void Instr::decode(size_t index, size_t offset, InstrData &idata) const {
+      if(op == OPCODE_ILL || op >= OPCODE_COUNT)
+        throw EncodingException();
+
+      idata.opcode = opcode();
+      fill(idata.params, idata.params + INSTR_PARAMS_MAX, 0);
+      decodeParams(idata.params);
+      idata.offset = offset;
+      idata.branches = branches();
+      idata.branchIndex = idata.branches ? branchIndex(index, idata.params) : 0;
     }
 
   }
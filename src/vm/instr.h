@@ -3,35 +3,69 @@
 
 #include <cstddef>
 #include <stdint.h>
+#include <vector>
 
 #include "vmdefs.h"
 
 namespace Ant {
   namespace VM {
 
-#define MAX_INSTR_SIZE 11
+// opcode, two registers and a signed 8-byte immediate value
+#define MAX_INSTR_SIZE 14
+
+    enum ParamKind {
+      PKIND_NONE = 0,
+      PKIND_REG, // register id
+      PKIND_PROC, // procedure id
+      PKIND_UINT, // unsigned integer (byte offset, vref index)
+      PKIND_IMM1, // 1-byte immediate value
+      PKIND_IMM2, // 2-byte immediate value
+      PKIND_IMM4, // 4-byte immediate value
+      PKIND_IMM8, // 8-byte immediate value
+      PKIND_OFFSET, // signed instruction offset
+      PKIND_INT // signed immediate value
+    };
 
     class ModuleBuilder;
 
     class Instr {
       friend class ModuleBuilder;
     public:
+      struct Spec {
+        const char *mnemonic;
+        uint8_t paramCount;
+        uint8_t paramKinds[INSTR_PARAMS_MAX];
+        bool branches;
+        void (*assertConsistency)(const Instr &instr, ModuleBuilder &mbuilder,
+                                  ProcId proc);
+      };
+
       Instr() : op(OPCODE_ILL) {}
       Instr(OpCode op) : op(op) {}
       Instr(VMCode code) { set(code); }
 
       void set(VMCode code);
+      void set(VMCode code, VMCode end);
 
       OpCode opcode() const { return OpCode(op); }
       VMCode data() const { return &op; }
 
       size_t size() const;
-      bool branches() const;
+      bool branches() const { return spec(opcode()).branches; }
       size_t branchIndex(size_t index) const;
 
-      const char *mnemonic() const;
+      void decode(size_t index, size_t offset, InstrData &idata) const;
+      static void scanOffsets(VMCode code, size_t size,
+                              std::vector<size_t> &offsets);
+
+      const char *mnemonic() const { return spec(opcode()).mnemonic; }
       static const char *opcodeMnemonic(OpCode op) {
-        return Instr(op).mnemonic();
+        return spec(op).mnemonic;
+      }
+
+      static const Spec specs[]; // indexed by OpCode
+      static const Spec &spec(OpCode op) {
+        return specs[op < OPCODE_COUNT ? op : OPCODE_ILL];
       }
 
     protected:
@@ -41,16 +75,21 @@ namespace Ant {
       void set2Params2(uint64_t p1, int64_t p2);
       void set3Params(uint64_t p1, uint64_t p2, uint64_t p3);
       void set3Params2(uint64_t p1, uint64_t p2, int64_t p3);
+      void set3ParamsI(uint64_t p1, int64_t p2, uint64_t p3);
+      void set3ParamsI2(uint64_t p1, int64_t p2, int64_t p3);
 
-      size_t size(int paramCount) const;
       uint64_t getParam(int index) const;
       int64_t getParam2(int index) const;
+      void decodeParams(uint64_t *params) const;
+      size_t branchIndex(size_t index, const uint64_t *params) const;
 
       static void assertRegExists(const ModuleBuilder &mbuilder, RegId reg);
       static void assertRegAllocated(const ModuleBuilder &mbuilder,
                                      ProcId proc, FrameType ftype, RegId reg);
       static void assertRegHasBytes(const ModuleBuilder &mbuilder, ProcId proc,
                                     RegId reg, uint32_t bytes);
+      static void assertWordArray(const ModuleBuilder &mbuilder, ProcId proc,
+                                  RegId reg);
       static void assertSameVarType(VarTypeId vtype1, VarTypeId vtype2);
       static void assertSafeRefCopy(const VarSpec &from, const VarSpec &to);
       static void assertProcCallable(const ModuleBuilder &mbuilder,
@@ -68,10 +107,13 @@ namespace Ant {
                                    ptrdiff_t offset);
       static void applyDefault(ModuleBuilder &mbuilder, ProcId proc);
 
+      template<class INSTR>
+        static void assertConsistencyOf(const Instr &instr,
+                                        ModuleBuilder &mbuilder, ProcId proc) {
+        static_cast<const INSTR&>(instr).assertConsistency(mbuilder, proc);
+      }
       void assertConsistency(ModuleBuilder &mbuilder, ProcId proc) const;
 
-      const char *dummy(const char *str) const { return str; }
-
       uint8_t op;
       uint8_t dat[MAX_INSTR_SIZE - 1];
     };
@@ -81,10 +123,7 @@ namespace Ant {
     public:
       UOInstrT(RegId it) { op = OP; setParam(it); }
 
-      size_t size() const { return Instr::size(1); }
       RegId it() const { return RegId(getParam(0)); }
-      bool branches() const { return false; }
-      size_t branchIndex(size_t) const { return 0; }
 
     protected:
       void assertConsistency(ModuleBuilder &mbuilder, ProcId proc) const {
@@ -96,25 +135,22 @@ namespace Ant {
     typedef UOInstrT<OPCODE_INC> INCInstr;
     typedef UOInstrT<OPCODE_DEC> DECInstr;
 
-    template<uint8_t OP> class BOInstrT : public Instr {
+    template<uint8_t OP, class VAL> class BOInstrT : public Instr {
       friend class Instr;
     public:
       BOInstrT(RegId operand1, RegId operand2, RegId result) {
         op = OP; set3Params(operand1, operand2, result);
       }
 
-      size_t size() const { return Instr::size(3); }
       RegId operand1() const { return RegId(getParam(0)); }
       RegId operand2() const { return RegId(getParam(1)); }
       RegId result() const { return RegId(getParam(2)); }
-      bool branches() const { return false; }
-      size_t branchIndex(size_t) const { return 0; }
 
     protected:
       void assertConsistency(ModuleBuilder &mbuilder, ProcId proc) const {
-        Instr::assertRegHasBytes(mbuilder, proc, operand1(), 8);
-        Instr::assertRegHasBytes(mbuilder, proc, operand2(), 8);
-        Instr::assertRegHasBytes(mbuilder, proc, result(), 8);
+        Instr::assertRegHasBytes(mbuilder, proc, operand1(), sizeof(VAL));
+        Instr::assertRegHasBytes(mbuilder, proc, operand2(), sizeof(VAL));
+        Instr::assertRegHasBytes(mbuilder, proc, result(), sizeof(VAL));
         Instr::applyDefault(mbuilder, proc);
       }
     };
@@ -122,6 +158,63 @@ namespace Ant {
     typedef BOInstrT<OPCODE_ADD> ADDInstr;
     typedef BOInstrT<OPCODE_SUB> SUBInstr;
     typedef BOInstrT<OPCODE_MUL> MULInstr;
+    typedef BOInstrT<OPCODE_ADD1, uint8_t> ADD1Instr;
+    typedef BOInstrT<OPCODE_ADD2, uint16_t> ADD2Instr;
+    typedef BOInstrT<OPCODE_ADD4, uint32_t> ADD4Instr;
+    typedef BOInstrT<OPCODE_SUB1, uint8_t> SUB1Instr;
+    typedef BOInstrT<OPCODE_SUB2, uint16_t> SUB2Instr;
+    typedef BOInstrT<OPCODE_SUB4, uint32_t> SUB4Instr;
+    typedef BOInstrT<OPCODE_MUL1, uint8_t> MUL1Instr;
+    typedef BOInstrT<OPCODE_MUL2, uint16_t> MUL2Instr;
+    typedef BOInstrT<OPCODE_MUL4, uint32_t> MUL4Instr;
+    typedef BOInstrT<OPCODE_SDIV1, int8_t> SDIV1Instr;
+    typedef BOInstrT<OPCODE_SDIV2, int16_t> SDIV2Instr;
+    typedef BOInstrT<OPCODE_SDIV4, int32_t> SDIV4Instr;
+    typedef BOInstrT<OPCODE_SDIV8, int64_t> SDIV8Instr;
+    typedef BOInstrT<OPCODE_UDIV1, uint8_t> UDIV1Instr;
+    typedef BOInstrT<OPCODE_UDIV2, uint16_t> UDIV2Instr;
+    typedef BOInstrT<OPCODE_UDIV4, uint32_t> UDIV4Instr;
+    typedef BOInstrT<OPCODE_UDIV8, uint64_t> UDIV8Instr;
+    typedef BOInstrT<OPCODE_SREM1, int8_t> SREM1Instr;
+    typedef BOInstrT<OPCODE_SREM2, int16_t> SREM2Instr;
+    typedef BOInstrT<OPCODE_SREM4, int32_t> SREM4Instr;
+    typedef BOInstrT<OPCODE_SREM8, int64_t> SREM8Instr;
+    typedef BOInstrT<OPCODE_UREM1, uint8_t> UREM1Instr;
+    typedef BOInstrT<OPCODE_UREM2, uint16_t> UREM2Instr;
+    typedef BOInstrT<OPCODE_UREM4, uint32_t> UREM4Instr;
+    typedef BOInstrT<OPCODE_UREM8, uint64_t> UREM8Instr;
+    typedef BOInstrT<OPCODE_SHL1, uint8_t> SHL1Instr;
+    typedef BOInstrT<OPCODE_SHL2, uint16_t> SHL2Instr;
+    typedef BOInstrT<OPCODE_SHL4, uint32_t> SHL4Instr;
+    typedef BOInstrT<OPCODE_SHL8, uint64_t> SHL8Instr;
+    typedef BOInstrT<OPCODE_SHR1, uint8_t> SHR1Instr;
+    typedef BOInstrT<OPCODE_SHR2, uint16_t> SHR2Instr;
+    typedef BOInstrT<OPCODE_SHR4, uint32_t> SHR4Instr;
+    typedef BOInstrT<OPCODE_SHR8, uint64_t> SHR8Instr;
+    typedef BOInstrT<OPCODE_SAR1, int8_t> SAR1Instr;
+    typedef BOInstrT<OPCODE_SAR2, int16_t> SAR2Instr;
+    typedef BOInstrT<OPCODE_SAR4, int32_t> SAR4Instr;
+    typedef BOInstrT<OPCODE_SAR8, int64_t> SAR8Instr;
+    typedef BOInstrT<OPCODE_AND1, uint8_t> AND1Instr;
+    typedef BOInstrT<OPCODE_AND2, uint16_t> AND2Instr;
+    typedef BOInstrT<OPCODE_AND4, uint32_t> AND4Instr;
+    typedef BOInstrT<OPCODE_AND8, uint64_t> AND8Instr;
+    typedef BOInstrT<OPCODE_OR1, uint8_t> OR1Instr;
+    typedef BOInstrT<OPCODE_OR2, uint16_t> OR2Instr;
+    typedef BOInstrT<OPCODE_OR4, uint32_t> OR4Instr;
+    typedef BOInstrT<OPCODE_OR8, uint64_t> OR8Instr;
+    typedef BOInstrT<OPCODE_XOR1, uint8_t> XOR1Instr;
+    typedef BOInstrT<OPCODE_XOR2, uint16_t> XOR2Instr;
+    typedef BOInstrT<OPCODE_XOR4, uint32_t> XOR4Instr;
+    typedef BOInstrT<OPCODE_XOR8, uint64_t> XOR8Instr;
+    typedef BOInstrT<OPCODE_FADD4, float> FADD4Instr;
+    typedef BOInstrT<OPCODE_FADD8, double> FADD8Instr;
+    typedef BOInstrT<OPCODE_FSUB4, float> FSUB4Instr;
+    typedef BOInstrT<OPCODE_FSUB8, double> FSUB8Instr;
+    typedef BOInstrT<OPCODE_FMUL4, float> FMUL4Instr;
+    typedef BOInstrT<OPCODE_FMUL8, double> FMUL8Instr;
+    typedef BOInstrT<OPCODE_FDIV4, float> FDIV4Instr;
+    typedef BOInstrT<OPCODE_FDIV8, double> FDIV8Instr;
 
     template<uint8_t OP> class UJInstrT : public Instr {
       friend class Instr;
@@ -129,12 +222,8 @@ namespace Ant {
       UJInstrT(RegId it, ptrdiff_t offset) {
         op = OP; set2Params2(it, offset); }
 
-      size_t size() const { return Instr::size(2); }
       RegId it() const { return RegId(getParam(0)); }
       ptrdiff_t offset() const { return ptrdiff_t(getParam2(1)); }
-      bool branches() const { return true; }
-      size_t branchIndex(size_t index) const {
-        return size_t(ptrdiff_t(index) + offset()); }
 
     protected:
       void assertConsistency(ModuleBuilder &mbuilder, ProcId proc) const {
@@ -151,13 +240,9 @@ namespace Ant {
       BJInstrT(RegId operand1, RegId operand2, ptrdiff_t offset) {
         op = OP; set3Params2(operand1, operand2, offset); }
 
-      size_t size() const { return Instr::size(3); }
       RegId operand1() const { return RegId(getParam(0)); }
       RegId operand2() const { return RegId(getParam(1)); }
       ptrdiff_t offset() const { return ptrdiff_t(getParam2(2)); }
-      bool branches() const { return true; }
-      size_t branchIndex(size_t index) const {
-        return size_t(ptrdiff_t(index) + offset()); }
 
     protected:
       void assertConsistency(ModuleBuilder &mbuilder, ProcId proc) const {
@@ -171,6 +256,50 @@ namespace Ant {
     typedef BJInstrT<OPCODE_JNG> JNGInstr;
     typedef BJInstrT<OPCODE_JE> JEInstr;
 
+    template<uint8_t OP> class BJIInstrT : public Instr {
+      friend class Instr;
+    public:
+      BJIInstrT(RegId operand1, int64_t operand2, ptrdiff_t offset) {
+        op = OP; set3ParamsI2(operand1, operand2, offset); }
+
+      RegId operand1() const { return RegId(getParam(0)); }
+      int64_t operand2() const { return getParam2(1); }
+      ptrdiff_t offset() const { return ptrdiff_t(getParam2(2)); }
+
+    protected:
+      void assertConsistency(ModuleBuilder &mbuilder, ProcId proc) const {
+        Instr::assertRegHasBytes(mbuilder, proc, operand1(), 8);
+        Instr::applyInstrOffset(mbuilder, proc, offset());
+      }
+    };
+
+    typedef BJIInstrT<OPCODE_JEI> JEIInstr;
+    typedef BJIInstrT<OPCODE_JGI> JGIInstr;
+    typedef BJIInstrT<OPCODE_JNGI> JNGIInstr;
+
+    template<uint8_t OP> class BOIInstrT : public Instr {
+      friend class Instr;
+    public:
+      BOIInstrT(RegId operand1, int64_t operand2, RegId result) {
+        op = OP; set3ParamsI(operand1, operand2, result);
+      }
+
+      RegId operand1() const { return RegId(getParam(0)); }
+      int64_t operand2() const { return getParam2(1); }
+      RegId result() const { return RegId(getParam(2)); }
+
+    protected:
+      void assertConsistency(ModuleBuilder &mbuilder, ProcId proc) const {
+        Instr::assertRegHasBytes(mbuilder, proc, operand1(), 8);
+        Instr::assertRegHasBytes(mbuilder, proc, result(), 8);
+        Instr::applyDefault(mbuilder, proc);
+      }
+    };
+
+    typedef BOIInstrT<OPCODE_ADDI> ADDIInstr;
+    typedef BOIInstrT<OPCODE_SUBI> SUBIInstr;
+    typedef BOIInstrT<OPCODE_MULI> MULIInstr;
+
     template<uint8_t OP, class VAL> class CPIInstrT : public Instr {
       friend class Instr;
     public:
@@ -178,11 +307,8 @@ namespace Ant {
         op = OP; set2Params(val, to);
       }
 
-      size_t size() const { return Instr::size(2); }
       VAL val() const { return VAL(getParam(0)); }
       RegId to() const { return RegId(getParam(1)); }
-      bool branches() const { return false; }
-      size_t branchIndex(size_t) const { return 0; }
 
     protected:
       void assertConsistency(ModuleBuilder &mbuilder, ProcId proc) const {
@@ -201,10 +327,7 @@ namespace Ant {
     public:
       PUSHInstrT(RegId reg) { op = OP; setParam(reg); }
 
-      size_t size() const { return Instr::size(1); }
       RegId reg() const { return RegId(getParam(0)); }
-      bool branches() const { return false; }
-      size_t branchIndex(size_t) const { return 0; }
 
     protected:
       void assertConsistency(ModuleBuilder &mbuilder, ProcId proc) const {
@@ -220,11 +343,7 @@ namespace Ant {
     public:
       PUSHHInstr(ptrdiff_t offset) { op = OPCODE_PUSHH; setParam2(offset); }
 
-      size_t size() const { return Instr::size(1); }
       ptrdiff_t offset() const { return ptrdiff_t(getParam2(0)); }
-      bool branches() const { return true; }
-      size_t branchIndex(size_t index) const {
-        return size_t(ptrdiff_t(index) + offset()); }
 
     protected:
       void assertConsistency(ModuleBuilder &mbuilder, ProcId proc) const {
@@ -237,10 +356,6 @@ namespace Ant {
     public:
       POPInstr() { op = OPCODE_POP; }
 
-      size_t size() const { return 1; }
-      bool branches() const { return false; }
-      size_t branchIndex(size_t) const { return 0; }
-
     protected:
       void assertConsistency(ModuleBuilder &mbuilder, ProcId proc) const {
         Instr::applyEndFrame(mbuilder, proc);
@@ -253,11 +368,7 @@ namespace Ant {
       JMPInstr(ptrdiff_t offset) {
         op = OPCODE_JMP; setParam2(offset); }
 
-      size_t size() const { return Instr::size(1); }
       ptrdiff_t offset() const { return ptrdiff_t(getParam2(0)); }
-      bool branches() const { return true; }
-      size_t branchIndex(size_t index) const {
-        return size_t(ptrdiff_t(index) + offset()); }
 
     protected:
       void assertConsistency(ModuleBuilder &mbuilder, ProcId proc) const {
@@ -272,11 +383,8 @@ namespace Ant {
         op = OPCODE_CPB; set2Params(from, to);
       }
 
-      size_t size() const { return Instr::size(2); }
       RegId from() const { return RegId(getParam(0)); }
       RegId to() const { return RegId(getParam(1)); }
-      bool branches() const { return false; }
-      size_t branchIndex(size_t) const { return 0; }
 
     protected:
       void assertConsistency(ModuleBuilder &mbuilder, ProcId proc) const {
@@ -293,12 +401,9 @@ namespace Ant {
         op = OPCODE_LDE; set3Params(from, elt, to);
       }
 
-      size_t size() const { return Instr::size(3); }
       RegId from() const { return RegId(getParam(0)); }
       RegId elt() const { return RegId(getParam(1)); }
       RegId to() const { return RegId(getParam(2)); }
-      bool branches() const { return false; }
-      size_t branchIndex(size_t) const { return 0; }
 
     protected:
       void assertConsistency(ModuleBuilder &mbuilder, ProcId proc) const {
@@ -318,12 +423,9 @@ namespace Ant {
         op = OPCODE_LDB; set3Params(from, offset, to);
       }
 
-      size_t size() const { return Instr::size(3); }
       RegId from() const { return RegId(getParam(0)); }
       uint32_t offset() const { return uint32_t(getParam(1)); }
       RegId to() const { return RegId(getParam(2)); }
-      bool branches() const { return false; }
-      size_t branchIndex(size_t) const { return 0; }
 
     protected:
       void assertConsistency(ModuleBuilder &mbuilder, ProcId proc) const {
@@ -340,12 +442,9 @@ namespace Ant {
         op = OPCODE_LDR; set3Params(from, vref, to);
       }
 
-      size_t size() const { return Instr::size(3); }
       RegId from() const { return RegId(getParam(0)); }
       uint32_t vref() const { return uint32_t(getParam(1)); }
       RegId to() const { return RegId(getParam(2)); }
-      bool branches() const { return false; }
-      size_t branchIndex(size_t) const { return 0; }
 
     protected:
       void assertConsistency(ModuleBuilder &mbuilder, ProcId proc) const {
@@ -365,12 +464,9 @@ namespace Ant {
         op = OPCODE_STE; set3Params(from, to, elt);
       }
 
-      size_t size() const { return Instr::size(3); }
       RegId from() const { return RegId(getParam(0)); }
       RegId to() const { return RegId(getParam(1)); }
       RegId elt() const { return RegId(getParam(2)); }
-      bool branches() const { return false; }
-      size_t branchIndex(size_t) const { return 0; }
 
     protected:
       void assertConsistency(ModuleBuilder &mbuilder, ProcId proc) const {
@@ -390,12 +486,9 @@ namespace Ant {
         op = OPCODE_STB; set3Params(from, to, offset);
       }
 
-      size_t size() const { return Instr::size(3); }
       RegId from() const { return RegId(getParam(0)); }
       RegId to() const { return RegId(getParam(1)); }
       uint32_t offset() const { return uint32_t(getParam(2)); }
-      bool branches() const { return false; }
-      size_t branchIndex(size_t) const { return 0; }
 
     protected:
       void assertConsistency(ModuleBuilder &mbuilder, ProcId proc) const {
@@ -412,12 +505,9 @@ namespace Ant {
         op = OPCODE_STR; set3Params(from, to, vref);
       }
 
-      size_t size() const { return Instr::size(3); }
       RegId from() const { return RegId(getParam(0)); }
       RegId to() const { return RegId(getParam(1)); }
       uint32_t vref() const { return uint32_t(getParam(2)); }
-      bool branches() const { return false; }
-      size_t branchIndex(size_t) const { return 0; }
 
     protected:
       void assertConsistency(ModuleBuilder &mbuilder, ProcId proc) const {
@@ -435,10 +525,7 @@ namespace Ant {
     public:
       CALLInstr(ProcId proc) { op = OPCODE_CALL; setParam(proc); }
 
-      size_t size() const { return Instr::size(1); }
       ProcId proc() const { return ProcId(getParam(0)); }
-      bool branches() const { return false; }
-      size_t branchIndex(size_t) const { return 0; }
 
     protected:
       void assertConsistency(ModuleBuilder &mbuilder, ProcId proc) const {
@@ -452,10 +539,6 @@ namespace Ant {
     public:
       THROWInstr() { op = OPCODE_THROW; }
 
-      size_t size() const { return 1; }
-      bool branches() const { return false; }
-      size_t branchIndex(size_t) const { return 0; }
-
     protected:
       void assertConsistency(ModuleBuilder &mbuilder, ProcId proc) const {
         Instr::applyDefault(mbuilder, proc);
@@ -467,12 +550,76 @@ namespace Ant {
     public:
       RETInstr() { op = OPCODE_RET; }
 
-      size_t size() const { return 1; }
-      bool branches() const { return true; }
-      size_t branchIndex(size_t index) const { return index + 1; }
+    protected:
+      void assertConsistency(ModuleBuilder &mbuilder, ProcId proc) const {
+        Instr::applyDefault(mbuilder, proc);
+      }
+    };
+
+    template<uint8_t OP> class AOInstrT : public Instr {
+      friend class Instr;
+    public:
+      AOInstrT(RegId operand1, RegId operand2, RegId result) {
+        op = OP; set3Params(operand1, operand2, result);
+      }
+
+      RegId operand1() const { return RegId(getParam(0)); }
+      RegId operand2() const { return RegId(getParam(1)); }
+      RegId result() const { return RegId(getParam(2)); }
+
+    protected:
+      void assertConsistency(ModuleBuilder &mbuilder, ProcId proc) const {
+        Instr::assertWordArray(mbuilder, proc, operand1());
+        Instr::assertWordArray(mbuilder, proc, operand2());
+        Instr::assertWordArray(mbuilder, proc, result());
+        Instr::applyDefault(mbuilder, proc);
+      }
+    };
+
+    typedef AOInstrT<OPCODE_AADD> AADDInstr;
+    typedef AOInstrT<OPCODE_ASUB> ASUBInstr;
+    typedef AOInstrT<OPCODE_AMUL> AMULInstr;
+    typedef AOInstrT<OPCODE_AMIN> AMINInstr;
+    typedef AOInstrT<OPCODE_AMAX> AMAXInstr;
+    typedef AOInstrT<OPCODE_ACMPE> ACMPEInstr;
+    typedef AOInstrT<OPCODE_ACMPG> ACMPGInstr;
+
+    template<uint8_t OP> class ARInstrT : public Instr {
+      friend class Instr;
+    public:
+      ARInstrT(RegId from, RegId to) {
+        op = OP; set2Params(from, to);
+      }
+
+      RegId from() const { return RegId(getParam(0)); }
+      RegId to() const { return RegId(getParam(1)); }
+
+    protected:
+      void assertConsistency(ModuleBuilder &mbuilder, ProcId proc) const {
+        Instr::assertWordArray(mbuilder, proc, from());
+        Instr::assertRegHasBytes(mbuilder, proc, to(), 8);
+        Instr::applyDefault(mbuilder, proc);
+      }
+    };
+
+    typedef ARInstrT<OPCODE_ARSUM> ARSUMInstr;
+    typedef ARInstrT<OPCODE_ARMIN> ARMINInstr;
+    typedef ARInstrT<OPCODE_ARMAX> ARMAXInstr;
+
+    class AFILLInstr : public Instr {
+      friend class Instr;
+    public:
+      AFILLInstr(RegId val, RegId to) {
+        op = OPCODE_AFILL; set2Params(val, to);
+      }
+
+      RegId val() const { return RegId(getParam(0)); }
+      RegId to() const { return RegId(getParam(1)); }
 
     protected:
       void assertConsistency(ModuleBuilder &mbuilder, ProcId proc) const {
+        Instr::assertRegHasBytes(mbuilder, proc, val(), 8);
+        Instr::assertWordArray(mbuilder, proc, to());
         Instr::applyDefault(mbuilder, proc);
       }
     };
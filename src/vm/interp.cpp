@@ -0,0 +1,895 @@
+#include <algorithm>
+#include <alloca.h>
+#include <limits>
+#include <string.h>
+
+#include "../exception.h"
+#include "mdata.h"
+
+// Dispatch jumps straight from one instruction handler to the next one
+// where labels as values are supported, otherwise a switch is used
+#ifdef __GNUC__
+#define INTERP_THREADED
+#endif
+
+namespace Ant {
+  namespace VM {
+
+    extern "C" void ant_vm_destroy_variable(const std::vector<VarTypeData>&,
+                                            const VarSpec&, Variable*);
+
+  }
+}
+
+namespace {
+
+  using namespace std;
+  using namespace Ant;
+  using namespace Ant::VM;
+
+  inline size_t alignInterpOffset(size_t offset) {
+    return (offset + sizeof(uint64_t) - 1) & ~(sizeof(uint64_t) - 1);
+  }
+
+  struct InterpState {
+    uint8_t *io, *frame, *globals;
+    int64_t *ed;
+  };
+
+  // same as in compiled code, exception descriptor is set before throwing
+  void throwVMException(const InterpState &state, int64_t edValue) {
+    *state.ed = edValue;
+    throw edValue;
+  }
+
+  inline uint8_t *regBase(const InterpState &state, const InterpReg &reg) {
+    switch(reg.kind) {
+      case IRK_IO: return state.io;
+      case IRK_FRAME: return state.frame + reg.offset;
+      default: return state.globals + reg.offset;
+    }
+  }
+
+  // variable of a register, a reference is dereferenced
+  inline uint8_t *regVar(const InterpState &state, const InterpReg &reg) {
+    uint8_t *vptr = regBase(state, reg);
+
+    if(reg.ref) {
+      vptr = *reinterpret_cast<uint8_t**>(vptr);
+      if(!vptr)
+        throwVMException(state, VMECODE_NULL_REFERENCE);
+    }
+    return vptr;
+  }
+
+  inline uint8_t *regElt(const InterpState &state, const InterpReg &reg,
+                         const uint8_t *eltPtr = NULL) {
+    uint8_t *vptr = regVar(state, reg);
+
+    bool nonFixed = reg.ref && reg.nonFixed;
+    if(eltPtr || nonFixed) {
+      uint64_t elt = eltPtr ? *reinterpret_cast<const uint64_t*>(eltPtr) : 0;
+      uint64_t count = nonFixed ? reinterpret_cast<uint64_t*>(vptr)[-2]
+        : reg.count;
+
+      if(elt >= count)
+        throwVMException(state, VMECODE_RANGE);
+
+      vptr += elt * reg.eltSize;
+    }
+
+    return vptr;
+  }
+
+  inline uint64_t &regWord(const InterpState &state, const InterpReg &reg) {
+    return *reinterpret_cast<uint64_t*>(regElt(state, reg));
+  }
+
+  template<class VAL>
+  inline VAL &regVal(const InterpState &state, const InterpReg &reg) {
+    return *reinterpret_cast<VAL*>(regElt(state, reg));
+  }
+
+  // first word of a word array, count gets its element count, which may
+  // be zero, so no element is checked
+  inline uint64_t *regArray(const InterpState &state, const InterpReg &reg,
+                            uint64_t &count) {
+    uint8_t *vptr = regVar(state, reg);
+    count = reg.ref && reg.nonFixed ? reinterpret_cast<uint64_t*>(vptr)[-2]
+      : reg.count;
+    return reinterpret_cast<uint64_t*>(vptr);
+  }
+
+  inline void retainVar(uint8_t *vptr) {
+    if(vptr)
+      ++reinterpret_cast<int64_t*>(vptr)[-1];
+  }
+
+  inline void releaseVar(const vector<VarTypeData> &vtypes,
+                         const VarSpec &vspec, uint8_t *vptr) {
+    if(vptr && !--reinterpret_cast<int64_t*>(vptr)[-1])
+      ant_vm_destroy_variable(vtypes, vspec,
+                              reinterpret_cast<Variable*>(vptr));
+  }
+
+}
+
+namespace Ant {
+  namespace VM {
+
+    using namespace std;
+
+    size_t Runtime::ModuleData::eltSize(VarTypeId vtype) const {
+      const VarTypeData &vt = vtypes[vtype];
+      size_t ptrs = vt.vrefs.size() + vt.prefs.size();
+      return ptrs ? vrefsOffset(vtype) + ptrs * sizeof(void*) : vt.bytes;
+    }
+
+    // variable element is laid out as its LLVM structure
+    size_t Runtime::ModuleData::vrefsOffset(VarTypeId vtype) const {
+      return (vtypes[vtype].bytes + sizeof(void*) - 1) & ~(sizeof(void*) - 1);
+    }
+
+    InterpReg Runtime::ModuleData::interpReg(const vector<InterpFrame> &frames,
+                                             RegId reg) const {
+      InterpReg ireg;
+      ireg.kind = IRK_GLOBAL, ireg.ref = false;
+      ireg.nonFixed = regs[reg].flags & VFLAG_NON_FIXED_REF;
+      ireg.offset = interpGlobalOffsets[reg];
+      ireg.count = regs[reg].count;
+      ireg.eltSize = eltSize(regs[reg].vtype);
+
+      for(size_t i = frames.size(); i > 0; i--) {
+        const InterpFrame &frame = frames[i - 1];
+        if(frame.ftype != FT_HAND && frame.reg == reg) {
+          ireg.kind = i == 1 ? IRK_IO : IRK_FRAME;
+          ireg.ref = frame.ftype == FT_REGR;
+          ireg.offset = frame.offset;
+          break;
+        }
+      }
+
+      return ireg;
+    }
+
+    void Runtime::ModuleData::prepareInterpLanding(InterpProc &iproc,
+                                  InterpInstr &instr, size_t index,
+                                  const vector<InterpFrame> &frames) {
+      instr.cleanupBegin = iproc.cleanups.size();
+
+      size_t fi = frames.size() - 1;
+      for(; fi > 0; fi--) {
+        const InterpFrame &frame = frames[fi];
+        if(frame.ftype == FT_HAND)
+          if(index >= frame.hindex) // inside of its own handler
+            continue;
+          else break;
+
+        iproc.cleanups.push_back(frame);
+      }
+
+      // instructions between frame changes share the same cleanups
+      size_t count = iproc.cleanups.size() - instr.cleanupBegin;
+      size_t prev = instr.cleanupBegin - count;
+      bool same = count && count <= instr.cleanupBegin;
+      for(size_t k = 0; same && k < count; k++) {
+        const InterpFrame &f1 = iproc.cleanups[prev + k];
+        const InterpFrame &f2 = iproc.cleanups[instr.cleanupBegin + k];
+        same = f1.ftype == f2.ftype && f1.reg == f2.reg &&
+          f1.offset == f2.offset;
+      }
+
+      if(same) {
+        iproc.cleanups.resize(instr.cleanupBegin);
+        instr.cleanupBegin = prev;
+      }
+
+      instr.cleanupEnd = instr.cleanupBegin + count;
+      if(fi > 0)
+        instr.handlerIndex = frames[fi].hindex;
+    }
+
+    void Runtime::ModuleData::prepareInterpProc(ProcId proc,
+                                                InterpProc &iproc) {
+      const FixedArray<InstrData> &instrs = procs[proc].instrs;
+      vector<InterpFrame> frames;
+      InterpFrame ioFrame = { FT_REGNR, ptypes[procs[proc].ptype].io, 0, 0,
+                              0 };
+      frames.push_back(ioFrame);
+
+      iproc.instrs.resize(instrs.size() + 1);
+      iproc.cleanups.clear();
+      iproc.frameBytes = 0;
+
+      for(size_t i = 0; i <= instrs.size(); i++) {
+        InterpInstr &instr = iproc.instrs[i];
+        memset(&instr, 0, sizeof(instr));
+        instr.handlerIndex = INTERP_NO_HANDLER;
+
+        if(i == instrs.size()) { // falling off the end returns
+          instr.opcode = OPCODE_RET;
+          break;
+        }
+
+        const InstrData &idata = instrs[i];
+        const uint64_t *p = idata.params;
+        instr.opcode = idata.opcode;
+        copy(p, p + INSTR_PARAMS_MAX, instr.params);
+        instr.branchIndex = idata.branchIndex;
+        instr.backEdge = idata.branches && idata.branchIndex <= i;
+
+        switch(idata.opcode) {
+          case OPCODE_ADD: case OPCODE_SUB: case OPCODE_MUL:
+          case OPCODE_AADD: case OPCODE_ASUB: case OPCODE_AMUL:
+          case OPCODE_AMIN: case OPCODE_AMAX: case OPCODE_ACMPE:
+          case OPCODE_ACMPG:
+          case OPCODE_ADD1: case OPCODE_ADD2: case OPCODE_ADD4:
+          case OPCODE_SUB1: case OPCODE_SUB2: case OPCODE_SUB4:
+          case OPCODE_MUL1: case OPCODE_MUL2: case OPCODE_MUL4:
+          case OPCODE_SDIV1: case OPCODE_SDIV2: case OPCODE_SDIV4:
+          case OPCODE_SDIV8: case OPCODE_UDIV1: case OPCODE_UDIV2:
+          case OPCODE_UDIV4: case OPCODE_UDIV8: case OPCODE_SREM1:
+          case OPCODE_SREM2: case OPCODE_SREM4: case OPCODE_SREM8:
+          case OPCODE_UREM1: case OPCODE_UREM2: case OPCODE_UREM4:
+          case OPCODE_UREM8: case OPCODE_SHL1: case OPCODE_SHL2:
+          case OPCODE_SHL4: case OPCODE_SHL8: case OPCODE_SHR1:
+          case OPCODE_SHR2: case OPCODE_SHR4: case OPCODE_SHR8:
+          case OPCODE_SAR1: case OPCODE_SAR2: case OPCODE_SAR4:
+          case OPCODE_SAR8: case OPCODE_AND1: case OPCODE_AND2:
+          case OPCODE_AND4: case OPCODE_AND8: case OPCODE_OR1:
+          case OPCODE_OR2: case OPCODE_OR4: case OPCODE_OR8:
+          case OPCODE_XOR1: case OPCODE_XOR2: case OPCODE_XOR4:
+          case OPCODE_XOR8: case OPCODE_FADD4: case OPCODE_FADD8:
+          case OPCODE_FSUB4: case OPCODE_FSUB8: case OPCODE_FMUL4:
+          case OPCODE_FMUL8: case OPCODE_FDIV4: case OPCODE_FDIV8:
+            instr.regs[2] = interpReg(frames, RegId(p[2]));
+          case OPCODE_JG: case OPCODE_JNG: case OPCODE_JE:
+            instr.regs[1] = interpReg(frames, RegId(p[1]));
+          case OPCODE_INC: case OPCODE_DEC: case OPCODE_JNZ:
+          case OPCODE_JEI: case OPCODE_JGI: case OPCODE_JNGI:
+            instr.regs[0] = interpReg(frames, RegId(p[0]));
+            break;
+
+          case OPCODE_ADDI: case OPCODE_SUBI: case OPCODE_MULI:
+            instr.regs[0] = interpReg(frames, RegId(p[0]));
+            instr.regs[2] = interpReg(frames, RegId(p[2]));
+            break;
+
+          case OPCODE_CPI1: case OPCODE_CPI2: case OPCODE_CPI4:
+          case OPCODE_CPI8:
+            instr.regs[1] = interpReg(frames, RegId(p[1]));
+            break;
+
+          case OPCODE_ARSUM: case OPCODE_ARMIN: case OPCODE_ARMAX:
+          case OPCODE_AFILL:
+            instr.regs[0] = interpReg(frames, RegId(p[0]));
+            instr.regs[1] = interpReg(frames, RegId(p[1]));
+            break;
+
+          case OPCODE_PUSH: case OPCODE_PUSHR: case OPCODE_PUSHH: {
+            const InterpFrame &top = frames.back();
+            InterpFrame frame = { FT_HAND, 0, 0, 0, idata.branchIndex };
+            frame.offset = alignInterpOffset(top.offset + top.size);
+
+            if(idata.opcode != OPCODE_PUSHH) {
+              RegId reg = RegId(p[0]);
+              bool ref = idata.opcode == OPCODE_PUSHR;
+              frame.ftype = ref ? FT_REGR : FT_REGNR;
+              frame.reg = reg;
+              frame.size = ref ? sizeof(void*)
+                : regs[reg].count * eltSize(regs[reg].vtype);
+            }
+
+            frames.push_back(frame);
+            iproc.frameBytes = max(iproc.frameBytes,
+                                   frame.offset + frame.size);
+            instr.regs[0].kind = IRK_FRAME;
+            instr.regs[0].offset = frame.offset;
+            instr.bytes = frame.size;
+            break;
+          }
+
+          case OPCODE_POP:
+            instr.cleanupBegin = iproc.cleanups.size();
+            if(frames.back().ftype != FT_HAND)
+              iproc.cleanups.push_back(frames.back());
+            instr.cleanupEnd = iproc.cleanups.size();
+            frames.pop_back();
+            break;
+
+          case OPCODE_CPB: case OPCODE_LDB: case OPCODE_STB: {
+            RegId f = RegId(p[0]);
+            RegId t = RegId(idata.opcode == OPCODE_LDB ? p[2] : p[1]);
+            size_t fbytes = vtypes[regs[f].vtype].bytes;
+            size_t tbytes = vtypes[regs[t].vtype].bytes;
+            if(idata.opcode == OPCODE_LDB)
+              fbytes -= uint32_t(p[1]);
+            else if(idata.opcode == OPCODE_STB)
+              tbytes -= uint32_t(p[2]);
+
+            instr.regs[0] = interpReg(frames, f);
+            instr.regs[1] = interpReg(frames, t);
+            instr.bytes = min(fbytes, tbytes);
+            break;
+          }
+
+          case OPCODE_LDE: case OPCODE_STE:
+            for(int k = 0; k < 3; k++)
+              instr.regs[k] = interpReg(frames, RegId(p[k]));
+            instr.bytes = eltSize(regs[RegId(p[0])].vtype);
+            break;
+
+          case OPCODE_LDR: case OPCODE_STR: {
+            RegId f = RegId(p[0]);
+            RegId t = RegId(idata.opcode == OPCODE_LDR ? p[2] : p[1]);
+            uint32_t r = uint32_t(idata.opcode == OPCODE_LDR ? p[1] : p[2]);
+            VarTypeId vtype = regs[idata.opcode == OPCODE_LDR ? f : t].vtype;
+
+            instr.regs[0] = interpReg(frames, f);
+            instr.regs[1] = interpReg(frames, t);
+            instr.fieldOffset = vrefsOffset(vtype) + r * sizeof(void*);
+            instr.vspec = idata.opcode == OPCODE_LDR ? &regs[t]
+              : &vtypes[regs[t].vtype].vrefs[r];
+            break;
+          }
+
+          case OPCODE_CALL:
+            // callee gets the variable of the last frame as it is
+            instr.regs[0].kind = frames.size() == 1 ? IRK_IO : IRK_FRAME;
+            instr.regs[0].offset = frames.back().offset;
+            break;
+
+          default:
+            break;
+        }
+
+        switch(idata.opcode) {
+          case OPCODE_PUSH: case OPCODE_PUSHR: case OPCODE_PUSHH:
+          case OPCODE_POP: case OPCODE_JMP: case OPCODE_RET:
+            break;
+
+          default: // failed checks land like THROW does
+            if(frames.size() > 1)
+              prepareInterpLanding(iproc, instr, i, frames);
+            break;
+        }
+      }
+    }
+
+    void Runtime::ModuleData::prepareInterp() {
+      size_t globalBytes = 0;
+      interpGlobalOffsets.assign(regs.size(), 0);
+      for(RegId reg = 0; reg < regs.size(); reg++)
+        if(regs[reg].flags & VFLAG_TOP_LEVEL_REG) {
+          interpGlobalOffsets[reg] = globalBytes;
+          globalBytes += regs[reg].count * eltSize(regs[reg].vtype);
+          globalBytes = alignInterpOffset(globalBytes);
+        }
+      interpGlobals.assign(globalBytes / sizeof(uint64_t) + 1, 0);
+
+      interpProcs.resize(procs.size());
+      for(ProcId proc = 0; proc < procs.size(); proc++)
+        prepareInterpProc(proc, interpProcs[proc]);
+
+      interpret(0, NULL); // sets dispatch labels
+      interpreted = true;
+    }
+
+    void Runtime::ModuleData::releaseInterp() {
+      interpreted = false;
+      interpProcs.clear();
+      interpGlobals.clear();
+      interpGlobalOffsets.clear();
+    }
+
+    void Runtime::ModuleData::cleanupInterpFrames(const InterpProc &iproc,
+                                                  size_t begin, size_t end,
+                                                  uint8_t *frame) {
+      for(size_t i = begin; i < end; i++) {
+        const InterpFrame &iframe = iproc.cleanups[i];
+        const VarSpec &vspec = regs[iframe.reg];
+        uint8_t *vptr = frame + iframe.offset;
+
+        if(iframe.ftype == FT_REGR) {
+          releaseVar(vtypes, vspec, *reinterpret_cast<uint8_t**>(vptr));
+          continue;
+        }
+
+        const FixedArray<VarSpec> &vrefs = vtypes[vspec.vtype].vrefs;
+        size_t size = eltSize(vspec.vtype), offset = vrefsOffset(vspec.vtype);
+        for(size_t elt = 0; elt < vspec.count; elt++, vptr += size)
+          for(size_t vref = 0; vref < vrefs.size(); vref++) {
+            uint8_t **rptr = reinterpret_cast<uint8_t**>
+              (vptr + offset + vref * sizeof(void*));
+            releaseVar(vtypes, vrefs[vref], *rptr);
+          }
+      }
+    }
+
+#ifdef INTERP_THREADED
+#define INTERP_LABEL(op) &&INTERP_##op
+#define INTERP_CASE(op) INTERP_##op:
+#define INTERP_NEXT goto *ip->handler
+#else
+#define INTERP_CASE(op) case OPCODE_##op:
+#define INTERP_NEXT goto dispatch
+#endif
+
+// loops of tiered modules are counted to find hot procedures
+#define INTERP_BRANCH \
+    if(ip->backEdge && tiered) \
+      countHotProc(proc); \
+    ip = &instrs[ip->branchIndex]
+
+#define INTERP_JUMP(cond) \
+    if(cond) { \
+      INTERP_BRANCH; \
+    } \
+    else ip++; \
+    INTERP_NEXT
+
+#define INTERP_BO(VAL, expr) { \
+      VAL val1 = regVal<VAL>(state, ip->regs[0]); \
+      VAL val2 = regVal<VAL>(state, ip->regs[1]); \
+      regVal<VAL>(state, ip->regs[2]) = expr; \
+      ip++; \
+      INTERP_NEXT; \
+    }
+
+#define INTERP_DIV(VAL, expr) { \
+      VAL val1 = regVal<VAL>(state, ip->regs[0]); \
+      VAL val2 = regVal<VAL>(state, ip->regs[1]); \
+      if(!val2) \
+        throwVMException(state, VMECODE_DIVISION_BY_ZERO); \
+      regVal<VAL>(state, ip->regs[2]) = expr; \
+      ip++; \
+      INTERP_NEXT; \
+    }
+
+// division of the least value by -1 wraps around instead of trapping
+#define INTERP_SDIV(VAL, UVAL) \
+    INTERP_DIV(VAL, val2 == -1 ? VAL(UVAL(0) - UVAL(val1)) : val1 / val2)
+
+// element counts are checked once, before any element is written
+#define INTERP_AO(expr) { \
+      uint64_t count1, count2, count; \
+      const uint64_t *arr1 = regArray(state, ip->regs[0], count1); \
+      const uint64_t *arr2 = regArray(state, ip->regs[1], count2); \
+      uint64_t *res = regArray(state, ip->regs[2], count); \
+      if(count1 < count || count2 < count) \
+        throwVMException(state, VMECODE_RANGE); \
+      for(uint64_t i = 0; i < count; i++) { \
+        uint64_t val1 = arr1[i], val2 = arr2[i]; \
+        res[i] = expr; \
+      } \
+      ip++; \
+      INTERP_NEXT; \
+    }
+
+// an empty array reduces to the identity of the operation
+#define INTERP_AR(identity, expr) { \
+      uint64_t count; \
+      const uint64_t *arr = regArray(state, ip->regs[0], count); \
+      uint64_t acc = identity; \
+      for(uint64_t i = 0; i < count; i++) { \
+        uint64_t val = arr[i]; \
+        acc = expr; \
+      } \
+      regWord(state, ip->regs[1]) = acc; \
+      ip++; \
+      INTERP_NEXT; \
+    }
+
+    void Runtime::ModuleData::interpret(ProcId proc, uint8_t *io) {
+#ifdef INTERP_THREADED
+      // must be ordered as OpCode enumeration
+      static const void *const labels[] = {
+        INTERP_LABEL(ILL), INTERP_LABEL(INC), INTERP_LABEL(DEC),
+        INTERP_LABEL(ADD), INTERP_LABEL(SUB), INTERP_LABEL(MUL),
+        INTERP_LABEL(JNZ), INTERP_LABEL(JG), INTERP_LABEL(JNG),
+        INTERP_LABEL(JE), INTERP_LABEL(CPI1), INTERP_LABEL(CPI2),
+        INTERP_LABEL(CPI4), INTERP_LABEL(CPI8), INTERP_LABEL(PUSH),
+        INTERP_LABEL(PUSHR), INTERP_LABEL(PUSHH), INTERP_LABEL(POP),
+        INTERP_LABEL(JMP), INTERP_LABEL(CPB), INTERP_LABEL(LDE),
+        INTERP_LABEL(LDB), INTERP_LABEL(LDR), INTERP_LABEL(STE),
+        INTERP_LABEL(STB), INTERP_LABEL(STR), INTERP_LABEL(CALL),
+        INTERP_LABEL(THROW), INTERP_LABEL(RET), INTERP_LABEL(AADD),
+        INTERP_LABEL(ASUB), INTERP_LABEL(AMUL), INTERP_LABEL(AMIN),
+        INTERP_LABEL(AMAX), INTERP_LABEL(ACMPE), INTERP_LABEL(ACMPG),
+        INTERP_LABEL(ARSUM), INTERP_LABEL(ARMIN), INTERP_LABEL(ARMAX),
+        INTERP_LABEL(AFILL), INTERP_LABEL(ADD1), INTERP_LABEL(ADD2),
+        INTERP_LABEL(ADD4), INTERP_LABEL(SUB1), INTERP_LABEL(SUB2),
+        INTERP_LABEL(SUB4), INTERP_LABEL(MUL1), INTERP_LABEL(MUL2),
+        INTERP_LABEL(MUL4), INTERP_LABEL(SDIV1), INTERP_LABEL(SDIV2),
+        INTERP_LABEL(SDIV4), INTERP_LABEL(SDIV8), INTERP_LABEL(UDIV1),
+        INTERP_LABEL(UDIV2), INTERP_LABEL(UDIV4), INTERP_LABEL(UDIV8),
+        INTERP_LABEL(SREM1), INTERP_LABEL(SREM2), INTERP_LABEL(SREM4),
+        INTERP_LABEL(SREM8), INTERP_LABEL(UREM1), INTERP_LABEL(UREM2),
+        INTERP_LABEL(UREM4), INTERP_LABEL(UREM8), INTERP_LABEL(SHL1),
+        INTERP_LABEL(SHL2), INTERP_LABEL(SHL4), INTERP_LABEL(SHL8),
+        INTERP_LABEL(SHR1), INTERP_LABEL(SHR2), INTERP_LABEL(SHR4),
+        INTERP_LABEL(SHR8), INTERP_LABEL(SAR1), INTERP_LABEL(SAR2),
+        INTERP_LABEL(SAR4), INTERP_LABEL(SAR8), INTERP_LABEL(AND1),
+        INTERP_LABEL(AND2), INTERP_LABEL(AND4), INTERP_LABEL(AND8),
+        INTERP_LABEL(OR1), INTERP_LABEL(OR2), INTERP_LABEL(OR4),
+        INTERP_LABEL(OR8), INTERP_LABEL(XOR1), INTERP_LABEL(XOR2),
+        INTERP_LABEL(XOR4), INTERP_LABEL(XOR8), INTERP_LABEL(FADD4),
+        INTERP_LABEL(FADD8), INTERP_LABEL(FSUB4), INTERP_LABEL(FSUB8),
+        INTERP_LABEL(FMUL4), INTERP_LABEL(FMUL8), INTERP_LABEL(FDIV4),
+        INTERP_LABEL(FDIV8), INTERP_LABEL(JEI), INTERP_LABEL(JGI),
+        INTERP_LABEL(JNGI), INTERP_LABEL(ADDI), INTERP_LABEL(SUBI),
+        INTERP_LABEL(MULI)
+      };
+      typedef char InterpLabelsCheck[sizeof(labels) / sizeof(labels[0]) ==
+                                     OPCODE_COUNT ? 1 : -1];
+#endif
+
+      if(!io) {
+#ifdef INTERP_THREADED
+        for(size_t i = 0; i < interpProcs.size(); i++)
+          for(size_t j = 0; j < interpProcs[i].instrs.size(); j++) {
+            InterpInstr &instr = interpProcs[i].instrs[j];
+            instr.handler = labels[instr.opcode];
+          }
+#endif
+        return;
+      }
+
+      if(tiered) { // hot procedures are entered through compiled code
+        if(!nativeProcs[proc])
+          countHotProc(proc);
+        if(NativeProc native = nativeProcs[proc]) {
+          native(*reinterpret_cast<Variable*>(io));
+          return;
+        }
+      }
+
+      const InterpProc &iproc = interpProcs[proc];
+      const InterpInstr *instrs = &iproc.instrs[0], *ip = instrs;
+      InterpState state;
+      state.io = io;
+      state.frame = static_cast<uint8_t*>(alloca(iproc.frameBytes));
+      state.globals = reinterpret_cast<uint8_t*>(&interpGlobals[0]);
+      state.ed = reinterpret_cast<int64_t*>
+        (state.globals + interpGlobalOffsets[PRESET_REG_ED]);
+
+      // exceptions of failed checks and callees land on the handler of
+      // the failing instruction once its frames are cleaned up
+      for(;;)
+        try {
+#ifdef INTERP_THREADED
+          INTERP_NEXT;
+#else
+        dispatch:
+          switch(ip->opcode) {
+#endif
+
+          INTERP_CASE(ILL)
+            throw BugException();
+
+          INTERP_CASE(INC)
+            regWord(state, ip->regs[0])++;
+            ip++;
+            INTERP_NEXT;
+
+          INTERP_CASE(DEC)
+            regWord(state, ip->regs[0])--;
+            ip++;
+            INTERP_NEXT;
+
+          INTERP_CASE(ADD) {
+            uint64_t val = regWord(state, ip->regs[0]);
+            val += regWord(state, ip->regs[1]);
+            regWord(state, ip->regs[2]) = val;
+            ip++;
+            INTERP_NEXT;
+          }
+
+          INTERP_CASE(SUB) {
+            uint64_t val = regWord(state, ip->regs[0]);
+            val -= regWord(state, ip->regs[1]);
+            regWord(state, ip->regs[2]) = val;
+            ip++;
+            INTERP_NEXT;
+          }
+
+          INTERP_CASE(MUL) {
+            uint64_t val = regWord(state, ip->regs[0]);
+            val *= regWord(state, ip->regs[1]);
+            regWord(state, ip->regs[2]) = val;
+            ip++;
+            INTERP_NEXT;
+          }
+
+          INTERP_CASE(JNZ) {
+            INTERP_JUMP(regWord(state, ip->regs[0]));
+          }
+
+          INTERP_CASE(JG) {
+            int64_t val1 = regWord(state, ip->regs[0]);
+            int64_t val2 = regWord(state, ip->regs[1]);
+            INTERP_JUMP(val1 > val2);
+          }
+
+          INTERP_CASE(JNG) {
+            int64_t val1 = regWord(state, ip->regs[0]);
+            int64_t val2 = regWord(state, ip->regs[1]);
+            INTERP_JUMP(val1 <= val2);
+          }
+
+          INTERP_CASE(JE) {
+            uint64_t val1 = regWord(state, ip->regs[0]);
+            uint64_t val2 = regWord(state, ip->regs[1]);
+            INTERP_JUMP(val1 == val2);
+          }
+
+          INTERP_CASE(CPI1)
+            *regElt(state, ip->regs[1]) = uint8_t(ip->params[0]);
+            ip++;
+            INTERP_NEXT;
+
+          INTERP_CASE(CPI2) {
+            uint16_t val = uint16_t(ip->params[0]);
+            memcpy(regElt(state, ip->regs[1]), &val, sizeof(val));
+            ip++;
+            INTERP_NEXT;
+          }
+
+          INTERP_CASE(CPI4) {
+            uint32_t val = uint32_t(ip->params[0]);
+            memcpy(regElt(state, ip->regs[1]), &val, sizeof(val));
+            ip++;
+            INTERP_NEXT;
+          }
+
+          INTERP_CASE(CPI8)
+            regWord(state, ip->regs[1]) = ip->params[0];
+            ip++;
+            INTERP_NEXT;
+
+          INTERP_CASE(PUSH)
+            memset(state.frame + ip->regs[0].offset, 0, ip->bytes);
+            ip++;
+            INTERP_NEXT;
+
+          INTERP_CASE(PUSHR)
+            *reinterpret_cast<void**>(state.frame + ip->regs[0].offset) = NULL;
+            ip++;
+            INTERP_NEXT;
+
+          INTERP_CASE(PUSHH)
+            ip++;
+            INTERP_NEXT;
+
+          INTERP_CASE(POP)
+            cleanupInterpFrames(iproc, ip->cleanupBegin, ip->cleanupEnd,
+                                state.frame);
+            ip++;
+            INTERP_NEXT;
+
+          INTERP_CASE(JMP)
+            INTERP_BRANCH;
+            INTERP_NEXT;
+
+          INTERP_CASE(CPB)
+          INTERP_CASE(STB) {
+            uint8_t *from = regElt(state, ip->regs[0]);
+            uint8_t *to = regElt(state, ip->regs[1]) + ip->params[2];
+            memmove(to, from, ip->bytes);
+            ip++;
+            INTERP_NEXT;
+          }
+
+          INTERP_CASE(LDB) {
+            uint8_t *from = regElt(state, ip->regs[0]) + ip->params[1];
+            uint8_t *to = regElt(state, ip->regs[1]);
+            memmove(to, from, ip->bytes);
+            ip++;
+            INTERP_NEXT;
+          }
+
+          INTERP_CASE(LDE) {
+            uint8_t *elt = regElt(state, ip->regs[1]);
+            uint8_t *from = regElt(state, ip->regs[0], elt);
+            memmove(regElt(state, ip->regs[2]), from, ip->bytes);
+            ip++;
+            INTERP_NEXT;
+          }
+
+          INTERP_CASE(STE) {
+            uint8_t *from = regElt(state, ip->regs[0]);
+            uint8_t *elt = regElt(state, ip->regs[2]);
+            memmove(regElt(state, ip->regs[1], elt), from, ip->bytes);
+            ip++;
+            INTERP_NEXT;
+          }
+
+          INTERP_CASE(LDR) {
+            uint8_t *from = regElt(state, ip->regs[0]) + ip->fieldOffset;
+            uint8_t *fval = *reinterpret_cast<uint8_t**>(from);
+            retainVar(fval);
+            uint8_t **to = reinterpret_cast<uint8_t**>(regBase(state,
+                                                               ip->regs[1]));
+            releaseVar(vtypes, *ip->vspec, *to);
+            *to = fval;
+            ip++;
+            INTERP_NEXT;
+          }
+
+          INTERP_CASE(STR) {
+            uint8_t *fval = *reinterpret_cast<uint8_t**>(regBase(state,
+                                                                 ip->regs[0]));
+            retainVar(fval);
+            uint8_t **to = reinterpret_cast<uint8_t**>
+              (regElt(state, ip->regs[1]) + ip->fieldOffset);
+            releaseVar(vtypes, *ip->vspec, *to);
+            *to = fval;
+            ip++;
+            INTERP_NEXT;
+          }
+
+          INTERP_CASE(CALL)
+            interpret(ProcId(ip->params[0]), regBase(state, ip->regs[0]));
+            ip++;
+            INTERP_NEXT;
+
+          INTERP_CASE(THROW) // caught within the procedure without unwinding
+            if(ip->handlerIndex == INTERP_NO_HANDLER)
+              throw int64_t(*state.ed);
+            cleanupInterpFrames(iproc, ip->cleanupBegin, ip->cleanupEnd,
+                                state.frame);
+            ip = &instrs[ip->handlerIndex];
+            INTERP_NEXT;
+
+          INTERP_CASE(RET)
+            return;
+
+          INTERP_CASE(AADD) INTERP_AO(val1 + val2)
+          INTERP_CASE(ASUB) INTERP_AO(val1 - val2)
+          INTERP_CASE(AMUL) INTERP_AO(val1 * val2)
+          INTERP_CASE(AMIN) INTERP_AO(int64_t(val1) < int64_t(val2) ? val1 : val2)
+          INTERP_CASE(AMAX) INTERP_AO(int64_t(val1) > int64_t(val2) ? val1 : val2)
+          INTERP_CASE(ACMPE) INTERP_AO(val1 == val2 ? ~uint64_t(0) : 0)
+          INTERP_CASE(ACMPG)
+            INTERP_AO(int64_t(val1) > int64_t(val2) ? ~uint64_t(0) : 0)
+
+          INTERP_CASE(ARSUM) INTERP_AR(0, acc + val)
+          INTERP_CASE(ARMIN)
+            INTERP_AR(uint64_t(numeric_limits<int64_t>::max()),
+                      int64_t(val) < int64_t(acc) ? val : acc)
+          INTERP_CASE(ARMAX)
+            INTERP_AR(uint64_t(numeric_limits<int64_t>::min()),
+                      int64_t(val) > int64_t(acc) ? val : acc)
+
+          INTERP_CASE(AFILL) {
+            uint64_t val = regWord(state, ip->regs[0]), count;
+            uint64_t *arr = regArray(state, ip->regs[1], count);
+            fill(arr, arr + count, val);
+            ip++;
+            INTERP_NEXT;
+          }
+
+          INTERP_CASE(ADD1) INTERP_BO(uint8_t, val1 + val2)
+          INTERP_CASE(ADD2) INTERP_BO(uint16_t, val1 + val2)
+          INTERP_CASE(ADD4) INTERP_BO(uint32_t, val1 + val2)
+
+          INTERP_CASE(SUB1) INTERP_BO(uint8_t, val1 - val2)
+          INTERP_CASE(SUB2) INTERP_BO(uint16_t, val1 - val2)
+          INTERP_CASE(SUB4) INTERP_BO(uint32_t, val1 - val2)
+
+          INTERP_CASE(MUL1) INTERP_BO(uint8_t, val1 * val2)
+          INTERP_CASE(MUL2) INTERP_BO(uint16_t, val1 * val2)
+          INTERP_CASE(MUL4) INTERP_BO(uint32_t, val1 * val2)
+
+          INTERP_CASE(SDIV1) INTERP_SDIV(int8_t, uint8_t)
+          INTERP_CASE(SDIV2) INTERP_SDIV(int16_t, uint16_t)
+          INTERP_CASE(SDIV4) INTERP_SDIV(int32_t, uint32_t)
+          INTERP_CASE(SDIV8) INTERP_SDIV(int64_t, uint64_t)
+
+          INTERP_CASE(UDIV1) INTERP_DIV(uint8_t, val1 / val2)
+          INTERP_CASE(UDIV2) INTERP_DIV(uint16_t, val1 / val2)
+          INTERP_CASE(UDIV4) INTERP_DIV(uint32_t, val1 / val2)
+          INTERP_CASE(UDIV8) INTERP_DIV(uint64_t, val1 / val2)
+
+          INTERP_CASE(SREM1) INTERP_DIV(int8_t, val2 == -1 ? 0 : val1 % val2)
+          INTERP_CASE(SREM2) INTERP_DIV(int16_t, val2 == -1 ? 0 : val1 % val2)
+          INTERP_CASE(SREM4) INTERP_DIV(int32_t, val2 == -1 ? 0 : val1 % val2)
+          INTERP_CASE(SREM8) INTERP_DIV(int64_t, val2 == -1 ? 0 : val1 % val2)
+
+          INTERP_CASE(UREM1) INTERP_DIV(uint8_t, val1 % val2)
+          INTERP_CASE(UREM2) INTERP_DIV(uint16_t, val1 % val2)
+          INTERP_CASE(UREM4) INTERP_DIV(uint32_t, val1 % val2)
+          INTERP_CASE(UREM8) INTERP_DIV(uint64_t, val1 % val2)
+
+          INTERP_CASE(SHL1) INTERP_BO(uint8_t, val1 << (val2 & 7))
+          INTERP_CASE(SHL2) INTERP_BO(uint16_t, val1 << (val2 & 15))
+          INTERP_CASE(SHL4) INTERP_BO(uint32_t, val1 << (val2 & 31))
+          INTERP_CASE(SHL8) INTERP_BO(uint64_t, val1 << (val2 & 63))
+
+          INTERP_CASE(SHR1) INTERP_BO(uint8_t, val1 >> (val2 & 7))
+          INTERP_CASE(SHR2) INTERP_BO(uint16_t, val1 >> (val2 & 15))
+          INTERP_CASE(SHR4) INTERP_BO(uint32_t, val1 >> (val2 & 31))
+          INTERP_CASE(SHR8) INTERP_BO(uint64_t, val1 >> (val2 & 63))
+
+          INTERP_CASE(SAR1) INTERP_BO(int8_t, val1 >> (val2 & 7))
+          INTERP_CASE(SAR2) INTERP_BO(int16_t, val1 >> (val2 & 15))
+          INTERP_CASE(SAR4) INTERP_BO(int32_t, val1 >> (val2 & 31))
+          INTERP_CASE(SAR8) INTERP_BO(int64_t, val1 >> (val2 & 63))
+
+          INTERP_CASE(AND1) INTERP_BO(uint8_t, val1 & val2)
+          INTERP_CASE(AND2) INTERP_BO(uint16_t, val1 & val2)
+          INTERP_CASE(AND4) INTERP_BO(uint32_t, val1 & val2)
+          INTERP_CASE(AND8) INTERP_BO(uint64_t, val1 & val2)
+
+          INTERP_CASE(OR1) INTERP_BO(uint8_t, val1 | val2)
+          INTERP_CASE(OR2) INTERP_BO(uint16_t, val1 | val2)
+          INTERP_CASE(OR4) INTERP_BO(uint32_t, val1 | val2)
+          INTERP_CASE(OR8) INTERP_BO(uint64_t, val1 | val2)
+
+          INTERP_CASE(XOR1) INTERP_BO(uint8_t, val1 ^ val2)
+          INTERP_CASE(XOR2) INTERP_BO(uint16_t, val1 ^ val2)
+          INTERP_CASE(XOR4) INTERP_BO(uint32_t, val1 ^ val2)
+          INTERP_CASE(XOR8) INTERP_BO(uint64_t, val1 ^ val2)
+
+          INTERP_CASE(FADD4) INTERP_BO(float, val1 + val2)
+          INTERP_CASE(FADD8) INTERP_BO(double, val1 + val2)
+
+          INTERP_CASE(FSUB4) INTERP_BO(float, val1 - val2)
+          INTERP_CASE(FSUB8) INTERP_BO(double, val1 - val2)
+
+          INTERP_CASE(FMUL4) INTERP_BO(float, val1 * val2)
+          INTERP_CASE(FMUL8) INTERP_BO(double, val1 * val2)
+
+          INTERP_CASE(FDIV4) INTERP_BO(float, val1 / val2)
+          INTERP_CASE(FDIV8) INTERP_BO(double, val1 / val2)
+
+          INTERP_CASE(JEI) {
+            uint64_t val = regWord(state, ip->regs[0]);
+            INTERP_JUMP(val == ip->params[1]);
+          }
+
+          INTERP_CASE(JGI) {
+            int64_t val = regWord(state, ip->regs[0]);
+            INTERP_JUMP(val > int64_t(ip->params[1]));
+          }
+
+          INTERP_CASE(JNGI) {
+            int64_t val = regWord(state, ip->regs[0]);
+            INTERP_JUMP(val <= int64_t(ip->params[1]));
+          }
+
+          INTERP_CASE(ADDI)
+            regWord(state, ip->regs[2]) = regWord(state, ip->regs[0]) +
+              ip->params[1];
+            ip++;
+            INTERP_NEXT;
+
+          INTERP_CASE(SUBI)
+            regWord(state, ip->regs[2]) = regWord(state, ip->regs[0]) -
+              ip->params[1];
+            ip++;
+            INTERP_NEXT;
+
+          INTERP_CASE(MULI)
+            regWord(state, ip->regs[2]) = regWord(state, ip->regs[0]) *
+              ip->params[1];
+            ip++;
+            INTERP_NEXT;
+
+#ifndef INTERP_THREADED
+            default:
+              throw BugException();
+          }
+#endif
+        }
+        catch(int64_t) {
+          cleanupInterpFrames(iproc, ip->cleanupBegin, ip->cleanupEnd,
+                              state.frame);
+          if(ip->handlerIndex == INTERP_NO_HANDLER)
+            throw;
+          ip = &instrs[ip->handlerIndex];
+        }
+    }
+
+  }
+}
@@ -0,0 +1,60 @@
+#ifndef __VM_INTERP_INCLUDED__
+#define __VM_INTERP_INCLUDED__
+
+#include <cstddef>
+#include <stdint.h>
+#include <vector>
+
+#include "vmdefs.h"
+
+namespace Ant {
+  namespace VM {
+
+    // Procedures are translated for the interpreter at unpack: registers
+    // are resolved to frame or global offsets, copy sizes are computed and
+    // every instruction knows which frames to clean up on an exception.
+
+    const size_t INTERP_NO_HANDLER = size_t(-1);
+
+    enum InterpRegKind { IRK_IO, IRK_FRAME, IRK_GLOBAL }; // for internal use
+
+    struct InterpReg { // for internal use
+      InterpRegKind kind;
+      bool ref; // frame holds a reference to the variable
+      bool nonFixed; // referenced variable keeps its element count
+      size_t offset; // of variable or reference within frame or globals
+      size_t count; // fixed element count
+      size_t eltSize;
+    };
+
+    struct InterpFrame { // for internal use
+      FrameType ftype;
+      RegId reg;
+      size_t offset, size;
+      size_t hindex;
+    };
+
+    struct InterpInstr { // for internal use
+      const void *handler; // dispatch label, if dispatch is threaded
+      OpCode opcode;
+      uint64_t params[INSTR_PARAMS_MAX];
+      InterpReg regs[INSTR_PARAMS_MAX];
+      size_t bytes; // to copy or to clear
+      size_t fieldOffset; // of variable reference within element
+      const VarSpec *vspec; // of variable reference being replaced
+      size_t branchIndex;
+      bool backEdge; // branch closes a loop
+      size_t cleanupBegin, cleanupEnd; // frames of InterpProc::cleanups
+      size_t handlerIndex;
+    };
+
+    struct InterpProc { // for internal use
+      std::vector<InterpInstr> instrs; // ends with RET
+      std::vector<InterpFrame> cleanups;
+      size_t frameBytes;
+    };
+
+  }
+}
+
+#endif // __VM_INTERP_INCLUDED__
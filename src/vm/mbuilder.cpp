@@ -258,6 +258,79 @@ namespace Ant {
       return procCons[id].instrCount++;
     }
 
+    size_t ModuleBuilder::addProcInstrs(ProcId id, const Instr *begin,
+                                        const Instr *end) {
+      ProcCon &con = procCons[assertProcExists(id)];
+      vector<VMCodeByte> &code = procs[id].code;
+      const ProcCon saved = con;
+      const size_t codeSize = code.size();
+
+      size_t size = 0;
+      for(const Instr *instr = begin; instr != end; instr++)
+        size += instr->size();
+      code.reserve(codeSize + size);
+
+      const Instr *instr = begin;
+      try {
+        for(; instr != end; instr++) {
+          if(con.instrCount >= PROC_INSTR_MAX)
+            throw RangeException();
+          instr->assertConsistency(*this, id);
+
+          code.insert(code.end(), instr->data(), instr->data() + instr->size());
+          con.instrCount++;
+        }
+      }
+      catch(const Exception &e) {
+        con = saved;
+        code.resize(codeSize);
+        throw InstrException(instr - begin, e);
+      }
+
+      return saved.instrCount;
+    }
+
+    size_t ModuleBuilder::appendProcCode(ProcId id, VMCode code, size_t size) {
+      ProcCon &con = procCons[assertProcExists(id)];
+      const ProcCon saved = con;
+
+      vector<size_t> offsets;
+      bool encoded = true;
+      try { Instr::scanOffsets(code, size, offsets); }
+      catch(const Exception&) { encoded = false; }
+
+      // instructions preceding a bad encoding are validated first, so
+      // that the index of the first failing instruction gets reported
+      size_t count = encoded ? offsets.size() : offsets.size() - 1;
+
+      Instr instr;
+      size_t index = 0;
+      try {
+        for(; index < count; index++) {
+          if(con.instrCount >= PROC_INSTR_MAX)
+            throw RangeException();
+          instr.set(code + offsets[index], code + size);
+          instr.assertConsistency(*this, id);
+
+          con.instrCount++;
+        }
+
+        if(!encoded)
+          throw EncodingException();
+      }
+      catch(const Exception &e) {
+        con = saved;
+        throw InstrException(index, e);
+      }
+
+      // code is copied only once it is validated as a whole
+      vector<VMCodeByte> &pcode = procs[id].code;
+      try { pcode.insert(pcode.end(), code, code + size); }
+      catch(...) { con = saved; throw; }
+
+      return saved.instrCount;
+    }
+
     void ModuleBuilder::assertConsistency() const {
       for(VarTypeId vtype = PRESET_VAR_TYPE_COUNT; vtype < vtypes.size();
           vtype++)
@@ -300,11 +373,16 @@ namespace Ant {
     }
 
     void ModuleBuilder::fillProcs(Runtime::ModuleData &moduleData) const {
-      size_t size = 0;
-      for(int i = 0; i < procs.size(); i++)
+      size_t size = 0, count = 0;
+      for(int i = 0; i < procs.size(); i++) {
         size += procs[i].code.size();
+        count += procCons[i].instrCount;
+      }
       moduleData.code.reserve(size);
+      moduleData.instrs.reserve(count);
 
+      vector<InstrData> instrs;
+      vector<size_t> offsets;
       for(int i = 0; i < procs.size(); i++) {
         ProcData procData;
         const Proc &proc = procs[i];
@@ -313,6 +391,18 @@ namespace Ant {
         procData.ptype = proc.ptype;
         setFixedArray(proc.code, procData.code, moduleData.code);
 
+        offsets.clear();
+        if(!proc.code.empty())
+          Instr::scanOffsets(&proc.code[0], proc.code.size(), offsets);
+
+        Instr instr;
+        instrs.resize(offsets.size());
+        for(size_t j = 0; j < instrs.size(); j++) {
+          instr.set(&proc.code[offsets[j]]);
+          instr.decode(j, offsets[j], instrs[j]);
+        }
+        setFixedArray(instrs, procData.instrs, moduleData.instrs);
+
         moduleData.procs.push_back(procData);
       }
     }
@@ -5,6 +5,7 @@
 #include <stdint.h>
 #include <vector>
 
+#include "../exception.h"
 #include "runtime.h"
 
 namespace Ant {
@@ -13,6 +14,19 @@ namespace Ant {
     class Instr;
     class Module;
 
+    // Thrown by bulk appends, what() tells why the instruction is
+    // inconsistent, as the exception it failed with does
+    class InstrException : public Exception {
+    public:
+      InstrException(size_t index, const Exception &reason)
+        : index(index), reason(reason.what()) {}
+
+      virtual const char *what() const throw() { return reason; }
+
+      size_t index; // within the appended instruction sequence
+      const char *reason; // what() of the exception it failed with
+    };
+
     class ModuleBuilder {
       friend class Instr;
     public:
@@ -44,6 +58,8 @@ namespace Ant {
       RegId addReg(uint32_t flags, VarTypeId vtype, size_t count = 1);
       ProcId addProc(uint32_t flags, ProcTypeId ptype);
       size_t addProcInstr(ProcId id, const Instr &instr);
+      size_t addProcInstrs(ProcId id, const Instr *begin, const Instr *end);
+      size_t appendProcCode(ProcId id, VMCode code, size_t size);
 
       void resetModule();
       void createModule(Module &module);
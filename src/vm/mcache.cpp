@@ -0,0 +1,169 @@
+#include <iomanip>
+#include <sstream>
+#include <stdio.h>
+
+#include "llvm/ADT/OwningPtr.h"
+#include "llvm/Bitcode/ReaderWriter.h"
+#include "llvm/LLVMContext.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Support/system_error.h"
+#include "mdata.h"
+
+namespace {
+
+  using namespace std;
+  using namespace Ant;
+  using namespace Ant::VM;
+
+  // must be changed whenever emitted code changes for the same module
+  const uint64_t CODE_CACHE_VERSION = 16;
+  const char *CODE_CACHE_SUFFIX = ".bc";
+
+  // 64-bit FNV-1a
+  class CodeCacheHash {
+  public:
+    CodeCacheHash() : hash(0xcbf29ce484222325ULL) {}
+
+    void add(const void *data, size_t size) {
+      const uint8_t *bytes = static_cast<const uint8_t*>(data);
+      for(size_t i = 0; i < size; i++)
+        hash = (hash ^ bytes[i]) * 0x100000001b3ULL;
+    }
+
+    void add(uint64_t value) { add(&value, sizeof(value)); }
+
+    void add(const string &str) {
+      add(uint64_t(str.size()));
+      add(str.data(), str.size());
+    }
+
+    void add(const VarSpec &vspec) {
+      add(uint64_t(vspec.flags));
+      add(uint64_t(vspec.vtype));
+      add(uint64_t(vspec.count));
+    }
+
+    uint64_t value() const { return hash; }
+
+  protected:
+    uint64_t hash;
+  };
+
+}
+
+namespace Ant {
+  namespace VM {
+
+    using namespace std;
+    using namespace llvm;
+
+    uint64_t Runtime::ModuleData::codeCacheKey(OptLevel level) const {
+      CodeCacheHash hash;
+
+      // environment the code has been compiled for
+      hash.add(CODE_CACHE_VERSION);
+      hash.add(uint64_t(sizeof(void*)));
+      hash.add(uint64_t(sys::isLittleEndianHost()));
+      hash.add(sys::getHostCPUName());
+#ifdef CONFIG_DEBUG
+      hash.add(uint64_t(1));
+#else
+      hash.add(uint64_t(0));
+#endif
+      hash.add(uint64_t(level));
+      hash.add(uint64_t(Runtime::instance().inlineBudget()));
+
+      // module contents, everything the emitted code depends on
+      hash.add(uint64_t(vtypes.size()));
+      for(size_t i = 0; i < vtypes.size(); i++) {
+        const VarTypeData &vtype = vtypes[i];
+
+        hash.add(uint64_t(vtype.bytes));
+        hash.add(uint64_t(vtype.vrefs.size()));
+        for(size_t j = 0; j < vtype.vrefs.size(); j++)
+          hash.add(vtype.vrefs[j]);
+        hash.add(uint64_t(vtype.prefs.size()));
+        for(size_t j = 0; j < vtype.prefs.size(); j++)
+          hash.add(uint64_t(vtype.prefs[j]));
+      }
+
+      hash.add(uint64_t(ptypes.size()));
+      for(size_t i = 0; i < ptypes.size(); i++) {
+        hash.add(uint64_t(ptypes[i].flags));
+        hash.add(uint64_t(ptypes[i].io));
+      }
+
+      hash.add(uint64_t(regs.size()));
+      for(size_t i = 0; i < regs.size(); i++)
+        hash.add(regs[i]);
+
+      hash.add(uint64_t(procs.size()));
+      for(size_t i = 0; i < procs.size(); i++) {
+        const ProcData &proc = procs[i];
+
+        hash.add(uint64_t(proc.flags));
+        hash.add(uint64_t(proc.ptype));
+        hash.add(uint64_t(proc.code.size()));
+        hash.add(proc.code.begin(), proc.code.size());
+      }
+
+      return hash.value();
+    }
+
+    string Runtime::ModuleData::codeCachePath(OptLevel level) const {
+      const string &dir = Runtime::instance().codeCacheDir();
+      if(dir.empty())
+        return string();
+
+      ostringstream out;
+      out << dir << '/' << hex << setfill('0') << setw(16)
+          << codeCacheKey(level) << CODE_CACHE_SUFFIX;
+      return out.str();
+    }
+
+    // Returns NULL if there is no usable cache entry, a damaged entry
+    // is not an error, the module is just compiled again
+    llvm::Module *Runtime::ModuleData::loadLLVMCache(const string &path,
+                                                     bool lazy) {
+      OwningPtr<MemoryBuffer> buffer;
+      if(MemoryBuffer::getFile(path, buffer))
+        return NULL;
+
+      string err;
+      llvm::Module *module;
+      if(lazy) { // module takes ownership of buffer on success
+        module = getLazyBitcodeModule(buffer.get(), getGlobalContext(), &err);
+        if(module)
+          buffer.take();
+      }
+      else module = ParseBitcodeFile(buffer.get(), getGlobalContext(), &err);
+
+      return module;
+    }
+
+    // Cache is written to a temporary file first and renamed, so a
+    // concurrently unpacked module never reads an incomplete entry
+    void Runtime::ModuleData::saveLLVMCache(const string &path) {
+      string err, tmpPath = path + '.' + string(id.str());
+
+      {
+        raw_fd_ostream out(tmpPath.c_str(), err, raw_fd_ostream::F_Binary);
+        if(!err.empty())
+          return;
+
+        WriteBitcodeToFile(llvmModule, out);
+        out.close();
+        if(out.has_error()) {
+          out.clear_error();
+          err = "write error";
+        }
+      }
+
+      if(!err.empty() || rename(tmpPath.c_str(), path.c_str()))
+        remove(tmpPath.c_str());
+    }
+
+  }
+}
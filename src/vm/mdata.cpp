@@ -1,4 +1,7 @@
+#include <algorithm>
 #include <iostream>
+#include <limits>
+#include <map>
 #include <set>
 #include <sstream>
 
@@ -9,27 +12,42 @@
 #include "llvm/Analysis/Verifier.h"
 #include "llvm/Constants.h"
 #include "llvm/ExecutionEngine/JIT.h"
+#include "llvm/GVMaterializer.h"
 #include "llvm/LLVMContext.h"
 #include "llvm/DerivedTypes.h"
 #include "llvm/Intrinsics.h"
+#include "llvm/Support/MutexGuard.h"
 #include "llvm/Target/TargetData.h"
 #include "llvm/Target/TargetOptions.h"
 #include "llvm/Support/TargetSelect.h"
+#include "llvm/Transforms/IPO.h"
 #include "llvm/Transforms/Scalar.h"
+#include "llvm/Transforms/Utils/Cloning.h"
 #include "mdata.h"
 
 namespace {
 
   using namespace std;
+  using namespace Ant;
   using namespace Ant::VM;
 
   const char *ZTI_VAR_NAME = "_ZTIx";
   const char *THROW_FUNC_NAME = "throw";
   const char *CXA_EALLOC_FUNC_NAME = "__cxa_allocate_exception";
   const char *CXA_THROW_FUNC_NAME = "__cxa_throw";
-  const char *GXX_PERS_FUNC_NAME = "__gxx_personality_v0";
   const char *DESTROY_FUNC_NAME = "ant_vm_destroy_variable";
   const char *TRACE_FUNC_NAME = "ant_vm_trace";
+  const char *RANGE_CHECKS_VAR_NAME = "ant_vm_range_checks";
+  const char *VTYPES_VAR_NAME = "ant_vm_vtypes";
+  const char *VSPECS_VAR_NAME = "ant_vm_vspecs";
+  const char *COUNTERS_VAR_NAME = "ant_vm_counters";
+  const char *MDATA_VAR_NAME = "ant_vm_mdata";
+  const char *PROMOTE_FUNC_NAME = "ant_vm_promote";
+
+  const size_t NO_BLOCK_PRED = size_t(-1), MANY_BLOCK_PREDS = size_t(-2);
+  const size_t CLEANUP_UNROLLED_MAX = 16; // references of a frame
+  const uint64_t ZERO_STORE_MAX = 64; // bytes of a frame zeroed by stores
+  const unsigned ARRAY_VECTOR_WIDTH = 2; // words SSE2 adds at a time
 
   inline string funcName(ProcId proc) {
     ostringstream out;
@@ -37,12 +55,311 @@ namespace {
     return out.str();
   }
 
+  inline string entryName(ProcId proc) {
+    ostringstream out;
+    out << 'e' << proc;
+    return out.str();
+  }
+
   inline string varName(RegId reg) {
     ostringstream out;
     out << 'v' << reg;
     return out.str();
   }
 
+  // whether a procedure calls another one, directly or indirectly,
+  // callees[proc] are the procedures proc calls directly
+  bool reachesProc(const vector<set<ProcId> > &callees, ProcId from,
+                   ProcId to) {
+    vector<bool> visited(callees.size(), false);
+    vector<ProcId> stack(callees[from].begin(), callees[from].end());
+
+    while(!stack.empty()) {
+      ProcId proc = stack.back();
+      stack.pop_back();
+
+      if(proc == to)
+        return true;
+      if(visited[proc])
+        continue;
+
+      visited[proc] = true;
+      stack.insert(stack.end(), callees[proc].begin(), callees[proc].end());
+    }
+
+    return false;
+  }
+
+  const size_t GLOBAL_FRAME = size_t(-1);
+  const RegId HAND_FRAME_REG = RegId(-1);
+
+  // register as resolved to a frame or a global
+  struct LoopReg { // for internal use
+    RegId reg;
+    size_t frame;
+
+    bool operator==(const LoopReg &lreg) const {
+      return reg == lreg.reg && frame == lreg.frame;
+    }
+    bool operator<(const LoopReg &lreg) const {
+      return reg < lreg.reg || (reg == lreg.reg && frame < lreg.frame);
+    }
+  };
+
+  // Loop stepping its index by one towards a bound, the index is in
+  // [min(first, bound), first] or [first, max(first, bound)] before the
+  // step, the bound is one step closer if it is exclusive
+  struct RangeLoop { // for internal use
+    LoopReg index, bound; // bound is not a register if immBound
+    bool down, immBound, inclusive;
+    int64_t boundImm;
+    // frames accessed at index, not loaded in loop, and whether they are
+    // accessed after the step, at an index one step further
+    map<LoopReg, bool> arrays;
+    vector<size_t> accesses; // LDE and STE instructions
+  };
+
+  LoopReg loopReg(const vector<RegId> &frames, uint64_t reg) {
+    LoopReg lreg = { RegId(reg), GLOBAL_FRAME };
+    for(size_t i = frames.size(); i > 0; i--)
+      if(frames[i - 1] == lreg.reg) {
+        lreg.frame = i - 1;
+        break;
+      }
+    return lreg;
+  }
+
+  // parameter the instruction stores to, INSTR_PARAMS_MAX if none
+  size_t storedParam(const InstrData &instr) {
+    switch(instr.opcode) {
+      case OPCODE_INC: case OPCODE_DEC:
+        return 0;
+      case OPCODE_CPI1: case OPCODE_CPI2: case OPCODE_CPI4: case OPCODE_CPI8:
+      case OPCODE_CPB: case OPCODE_STE: case OPCODE_STB: case OPCODE_STR:
+      case OPCODE_ARSUM: case OPCODE_ARMIN: case OPCODE_ARMAX:
+      case OPCODE_AFILL:
+        return 1;
+      case OPCODE_ADD: case OPCODE_SUB: case OPCODE_MUL: case OPCODE_LDE:
+      case OPCODE_LDB: case OPCODE_LDR: case OPCODE_AADD: case OPCODE_ASUB:
+      case OPCODE_AMUL: case OPCODE_AMIN: case OPCODE_AMAX: case OPCODE_ACMPE:
+      case OPCODE_ACMPG:
+      case OPCODE_ADD1: case OPCODE_ADD2: case OPCODE_ADD4:
+      case OPCODE_SUB1: case OPCODE_SUB2: case OPCODE_SUB4:
+      case OPCODE_MUL1: case OPCODE_MUL2: case OPCODE_MUL4:
+      case OPCODE_SDIV1: case OPCODE_SDIV2: case OPCODE_SDIV4:
+      case OPCODE_SDIV8: case OPCODE_UDIV1: case OPCODE_UDIV2:
+      case OPCODE_UDIV4: case OPCODE_UDIV8: case OPCODE_SREM1:
+      case OPCODE_SREM2: case OPCODE_SREM4: case OPCODE_SREM8:
+      case OPCODE_UREM1: case OPCODE_UREM2: case OPCODE_UREM4:
+      case OPCODE_UREM8: case OPCODE_SHL1: case OPCODE_SHL2:
+      case OPCODE_SHL4: case OPCODE_SHL8: case OPCODE_SHR1:
+      case OPCODE_SHR2: case OPCODE_SHR4: case OPCODE_SHR8:
+      case OPCODE_SAR1: case OPCODE_SAR2: case OPCODE_SAR4:
+      case OPCODE_SAR8: case OPCODE_AND1: case OPCODE_AND2:
+      case OPCODE_AND4: case OPCODE_AND8: case OPCODE_OR1: case OPCODE_OR2:
+      case OPCODE_OR4: case OPCODE_OR8: case OPCODE_XOR1: case OPCODE_XOR2:
+      case OPCODE_XOR4: case OPCODE_XOR8: case OPCODE_FADD4:
+      case OPCODE_FADD8: case OPCODE_FSUB4: case OPCODE_FSUB8:
+      case OPCODE_FMUL4: case OPCODE_FMUL8: case OPCODE_FDIV4:
+      case OPCODE_FDIV8: case OPCODE_ADDI: case OPCODE_SUBI:
+      case OPCODE_MULI:
+        return 2;
+      default:
+        return INSTR_PARAMS_MAX;
+    }
+  }
+
+  // Innermost loop from head to its single latch, JNG, JG, JNGI or JGI,
+  // entered only from above, without calls and with frames of head kept
+  bool findRangeLoop(const FixedArray<InstrData> &instrs, size_t head,
+                     vector<RegId> frames, RangeLoop &loop) {
+    OpCode above = instrs[head - 1].opcode;
+    if(above == OPCODE_JMP || above == OPCODE_THROW || above == OPCODE_RET)
+      return false;
+
+    size_t latch = 0;
+    for(size_t i = head; i < instrs.size(); i++)
+      if(instrs[i].branches && instrs[i].opcode != OPCODE_RET &&
+         instrs[i].branchIndex == head) {
+        if(latch)
+          return false;
+        latch = i;
+      }
+    if(!latch)
+      return false;
+    OpCode lop = instrs[latch].opcode;
+    if(lop != OPCODE_JNG && lop != OPCODE_JG && lop != OPCODE_JNGI &&
+       lop != OPCODE_JGI)
+      return false;
+
+    for(size_t i = 0; i < instrs.size(); i++) {
+      const InstrData &instr = instrs[i];
+      if(!instr.branches || instr.opcode == OPCODE_RET || i == latch)
+        continue;
+
+      size_t bi = instr.branchIndex;
+      if(i >= head && i < latch) { // no inner loops
+        if(bi >= head && bi <= i)
+          return false;
+      }
+      else if(bi == head) { // the instruction above falls through anyway
+        if(i + 1 != head || instr.opcode == OPCODE_PUSHH)
+          return false;
+      }
+      else if(bi > head && bi <= latch)
+        return false;
+    }
+
+    size_t headFrames = frames.size();
+    vector<pair<size_t, LoopReg> > stores;
+    map<size_t, pair<LoopReg, LoopReg> > accesses;
+    for(size_t i = head; i < latch; i++) {
+      const InstrData &instr = instrs[i];
+      switch(instr.opcode) {
+        case OPCODE_PUSH: case OPCODE_PUSHR:
+          frames.push_back(RegId(instr.params[0]));
+          break;
+        case OPCODE_POP:
+          if(frames.size() == headFrames)
+            return false;
+          frames.pop_back();
+          break;
+        case OPCODE_PUSHH: case OPCODE_CALL:
+          return false;
+        case OPCODE_LDE:
+          accesses[i] = make_pair(loopReg(frames, instr.params[1]),
+                                  loopReg(frames, instr.params[0]));
+          break;
+        case OPCODE_STE:
+          accesses[i] = make_pair(loopReg(frames, instr.params[2]),
+                                  loopReg(frames, instr.params[1]));
+          break;
+        default:
+          break;
+      }
+
+      size_t p = storedParam(instr);
+      if(p != INSTR_PARAMS_MAX)
+        stores.push_back(make_pair(i, loopReg(frames, instr.params[p])));
+    }
+
+    // JNG continues while p0 <= p1, JG while p0 > p1, an immediate p1
+    // can only be the bound
+    loop.immBound = lop == OPCODE_JNGI || lop == OPCODE_JGI;
+    loop.inclusive = lop == OPCODE_JNG || lop == OPCODE_JNGI;
+    loop.boundImm = int64_t(instrs[latch].params[1]);
+    LoopReg p0 = loopReg(frames, instrs[latch].params[0]), p1 = p0;
+    if(!loop.immBound)
+      p1 = loopReg(frames, instrs[latch].params[1]);
+    for(int down = 0; down < 2; down++) {
+      bool first = (lop == OPCODE_JNG || lop == OPCODE_JNGI) == !down;
+      if(loop.immBound && !first)
+        continue;
+      loop.index = first ? p0 : p1;
+      loop.bound = first ? p1 : p0;
+      loop.down = down;
+      if(!loop.immBound && loop.index == loop.bound)
+        continue;
+
+      OpCode step = down ? OPCODE_DEC : OPCODE_INC;
+      size_t steps = 0, others = 0, stepIndex = 0;
+      for(size_t i = 0; i < stores.size(); i++) {
+        if(stores[i].second == loop.index &&
+           instrs[stores[i].first].opcode == step)
+          steps++, stepIndex = stores[i].first;
+        else if(stores[i].second == loop.index ||
+                (!loop.immBound && stores[i].second == loop.bound))
+          others++;
+      }
+      if(steps != 1 || others)
+        continue;
+
+      set<LoopReg> loaded;
+      for(size_t i = 0; i < stores.size(); i++)
+        if(instrs[stores[i].first].opcode == OPCODE_LDR)
+          loaded.insert(stores[i].second);
+
+      loop.arrays.clear();
+      loop.accesses.clear();
+      map<size_t, pair<LoopReg, LoopReg> >::iterator iter;
+      for(iter = accesses.begin(); iter != accesses.end(); iter++) {
+        const LoopReg &array = iter->second.second;
+        if(iter->second.first == loop.index && !loaded.count(array) &&
+           array.frame < headFrames) {
+          // a branch may skip the step, so an access after it sees either
+          bool &after = loop.arrays[array];
+          after = after || iter->first > stepIndex;
+          loop.accesses.push_back(iter->first);
+        }
+      }
+      if(!loop.accesses.empty())
+        return true;
+    }
+
+    return false;
+  }
+
+  // Reference frame pushed at push is borrowed if it is loaded once from
+  // a frame below or a global, and no reference may be replaced and no
+  // procedure called until it is popped; the variable outlives it then
+  bool isBorrowedFrame(const FixedArray<InstrData> &instrs, size_t push,
+                       vector<RegId> frames) {
+    size_t frame = frames.size() - 1, load = 0;
+    for(size_t i = push + 1; i < instrs.size(); i++) {
+      const InstrData &instr = instrs[i];
+      switch(instr.opcode) {
+        case OPCODE_PUSH: case OPCODE_PUSHR:
+          frames.push_back(RegId(instr.params[0]));
+          break;
+        case OPCODE_PUSHH:
+          frames.push_back(HAND_FRAME_REG);
+          break;
+        case OPCODE_POP:
+          frames.pop_back();
+          if(frames.size() == frame)
+            return load != 0;
+          break;
+        case OPCODE_CALL: case OPCODE_STR:
+          if(load)
+            return false;
+          break;
+        case OPCODE_LDR:
+          if(load)
+            return false;
+          if(loopReg(frames, instr.params[2]).frame == frame) {
+            size_t from = loopReg(frames, instr.params[0]).frame;
+            if(from >= frame && from != GLOBAL_FRAME)
+              return false;
+            load = i;
+          }
+          break;
+        default:
+          break;
+      }
+
+      // code before the load never runs again after it
+      if(load && instr.branches && instr.opcode != OPCODE_RET &&
+         instr.branchIndex <= load)
+        return false;
+    }
+
+    return false;
+  }
+
+  // POPs between a CALL of the procedure itself and RET, or 0 if other
+  // instructions follow the call
+  size_t selfTailPops(const FixedArray<InstrData> &instrs, ProcId proc,
+                      size_t call) {
+    if(instrs[call].opcode != OPCODE_CALL || instrs[call].params[0] != proc)
+      return 0;
+
+    size_t i = call + 1;
+    while(i < instrs.size() && instrs[i].opcode == OPCODE_POP)
+      i++;
+    return i < instrs.size() && instrs[i].opcode == OPCODE_RET ?
+      i - call - 1 : 0;
+  }
+
 }
 
 namespace Ant {
@@ -52,44 +369,96 @@ namespace Ant {
     using namespace llvm;
 
     struct Runtime::ModuleData::LLVMContext {
-      struct Frame {
+      // what is known about a reference frame where it is used; values
+      // must dominate the use, so they are only passed on to a block from
+      // its single predecessor
+      struct Facts {
+        Value *known; // reference loaded and checked not to be null
+        Value *count; // element count of the referenced variable
+      };
+
+      struct Frame : Facts {
         FrameType ftype;
         RegId reg;
-        Value *sptr;
+        Value *slot; // i8* to the entry block alloca, NULL for io
         Value *vptr;
         size_t hindex;
         BasicBlock *ublock;
+        bool borrowed; // reference is not counted, a frame below keeps it
+
+        void forget() { known = count = NULL; }
       };
 
+
       Frame *findFrame(RegId reg) {
         for(int i = frames.size() - 1; i >= 0; i--)
           if(frames[i].ftype != FT_HAND && frames[i].reg == reg)
             return &frames[i];
         return NULL;
       }
-      void pushRegFrame(bool ref, RegId reg, Value *sptr, Value *vptr) {
+      void pushRegFrame(bool ref, RegId reg, Value *slot, Value *vptr) {
         frames.push_back(Frame());
+        frames.back().forget();
         frames.back().ftype = ref ? FT_REGR : FT_REGNR;
         frames.back().reg = reg;
-        frames.back().sptr = sptr;
+        frames.back().slot = slot;
         frames.back().vptr = vptr;
         frames.back().ublock = NULL;
+        frames.back().borrowed = false;
       }
       void pushHandFrame(size_t hindex) {
         frames.push_back(Frame());
+        frames.back().forget();
         frames.back().ftype = FT_HAND;
         frames.back().hindex = hindex;
         frames.back().ublock = NULL;
+        frames.back().borrowed = false;
       }
 
       void popFrame() { frames.pop_back(); }
 
-      BasicBlock *branchBlock(size_t instrIndex) {
+      // registers of frames as bytecode analyses resolve them
+      vector<RegId> frameRegs() const {
+        vector<RegId> regs;
+        for(size_t i = 0; i < frames.size(); i++)
+          regs.push_back(frames[i].ftype == FT_HAND ? HAND_FRAME_REG
+                         : frames[i].reg);
+        return regs;
+      }
+
+      void forgetFacts() {
+        for(size_t i = 0; i < frames.size(); i++)
+          frames[i].forget();
+      }
+      // called when code of the next block is going to be emitted
+      void passFacts() {
+        vector<Facts> &facts = blockFacts[blockIndex];
+        facts.assign(frames.begin(), frames.end());
+
+        size_t pred = blockPreds[blockIndex + 1];
+        if(pred == blockIndex) // falls through from the current block
+          return;
+        if(pred >= blockIndex || blockFacts[pred].size() != frames.size()) {
+          forgetFacts();
+          return;
+        }
+        for(size_t i = 0; i < frames.size(); i++)
+          static_cast<Facts&>(frames[i]) = blockFacts[pred][i];
+      }
+
+      size_t blockOf(size_t instrIndex) {
         vector<size_t>::iterator iter = lower_bound(blockIndexes.begin(),
                                                     blockIndexes.end(),
                                                     instrIndex);
         ASSERT(iter != blockIndexes.end() && *iter == instrIndex);
-        return blocks[distance(blockIndexes.begin(), iter)];
+        return distance(blockIndexes.begin(), iter);
+      }
+      BasicBlock *branchBlock(size_t instrIndex) {
+        return blocks[blockOf(instrIndex)];
+      }
+      void addBlockPred(size_t block, size_t pred) {
+        size_t &p = blockPreds[block];
+        p = p == NO_BLOCK_PRED || p == pred ? pred : MANY_BLOCK_PREDS;
       }
 
       ProcId proc;
@@ -98,15 +467,84 @@ namespace Ant {
       std::vector<size_t> blockIndexes;
       std::vector<llvm::BasicBlock*> blocks;
       BasicBlock *currentBlock; // sometimes != blocks[blockIndex]
+      BasicBlock *entryBlock; // static allocas of all frames
       std::vector<Frame> frames;
+      std::vector<size_t> blockPreds; // the single one if there is one
+      std::vector<std::vector<Facts> > blockFacts; // at end of each block
+      std::map<size_t, Value*> inRange; // of LDE and STE index, by loop
+      PHINode *tailIO; // io passed by the caller or by a self tail call
+      Value *tailSlots[2]; // io variables self tail calls take turns in
+    };
+
+    // Emits procedure bodies on demand, the JIT asks for them when
+    // a procedure is called for the first time
+    struct Runtime::ModuleData::LLVMMaterializer : GVMaterializer {
+      LLVMMaterializer(ModuleData &moduleData) : moduleData(moduleData) {
+        for(ProcId proc = 0; proc < moduleData.procs.size(); proc++)
+          funcs[moduleData.llvmModule->getFunction(funcName(proc))] = proc;
+      }
+
+      bool isMaterializable(const GlobalValue *gv) const {
+        const Function *func = dyn_cast<Function>(gv);
+        return func && func->empty() && funcs.count(func);
+      }
+      bool isDematerializable(const GlobalValue *gv) const { return false; }
+
+      bool Materialize(GlobalValue *gv, string *errInfo) {
+        if(!isMaterializable(gv))
+          return false;
+
+        Function *func = cast<Function>(gv);
+        if(moduleData.lazy) // compileLazyProc() holds llvmMutex already
+          return emit(func, errInfo);
+
+        // called on the thread that invokes a procedure for the first time
+        MutexLock lock(Runtime::instance().llvmMutex);
+        return emit(func, errInfo);
+      }
+
+      bool emit(Function *func, string *errInfo) {
+        try {
+          moduleData.emitLLVMFunc(funcs[func], func);
+#ifdef CONFIG_DEBUG
+          if(verifyFunction(*func, PrintMessageAction))
+            throw BugException();
+#endif
+        }
+        catch(const exception &e) {
+          if(errInfo)
+            *errInfo = e.what();
+          return true;
+        }
+
+        return false;
+      }
+
+      bool MaterializeModule(llvm::Module *module, string *errInfo) {
+        std::map<const Function*, ProcId>::iterator i;
+        for(i = funcs.begin(); i != funcs.end(); i++)
+          if(Materialize(const_cast<Function*>(i->first), errInfo))
+            return true;
+        return false;
+      }
+
+      ModuleData &moduleData;
+      std::map<const Function*, ProcId> funcs;
     };
 
     Runtime::ModuleData::ModuleData(const UUID &id)
-      : id(id), dropped(false), llvmModule(NULL), llvmFPM(NULL), llvmEE(NULL) {
+      : id(id), dropped(false), unpackPending(false), image(NULL),
+        imageSize(0), interpreted(false), tiered(false), lazy(false),
+        llvmModule(NULL), llvmFPM(NULL), llvmBaseFPM(NULL), llvmEE(NULL),
+        optLevel(OPT_O0) {
       InitializeNativeTarget();
       JITExceptionHandling = true;
     }
 
+    Runtime::ModuleData::~ModuleData() {
+      unmap();
+    }
+
     void Runtime::ModuleData::assertNotDropped() const {
       if(isDropped())
         throw NotFoundException();
@@ -184,7 +622,7 @@ namespace Ant {
 
     bool Runtime::ModuleData::isPacked() const {
       assertNotDropped();
-      return !llvmModule;
+      return isUnpacking() || (!llvmModule && !interpreted);
     }
 
     bool Runtime::ModuleData::isDropped() const {
@@ -194,11 +632,28 @@ namespace Ant {
     void Runtime::ModuleData::pack() {
       assertNotDropped();
 
+      waitUnpacked();
+      releaseInterp();
+      MutexLock lock(Runtime::instance().llvmMutex);
+      releaseLLVM();
+    }
+
+    void Runtime::ModuleData::releaseLLVM() {
       if(llvmModule) {
+        natives.set(NULL, 0);
+        nativeProcs.clear();
+        vspecPtrs.clear();
+        tiered = false;
+        procTiers.clear();
+        lazy = false;
+        procCounters.clear();
+
         delete llvmEE;
         llvmEE = NULL;
         delete llvmFPM;
         llvmFPM = NULL;
+        delete llvmBaseFPM;
+        llvmBaseFPM = NULL;
         // llvmEE already deleted llvmModule
         llvmModule = NULL;
       }
@@ -220,24 +675,41 @@ namespace Ant {
       return StructType::get(llvmModule->getContext(), fields, false);
     }
 
+    // integer of the same width, unless the value is floating-point
+    template<class VAL> Type *Runtime::ModuleData::getValLLVMType() const {
+      if(numeric_limits<VAL>::is_integer)
+        return TYPE_INT(sizeof(VAL) * 8);
+      else if(sizeof(VAL) == sizeof(float))
+        return Type::getFloatTy(llvmModule->getContext());
+      else return Type::getDoubleTy(llvmModule->getContext());
+    }
+
 #define CF context.func
 #define CB context.currentBlock
 
+#define CONST_INT(bits, val, signed) \
+  ConstantInt::get(llvmModule->getContext(), APInt(bits, val, signed))
+#define BITCAST_PINT(bits, vptr, block) \
+    new BitCastInst(vptr, TYPE_PTR(TYPE_INT(bits)), "", block)
+#define CALL_FUNC(block, var, func, args) \
+    CallInst *var = CallInst::Create(func, args, "", block); \
+    var->setCallingConv(func->getCallingConv());
+#define BITCAST_PARR(bytes, vptr, block) \
+    new BitCastInst(vptr, TYPE_PTR(TYPE_BARR(bytes)), "", block)
+
     void Runtime::ModuleData::prepareLLVMContext(LLVMContext &context) {
+      const FixedArray<InstrData> &instrs = procs[context.proc].instrs;
       bool newBlock = false;
       set<size_t> indexes;
-      Instr instr;
       indexes.insert(0);
-      for(size_t i = 0, j = 0; j < procs[context.proc].code.size();
-          i++, j += instr.size()) {
+      for(size_t i = 0; i < instrs.size(); i++) {
         if(newBlock) {
           indexes.insert(i);
           newBlock = false;
         }
 
-        instr.set(&procs[context.proc].code[j]);
-        if(instr.branches()) {
-          size_t bi = instr.branchIndex(i);
+        if(instrs[i].branches) {
+          size_t bi = instrs[i].branchIndex;
           if(bi != i + 1) // this line prevents an unnecessary ending block
             indexes.insert(bi);
           newBlock = true;
@@ -246,40 +718,81 @@ namespace Ant {
       context.blockIndexes.assign(indexes.begin(), indexes.end());
       sort(context.blockIndexes.begin(), context.blockIndexes.end());
 
+      context.entryBlock = BasicBlock::Create(llvmModule->getContext(), "",
+                                              CF, 0);
       context.blocks.reserve(context.blockIndexes.size());
       for(size_t i = 0; i < context.blockIndexes.size(); i++)
         context.blocks.push_back(BasicBlock::Create(llvmModule->getContext(),
                                                     "", CF, 0));
+      BranchInst::Create(context.blocks[0], context.entryBlock);
       CB = context.blocks[0];
 
+      // self tail calls loop back to the first block with a new io
+      Value *io = CF->arg_begin();
+      for(size_t i = 0; i < instrs.size(); i++)
+        if(selfTailPops(instrs, context.proc, i)) {
+          RegId ioReg = ptypes[procs[context.proc].ptype].io;
+          Type *type = getEltLLVMType(regs[ioReg].vtype);
+          ArrayType *atype = ArrayType::get(type, regs[ioReg].count);
+          Instruction *entry = context.entryBlock->getTerminator();
+          vector<Value*> indexes(2, CONST_INT(32, 0, false));
+          for(int slot = 0; slot < 2; slot++) {
+            Value *aptr = new AllocaInst(atype, "", entry);
+            context.tailSlots[slot] = GetElementPtrInst::Create(aptr, indexes,
+                                                                "", entry);
+          }
+
+          BasicBlock *lblock = BasicBlock::Create(llvmModule->getContext(), "",
+                                                  CF, context.blocks[0]);
+          entry->setSuccessor(0, lblock);
+          context.tailIO = PHINode::Create(io->getType(), 2, "", lblock);
+          context.tailIO->addIncoming(io, context.entryBlock);
+          BranchInst::Create(context.blocks[0], lblock);
+          io = context.tailIO;
+          break;
+        }
+
+      // handlers are entered from landing pads, the first block from the
+      // entry block
+      size_t blockCount = context.blocks.size();
+      context.blockPreds.assign(blockCount, NO_BLOCK_PRED);
+      context.blockPreds[0] = MANY_BLOCK_PREDS;
+      for(size_t b = 0; b < blockCount; b++) {
+        size_t end = b + 1 < blockCount ? context.blockIndexes[b + 1]
+          : instrs.size();
+        if(end == context.blockIndexes[b])
+          continue;
+
+        const InstrData &last = instrs[end - 1];
+        if(last.opcode == OPCODE_PUSHH)
+          context.blockPreds[context.blockOf(last.branchIndex)] =
+            MANY_BLOCK_PREDS;
+        else if(last.branches && last.opcode != OPCODE_RET)
+          context.addBlockPred(context.blockOf(last.branchIndex), b);
+
+        if(last.opcode != OPCODE_JMP && last.opcode != OPCODE_RET &&
+           b + 1 < blockCount)
+          context.addBlockPred(b + 1, b);
+      }
+      context.blockFacts.resize(blockCount);
+
       context.pushRegFrame(false, ptypes[procs[context.proc].ptype].io, NULL,
-                           CF->arg_begin());
+                           io);
     }
 
-#define CONST_INT(bits, val, signed) \
-  ConstantInt::get(llvmModule->getContext(), APInt(bits, val, signed))
-#define BITCAST_PINT(bits, vptr, block) \
-    new BitCastInst(vptr, TYPE_PTR(TYPE_INT(bits)), "", block)
-#define CALL_FUNC(block, var, func, args) \
-    CallInst *var = CallInst::Create(func, args, "", block); \
-    var->setCallingConv(func->getCallingConv());
-
-    void Runtime::ModuleData::emitThrowIfNot(Function *func,BasicBlock *&block,
+    void Runtime::ModuleData::emitThrowIfNot(LLVMContext &context,
                                              Value *cond, int64_t edValue) {
       BasicBlock *fblock = BasicBlock::Create(llvmModule->getContext(), "",
-                                              func, 0);
-      Function *thrw = llvmModule->getFunction(THROW_FUNC_NAME);
-      vector<Value*> args(1, CONST_INT(64, edValue, true));
+                                              CF, 0);
       Value *edptr =llvmModule->getGlobalVariable(varName(PRESET_REG_ED),true);
       edptr = BITCAST_PINT(64, edptr, fblock);
-      new StoreInst(args[0], edptr, fblock);
-      CALL_FUNC(fblock, call, thrw, args);
-      new UnreachableInst(llvmModule->getContext(), fblock);
+      new StoreInst(CONST_INT(64, edValue, true), edptr, fblock);
+      BranchInst::Create(emitUnwindBlock(context), fblock);
 
       BasicBlock *tblock = BasicBlock::Create(llvmModule->getContext(), "",
-                                              func, 0);
-      BranchInst::Create(tblock, fblock, cond, block);
-      block = tblock;
+                                              CF, 0);
+      BranchInst::Create(tblock, fblock, cond, CB);
+      CB = tblock;
     }
 
     Value *Runtime::ModuleData::emitSpecialPtr(BasicBlock *block, Value *vptr,
@@ -289,10 +802,11 @@ namespace Ant {
       return GetElementPtrInst::Create(iptr, index, "", block);
     }
 
-    Value *Runtime::ModuleData::emitElementPtr(Function *func,
-                                               BasicBlock *&block, RegId reg,
-                                               bool ref,Value *vptr,
-                                               size_t eltc, Value *eltv) {
+    Value *Runtime::ModuleData::emitElementPtr(LLVMContext &context,
+                                               RegId reg, bool ref,
+                                               Value *vptr, size_t eltc,
+                                               Value *eltv, Value *ecval,
+                                               Value *inRange) {
       bool runtimeCheck = eltv ||
         (ref && regs[reg].flags & VFLAG_NON_FIXED_REF);
 
@@ -301,16 +815,22 @@ namespace Ant {
           eltv = CONST_INT(64, uint64_t(eltc), false);
 
         if(runtimeCheck) {
-          Value *ecval;
-          if(regs[reg].flags & VFLAG_NON_FIXED_REF)
-            ecval = new LoadInst(emitSpecialPtr(block, vptr, SFLD_ELT_COUNT),
-                                 "", block);
-          else ecval = CONST_INT(64, uint64_t(regs[reg].count), false);
-
-          Value *cond = new ICmpInst(*block, ICmpInst::ICMP_ULT, eltv, ecval);
-          emitThrowIfNot(func, block, cond, VMECODE_RANGE);
+          if(!ecval) {
+            if(regs[reg].flags & VFLAG_NON_FIXED_REF)
+              ecval = new LoadInst(emitSpecialPtr(CB, vptr, SFLD_ELT_COUNT),
+                                   "", CB);
+            else ecval = CONST_INT(64, uint64_t(regs[reg].count), false);
+          }
+
+#ifdef CONFIG_DEBUG
+          emitRangeCheckCount(CB, inRange);
+#endif
+          Value *cond = new ICmpInst(*CB, ICmpInst::ICMP_ULT, eltv, ecval);
+          if(inRange) // loop unswitching drops the check where it holds
+            cond = BinaryOperator::CreateOr(inRange, cond, "", CB);
+          emitThrowIfNot(context, cond, VMECODE_RANGE);
         }
-        return GetElementPtrInst::Create(vptr, eltv, "", block);
+        return GetElementPtrInst::Create(vptr, eltv, "", CB);
       }
       else return vptr;
     }
@@ -336,25 +856,40 @@ namespace Ant {
       return GetElementPtrInst::Create(vptr, indexes, "", block);
     }
 
+    // reference is loaded and checked once until it may change
+    Value *Runtime::ModuleData::emitRefValue(LLVMContext &context,
+                                             RegId reg) {
+      LLVMContext::Frame &frame = *context.findFrame(reg);
+      if(!frame.known) {
+        Value *vptr = new LoadInst(frame.vptr, "", CB);
+        PointerType *ptype = static_cast<PointerType*>(vptr->getType());
+        Constant *null = ConstantPointerNull::get(ptype);
+        Value *cond = new ICmpInst(*CB, ICmpInst::ICMP_NE, vptr, null);
+        emitThrowIfNot(context, cond, VMECODE_NULL_REFERENCE);
+        frame.known = vptr;
+      }
+
+      if(!frame.count && regs[reg].flags & VFLAG_NON_FIXED_REF)
+        frame.count = new LoadInst(emitSpecialPtr(CB, frame.known,
+                                                  SFLD_ELT_COUNT), "", CB);
+      return frame.known;
+    }
+
     Value *Runtime::ModuleData::emitRegValue(LLVMContext &context, RegId reg,
                                              bool dereferenceIfNeeded,
-                                             size_t eltc, Value *eltv) {
+                                             size_t eltc, Value *eltv,
+                                             Value *inRange) {
       LLVMContext::Frame *frame = context.findFrame(reg);
       if(frame) {
         Value *vptr = frame->vptr;
         if(frame->ftype == FT_REGR) {
           if(!dereferenceIfNeeded)
             return vptr;
-
-          vptr = new LoadInst(vptr, "", CB);
-          PointerType *ptype = static_cast<PointerType*>(vptr->getType());
-          Constant *null = ConstantPointerNull::get(ptype);
-          Value *cond = new ICmpInst(*CB, ICmpInst::ICMP_NE, vptr, null);
-          emitThrowIfNot(CF, CB, cond, VMECODE_NULL_REFERENCE);
+          vptr = emitRefValue(context, reg);
         }
 
-        return emitElementPtr(CF, CB, reg, frame->ftype == FT_REGR, vptr, eltc,
-                              eltv);
+        return emitElementPtr(context, reg, frame->ftype == FT_REGR, vptr,
+                              eltc, eltv, frame->count, inRange);
       }
       else {
         Value *vptr = llvmModule->getGlobalVariable(varName(reg), true);
@@ -363,123 +898,345 @@ namespace Ant {
       }
     }
 
-    template<uint8_t OP, Instruction::BinaryOps IOP, uint64_t CO>
+    template<Instruction::BinaryOps IOP, uint64_t CO>
       void Runtime::ModuleData::emitLLVMCodeUO(LLVMContext &context,
-                                               const UOInstrT<OP> &instr) {
-      Value *it = BITCAST_PINT(64, emitRegValue(context, instr.it()), CB);
+                                               const InstrData &instr) {
+      RegId i = RegId(instr.params[0]);
+      Value *it = BITCAST_PINT(64, emitRegValue(context, i), CB);
       Value *val = new LoadInst(it, "", CB);
       Value *co = CONST_INT(64, CO, false);
       val = BinaryOperator::Create(IOP, val, co, "", CB);
       new StoreInst(val, it, CB);
     }
 
-    template<uint8_t OP, Instruction::BinaryOps IOP>
+    template<Instruction::BinaryOps IOP, class VAL>
       void Runtime::ModuleData::emitLLVMCodeBO(LLVMContext &context,
-                                               const BOInstrT<OP> &instr) {
-      Value *operand1 =
-        BITCAST_PINT(64, emitRegValue(context, instr.operand1()), CB);
-      Value *operand2 =
-        BITCAST_PINT(64, emitRegValue(context, instr.operand2()), CB);
-      Value *result =
-        BITCAST_PINT(64, emitRegValue(context, instr.result()), CB);
+                                               const InstrData &instr) {
+      RegId o1 = RegId(instr.params[0]), o2 = RegId(instr.params[1]);
+      RegId r = RegId(instr.params[2]);
+      Type *ptype = TYPE_PTR(getValLLVMType<VAL>());
+      Value *operand1 = new BitCastInst(emitRegValue(context, o1), ptype, "",
+                                        CB);
+      Value *operand2 = new BitCastInst(emitRegValue(context, o2), ptype, "",
+                                        CB);
+      Value *result = new BitCastInst(emitRegValue(context, r), ptype, "", CB);
       Value *val1 = new LoadInst(operand1, "", CB);
       Value *val2 = new LoadInst(operand2, "", CB);
+
+      // shift count is taken modulo width, larger shifts are undefined
+      if(IOP == Instruction::Shl || IOP == Instruction::LShr ||
+         IOP == Instruction::AShr) {
+        unsigned bits = sizeof(VAL) * 8;
+        val2 = BinaryOperator::Create(Instruction::And, val2,
+                                      CONST_INT(bits, bits - 1, false), "",
+                                      CB);
+      }
+
       Value *val3 = BinaryOperator::Create(IOP, val1, val2, "", CB);
       new StoreInst(val3, result, CB);
     }
 
-    template<uint8_t OP, ICmpInst::Predicate PR, uint64_t CO>
+    template<Instruction::BinaryOps IOP, class VAL>
+      void Runtime::ModuleData::emitLLVMCodeDIV(LLVMContext &context,
+                                                const InstrData &instr) {
+      RegId o1 = RegId(instr.params[0]), o2 = RegId(instr.params[1]);
+      RegId r = RegId(instr.params[2]);
+      unsigned bits = sizeof(VAL) * 8;
+      Value *operand1 = BITCAST_PINT(bits, emitRegValue(context, o1), CB);
+      Value *operand2 = BITCAST_PINT(bits, emitRegValue(context, o2), CB);
+      Value *result = BITCAST_PINT(bits, emitRegValue(context, r), CB);
+      Value *val1 = new LoadInst(operand1, "", CB);
+      Value *val2 = new LoadInst(operand2, "", CB);
+      Value *cond = new ICmpInst(*CB, ICmpInst::ICMP_NE, val2,
+                                 CONST_INT(bits, 0, false));
+      emitThrowIfNot(context, cond, VMECODE_DIVISION_BY_ZERO);
+
+      // division of the least value by -1 wraps around instead of trapping
+      Value *val3;
+      if(numeric_limits<VAL>::is_signed) {
+        Value *minus = new ICmpInst(*CB, ICmpInst::ICMP_EQ, val2,
+                                    CONST_INT(bits, uint64_t(-1), true));
+        val2 = SelectInst::Create(minus, CONST_INT(bits, 1, false), val2, "",
+                                  CB);
+        val3 = BinaryOperator::Create(IOP, val1, val2, "", CB);
+        Value *wrapped = CONST_INT(bits, 0, false);
+        if(IOP == Instruction::SDiv)
+          wrapped = BinaryOperator::CreateNeg(val1, "", CB);
+        val3 = SelectInst::Create(minus, wrapped, val3, "", CB);
+      }
+      else val3 = BinaryOperator::Create(IOP, val1, val2, "", CB);
+      new StoreInst(val3, result, CB);
+    }
+
+    template<ICmpInst::Predicate PR, uint64_t CO>
       void Runtime::ModuleData::emitLLVMCodeUJ(LLVMContext &context,
-                                               const UJInstrT<OP> &instr) {
-      Value *it = BITCAST_PINT(64, emitRegValue(context, instr.it()), CB);
+                                               const InstrData &instr) {
+      RegId i = RegId(instr.params[0]);
+      Value *it = BITCAST_PINT(64, emitRegValue(context, i), CB);
       Value *val = new LoadInst(it, "", CB);
       ICmpInst* cmp = new ICmpInst(*CB, PR, val, CONST_INT(64, CO, false));
-      size_t jindex = instr.branchIndex(context.instrIndex);
-      BasicBlock *tblock = context.branchBlock(jindex);
+      BasicBlock *tblock = context.branchBlock(instr.branchIndex);
       BasicBlock *fblock = context.blocks[context.blockIndex + 1];
       BranchInst::Create(tblock, fblock, cmp, CB);
     }
 
-    template<uint8_t OP, ICmpInst::Predicate PR>
+    template<ICmpInst::Predicate PR>
       void Runtime::ModuleData::emitLLVMCodeBJ(LLVMContext &context,
-                                               const BJInstrT<OP> &instr) {
-      Value *operand1 =
-        BITCAST_PINT(64, emitRegValue(context, instr.operand1()), CB);
-      Value *operand2 =
-        BITCAST_PINT(64, emitRegValue(context, instr.operand2()), CB);
+                                               const InstrData &instr) {
+      RegId o1 = RegId(instr.params[0]), o2 = RegId(instr.params[1]);
+      Value *operand1 = BITCAST_PINT(64, emitRegValue(context, o1), CB);
+      Value *operand2 = BITCAST_PINT(64, emitRegValue(context, o2), CB);
       Value *val1 = new LoadInst(operand1, "", CB);
       Value *val2 = new LoadInst(operand2, "", CB);
       ICmpInst* cmp = new ICmpInst(*CB, PR, val1, val2);
-      size_t jindex = instr.branchIndex(context.instrIndex);
-      BasicBlock *tblock = context.branchBlock(jindex);
+      BasicBlock *tblock = context.branchBlock(instr.branchIndex);
+      BasicBlock *fblock = context.blocks[context.blockIndex + 1];
+      BranchInst::Create(tblock, fblock, cmp, CB);
+    }
+
+    // immediate operand is a constant, no register is loaded for it
+    template<ICmpInst::Predicate PR>
+      void Runtime::ModuleData::emitLLVMCodeBJI(LLVMContext &context,
+                                                const InstrData &instr) {
+      RegId o1 = RegId(instr.params[0]);
+      Value *operand1 = BITCAST_PINT(64, emitRegValue(context, o1), CB);
+      Value *val1 = new LoadInst(operand1, "", CB);
+      Value *val2 = CONST_INT(64, instr.params[1], true);
+      ICmpInst* cmp = new ICmpInst(*CB, PR, val1, val2);
+      BasicBlock *tblock = context.branchBlock(instr.branchIndex);
       BasicBlock *fblock = context.blocks[context.blockIndex + 1];
       BranchInst::Create(tblock, fblock, cmp, CB);
     }
 
-    template<uint8_t OP, class VAL>
+    template<Instruction::BinaryOps IOP>
+      void Runtime::ModuleData::emitLLVMCodeBOI(LLVMContext &context,
+                                                const InstrData &instr) {
+      RegId o1 = RegId(instr.params[0]), r = RegId(instr.params[2]);
+      Value *operand1 = BITCAST_PINT(64, emitRegValue(context, o1), CB);
+      Value *result = BITCAST_PINT(64, emitRegValue(context, r), CB);
+      Value *val1 = new LoadInst(operand1, "", CB);
+      Value *val2 = CONST_INT(64, instr.params[1], true);
+      Value *val3 = BinaryOperator::Create(IOP, val1, val2, "", CB);
+      new StoreInst(val3, result, CB);
+    }
+
+    template<class VAL>
       void Runtime::ModuleData::emitLLVMCodeCPI(LLVMContext &context,
-                                             const CPIInstrT<OP, VAL> &instr) {
+                                                const InstrData &instr) {
       int bits = sizeof(VAL) << 3;
-      Value *to = BITCAST_PINT(bits, emitRegValue(context, instr.to()), CB);
-      new StoreInst(CONST_INT(bits, uint64_t(instr.val()), false), to, CB);
+      VAL v = VAL(instr.params[0]);
+      RegId t = RegId(instr.params[1]);
+      Value *to = BITCAST_PINT(bits, emitRegValue(context, t), CB);
+      new StoreInst(CONST_INT(bits, uint64_t(v), false), to, CB);
+    }
+
+    // Marks bytes of the first element of the variable pushed at push,
+    // which straight code after the push writes before anything may read
+    // them; a branch, a call with the variable as io, another frame of the
+    // register or any instruction not known here ends the search
+    void Runtime::ModuleData::findWrittenBytes(ProcId proc, size_t push,
+                                               vector<bool> &written) const {
+      const FixedArray<InstrData> &instrs = procs[proc].instrs;
+      RegId reg = RegId(instrs[push].params[0]);
+      written.assign(vtypes[regs[reg].vtype].bytes, false);
+
+      size_t depth = 0;
+      for(size_t i = push + 1; i < instrs.size(); i++) {
+        const InstrData &instr = instrs[i];
+        const uint64_t *p = instr.params;
+        RegId to = RegId(-1);
+        size_t begin = 0, end = 0;
+
+        switch(instr.opcode) {
+          case OPCODE_ADD: case OPCODE_SUB: case OPCODE_MUL:
+            if(p[0] == reg || p[1] == reg)
+              return;
+            to = RegId(p[2]), end = 8;
+            break;
+          case OPCODE_ADDI: case OPCODE_SUBI: case OPCODE_MULI:
+            if(p[0] == reg)
+              return;
+            to = RegId(p[2]), end = 8;
+            break;
+          case OPCODE_CPI1: to = RegId(p[1]), end = 1; break;
+          case OPCODE_CPI2: to = RegId(p[1]), end = 2; break;
+          case OPCODE_CPI4: to = RegId(p[1]), end = 4; break;
+          case OPCODE_CPI8: to = RegId(p[1]), end = 8; break;
+          case OPCODE_PUSH: case OPCODE_PUSHR:
+            if(p[0] == reg)
+              return;
+            // fall through, nested frame of any kind
+          case OPCODE_PUSHH:
+            depth++;
+            break;
+          case OPCODE_POP:
+            if(!depth--)
+              return;
+            break;
+          case OPCODE_CPB:
+            if(p[0] == reg)
+              return;
+            to = RegId(p[1]);
+            end = min(vtypes[regs[p[0]].vtype].bytes, written.size());
+            break;
+          case OPCODE_LDE:
+            if(p[0] == reg || p[1] == reg)
+              return;
+            to = RegId(p[2]), end = written.size();
+            break;
+          case OPCODE_LDB:
+            if(p[0] == reg)
+              return;
+            to = RegId(p[2]);
+            end = min(vtypes[regs[p[0]].vtype].bytes - size_t(p[1]),
+                      written.size());
+            break;
+          case OPCODE_STE: // element being written is not known
+            if(p[0] == reg || p[2] == reg)
+              return;
+            break;
+          case OPCODE_STB:
+            if(p[0] == reg)
+              return;
+            if(p[1] == reg) {
+              to = reg, begin = size_t(p[2]);
+              end = begin + min(vtypes[regs[p[0]].vtype].bytes,
+                                written.size() - begin);
+            }
+            break;
+          case OPCODE_STR: // references are zeroed anyway
+            if(p[0] == reg)
+              return;
+            break;
+          case OPCODE_CALL:
+            if(!depth)
+              return;
+            break;
+          default:
+            return;
+        }
+
+        if(to == reg)
+          for(size_t b = begin; b < end; b++)
+            written[b] = true;
+        if(instr.branches)
+          return;
+      }
+    }
+
+    // Frame variables start zeroed, except for bytes the code is known to
+    // write first; references are always zeroed, cleanup releases them
+    void Runtime::ModuleData::emitZeroFrame(LLVMContext &context, RegId reg,
+                                            Value *vptr) {
+      Type *type = getEltLLVMType(regs[reg].vtype);
+      size_t count = regs[reg].count;
+      vector<bool> written;
+      findWrittenBytes(context.proc, context.instrIndex, written);
+
+      if(find(written.begin(), written.end(), true) == written.end()) {
+        emitZeroStore(CB, vptr, ArrayType::get(type, count));
+        return;
+      }
+
+      for(size_t b = 0; b < written.size(); b++) {
+        size_t e = b;
+        while(e < written.size() && !written[e])
+          e++;
+        if(e > b)
+          emitZeroStore(CB, emitFieldPtr(CB, vptr, EFLD_BYTES, b),
+                        TYPE_BARR(e - b));
+        b = e;
+      }
+
+      const VarTypeData &vtype = vtypes[regs[reg].vtype];
+      if(vtype.vrefs.size())
+        emitZeroStore(CB, emitFieldPtr(CB, vptr, EFLD_VREFS),
+                      TYPE_PBARR(vtype.vrefs.size()));
+      if(vtype.prefs.size())
+        emitZeroStore(CB, emitFieldPtr(CB, vptr, EFLD_PREFS),
+                      TYPE_PBARR(vtype.prefs.size()));
+
+      if(count > 1) {
+        Value *eptr = GetElementPtrInst::Create(vptr, CONST_INT(64, 1, false),
+                                                "", CB);
+        emitZeroStore(CB, eptr, ArrayType::get(type, count - 1));
+      }
     }
 
-    Value *Runtime::ModuleData::emitZeroVariable(BasicBlock *block,
-                                                 Value *vptr, Value *count) {
-      vector<Value*> args(1, count);
-      Value *eptr = GetElementPtrInst::Create(vptr, args, "", block);
-      Value *vptri = new PtrToIntInst(vptr, TYPE_INT(64), "", block);
-      Value *eptri = new PtrToIntInst(eptr, TYPE_INT(64), "", block);
-      Value *len = BinaryOperator::Create(Instruction::Sub, eptri, vptri, "",
-                                          block);
+    // Code generator expands aggregate stores into a store per element,
+    // so larger frames are zeroed by memset
+    void Runtime::ModuleData::emitZeroStore(BasicBlock *block, Value *ptr,
+                                            Type *type) {
+      uint64_t bytes = llvmEE->getTargetData()->getTypeAllocSize(type);
+      if(bytes <= ZERO_STORE_MAX) {
+        ptr = new BitCastInst(ptr, TYPE_PTR(type), "", block);
+        new StoreInst(ConstantAggregateZero::get(type), ptr, block);
+        return;
+      }
 
       vector<Type*> types;
       types.push_back(TYPE_PTR(TYPE_INT(8)));
       types.push_back(TYPE_INT(64));
       Function *ms = Intrinsic::getDeclaration(llvmModule, Intrinsic::memset,
                                                types);
-      args.clear();
-      args.push_back(BITCAST_PINT(8, vptr, block));
+      vector<Value*> args;
+      args.push_back(BITCAST_PINT(8, ptr, block));
       args.push_back(CONST_INT(8, 0, false));
-      args.push_back(len);
+      args.push_back(CONST_INT(64, bytes, false));
       args.push_back(CONST_INT(32, 0, false));
       args.push_back(CONST_INT(1, 0, false));
       CALL_FUNC(block, call, ms, args);
     }
 
-#define CONST_PTR(type, ptr) \
-    ConstantExpr::getCast(Instruction::IntToPtr, \
-                          CONST_INT(64, uint64_t(ptr), false), \
-                          TYPE_PTR(type))
+    void Runtime::ModuleData::emitLifetimeMarker(BasicBlock *block,
+                                                 Intrinsic::ID id,
+                                                 Value *slot) {
+      Function *lm = Intrinsic::getDeclaration(llvmModule, id);
+      vector<Value*> args;
+      args.push_back(CONST_INT(64, -1, true)); // whole alloca
+      args.push_back(slot);
+      CALL_FUNC(block, call, lm, args);
+    }
 
-    template<uint8_t OP, bool REF>
+    // Frames have fixed sizes and stack depth is the same whenever an
+    // instruction is reached, so every PUSH gets its own static alloca,
+    // which mem2reg and SROA can turn into registers. Lifetime markers
+    // let the code generator share stack slots of disjoint frames.
+    template<bool REF>
       void Runtime::ModuleData::emitLLVMCodePUSH(LLVMContext &context,
-                                            const PUSHInstrT<OP, REF> &instr) {
-      Function *ss = Intrinsic::getDeclaration(llvmModule,
-                                               Intrinsic::stacksave);
-      Value *sptr = CallInst::Create(ss, "", CB), *vptr;
-
-      RegId reg = instr.reg();
+                                                 const InstrData &instr) {
+      Instruction *entry = context.entryBlock->getTerminator();
+      RegId reg = RegId(instr.params[0]);
       Type *type = getEltLLVMType(regs[reg].vtype);
+      Value *vptr, *slot;
 
       if(REF) {
         PointerType *ptype = TYPE_PTR(type);
-        vptr = new AllocaInst(ptype, "", CB);
-        Constant *null = ConstantPointerNull::get(ptype);
-        new StoreInst(null, vptr, CB);
+        vptr = new AllocaInst(ptype, "", entry);
+        slot = new BitCastInst(vptr, TYPE_PTR(TYPE_INT(8)), "", entry);
+        emitLifetimeMarker(CB, Intrinsic::lifetime_start, slot);
+        new StoreInst(ConstantPointerNull::get(ptype), vptr, CB);
       }
       else {
-        Value *count = CONST_INT(64, uint64_t(regs[reg].count), false);
-        vptr = new AllocaInst(type, count, "", CB);
-        emitZeroVariable(CB, vptr, count);
+        ArrayType *atype = ArrayType::get(type, regs[reg].count);
+        Value *aptr = new AllocaInst(atype, "", entry);
+        slot = new BitCastInst(aptr, TYPE_PTR(TYPE_INT(8)), "", entry);
+        vector<Value*> indexes(2, CONST_INT(32, 0, false));
+        vptr = GetElementPtrInst::Create(aptr, indexes, "", entry);
+        emitLifetimeMarker(CB, Intrinsic::lifetime_start, slot);
+        emitZeroFrame(context, reg, vptr);
       }
 
-      context.pushRegFrame(REF, reg, sptr, vptr);
+      context.pushRegFrame(REF, reg, slot, vptr);
+      if(REF)
+        context.frames.back().borrowed =
+          isBorrowedFrame(procs[context.proc].instrs, context.instrIndex,
+                          context.frameRegs());
     }
 
     void Runtime::ModuleData::emitLLVMCodePUSHH(LLVMContext &context,
-                                                const PUSHHInstr &instr) {
-      context.pushHandFrame(instr.branchIndex(context.instrIndex));
+                                                const InstrData &instr) {
+      context.pushHandFrame(instr.branchIndex);
     }
 
     typedef void (*AntVMDestroyVariablePtr)(const vector<VarTypeData>&,
@@ -490,6 +1247,31 @@ namespace Ant {
       // to be done
     }
 
+    size_t Runtime::ModuleData::varSpecIndex(const VarSpec *vspec) const {
+      if(!regs.empty() && vspec >= &regs[0] && vspec < &regs[0] + regs.size())
+        return vspec - &regs[0];
+
+      size_t index = regs.size();
+      for(size_t i = 0; i < vtypes.size(); i++) {
+        const FixedArray<VarSpec> &vrefs = vtypes[i].vrefs;
+        if(vspec >= vrefs.begin() && vspec < vrefs.end())
+          return index + (vspec - vrefs.begin());
+        index += vrefs.size();
+      }
+
+      throw BugException();
+    }
+
+    // Variable specifications are referenced through a table mapped at
+    // unpack, so emitted code does not depend on where the pools live
+    Value *Runtime::ModuleData::emitVarSpecPtr(BasicBlock *block,
+                                               const VarSpec *vspec) {
+      Value *vspecs = llvmModule->getGlobalVariable(VSPECS_VAR_NAME);
+      Value *index = CONST_INT(64, uint64_t(varSpecIndex(vspec)), false);
+      Value *ptr = GetElementPtrInst::Create(vspecs, index, "", block);
+      return new LoadInst(ptr, "", block);
+    }
+
     void Runtime::ModuleData::emitIncVarRefCount(Function *func,
                                                BasicBlock *&block, Value *vptr,
                                                const VarSpec *vspecForDec) {
@@ -519,8 +1301,8 @@ namespace Ant {
         vptr = BITCAST_PINT(8, vptr, desBlock);
         Function *des = llvmModule->getFunction(DESTROY_FUNC_NAME);
         vector<Value*> args;
-        args.push_back(CONST_PTR(TYPE_INT(8), intptr_t(&vtypes)));
-        args.push_back(CONST_PTR(TYPE_INT(8), intptr_t(vspecForDec)));
+        args.push_back(llvmModule->getGlobalVariable(VTYPES_VAR_NAME));
+        args.push_back(emitVarSpecPtr(desBlock, vspecForDec));
         args.push_back(vptr);
         CALL_FUNC(desBlock, call, des, args);
         BranchInst::Create(endBlock, desBlock);
@@ -528,54 +1310,87 @@ namespace Ant {
       else BranchInst::Create(endBlock, incBlock);
     }
 
+    void Runtime::ModuleData::emitCleanupElt(Function *func,
+                                             BasicBlock *&block,
+                                             const FixedArray<VarSpec> &vrefs,
+                                             Value *eptr) {
+      for(uint32_t vref = 0; vref < vrefs.size(); vref++) {
+        Value *rptr = emitFieldPtr(block, eptr, EFLD_VREFS, vref);
+        Type *ty = TYPE_PTR(TYPE_PTR(getEltLLVMType(vrefs[vref].vtype)));
+        rptr = new BitCastInst(rptr, ty, "", block);
+        Value *rval = new LoadInst(rptr, "", block);
+        emitIncVarRefCount(func, block, rval, &vrefs[vref]);
+      }
+    }
+
+    // References of few elements are released one by one, those of
+    // larger frames in a loop over elements, so code stays small
     void Runtime::ModuleData::emitCleanupRegFrame(Function *func,
                                                   BasicBlock *&block,RegId reg,
                                                   bool ref, Value *vptr) {
       if(ref) {
         vptr = new LoadInst(vptr, "", block);
         emitIncVarRefCount(func, block, vptr, &regs[reg]);
+        return;
       }
-      else for(size_t elt = 0; elt < regs[reg].count; elt++) {
-          FixedArray<VarSpec> &vrefs = vtypes[regs[reg].vtype].vrefs;
-          for(uint32_t vref = 0; vref < vrefs.size(); vref++) {
-            vptr = emitElementPtr(func, block, reg, false, vptr, elt);
-            vptr = emitFieldPtr(block, vptr, EFLD_VREFS, vref);
-            Type *ty = TYPE_PTR(TYPE_PTR(getEltLLVMType(vrefs[vref].vtype)));
-            vptr = new BitCastInst(vptr, ty, "", block);
-            vptr = new LoadInst(vptr, "", block);
-            emitIncVarRefCount(func, block, vptr, &vrefs[vref]);
-          }
+
+      const FixedArray<VarSpec> &vrefs = vtypes[regs[reg].vtype].vrefs;
+      size_t count = regs[reg].count;
+      if(!vrefs.size())
+        return;
+
+      if(count * vrefs.size() <= CLEANUP_UNROLLED_MAX) {
+        for(size_t elt = 0; elt < count; elt++) {
+          Value *eptr = vptr;
+          if(elt)
+            eptr = GetElementPtrInst::Create(vptr, CONST_INT(64, elt, false),
+                                             "", block);
+          emitCleanupElt(func, block, vrefs, eptr);
         }
+        return;
+      }
+
+      BasicBlock *lblock = BasicBlock::Create(llvmModule->getContext(), "",
+                                              func, 0);
+      BasicBlock *eblock = BasicBlock::Create(llvmModule->getContext(), "",
+                                              func, 0);
+      PHINode *index = PHINode::Create(TYPE_INT(64), 2, "", lblock);
+      index->addIncoming(CONST_INT(64, 0, false), block);
+      BranchInst::Create(lblock, block);
+      block = lblock;
+
+      emitCleanupElt(func, block, vrefs,
+                     GetElementPtrInst::Create(vptr, index, "", block));
+      Value *next = BinaryOperator::Create(Instruction::Add, index,
+                                           CONST_INT(64, 1, false), "", block);
+      index->addIncoming(next, block);
+      Value *cond = new ICmpInst(*block, ICmpInst::ICMP_ULT, next,
+                                 CONST_INT(64, uint64_t(count), false));
+      BranchInst::Create(lblock, eblock, cond, block);
+      block = eblock;
     }
 
     void Runtime::ModuleData::emitLLVMCodePOP(LLVMContext &context,
-                                              const POPInstr &instr) {
+                                              const InstrData &instr) {
       LLVMContext::Frame &frame = context.frames.back();
       if(frame.ftype != FT_HAND) {
-        emitCleanupRegFrame(CF, CB, frame.reg, frame.ftype == FT_REGR,
-                            frame.vptr);
-
-        Function *sr = Intrinsic::getDeclaration(llvmModule,
-                                                 Intrinsic::stackrestore);
-        vector<Value*> args(1, frame.sptr);
-        CALL_FUNC(CB, call, sr, args);
+        if(!frame.borrowed)
+          emitCleanupRegFrame(CF, CB, frame.reg, frame.ftype == FT_REGR,
+                              frame.vptr);
+        emitLifetimeMarker(CB, Intrinsic::lifetime_end, frame.slot);
       }
 
       context.popFrame();
     }
 
     void Runtime::ModuleData::emitLLVMCodeJMP(LLVMContext &context,
-                                              const JMPInstr &instr) {
-      size_t jindex = instr.branchIndex(context.instrIndex);
-      BranchInst::Create(context.branchBlock(jindex), CB);
+                                              const InstrData &instr) {
+      BranchInst::Create(context.branchBlock(instr.branchIndex), CB);
     }
 
-#define BITCAST_PARR(bytes, vptr, block) \
-    new BitCastInst(vptr, TYPE_PTR(TYPE_BARR(bytes)), "", block)
-
     void Runtime::ModuleData::emitLLVMCodeCPB(LLVMContext &context,
-                                              const CPBInstr &instr) {
-      RegId f = instr.from(), t = instr.to();
+                                              const InstrData &instr) {
+      RegId f = RegId(instr.params[0]), t = RegId(instr.params[1]);
       uint32_t fbytes = vtypes[regs[f].vtype].bytes;
       uint32_t tbytes = vtypes[regs[t].vtype].bytes;
       uint32_t mbytes = fbytes < tbytes ? fbytes : tbytes;
@@ -586,19 +1401,22 @@ namespace Ant {
     }
 
     void Runtime::ModuleData::emitLLVMCodeLDE(LLVMContext &context,
-                                              const LDEInstr &instr) {
-      Value *eltptr = BITCAST_PINT(64, emitRegValue(context, instr.elt()), CB);
+                                              const InstrData &instr) {
+      RegId f = RegId(instr.params[0]), e = RegId(instr.params[1]);
+      RegId t = RegId(instr.params[2]);
+      Value *eltptr = BITCAST_PINT(64, emitRegValue(context, e), CB);
       Value *eltval = new LoadInst(eltptr, "", CB);
-      Value *from = emitRegValue(context, instr.from(), true, 0, eltval);
+      Value *from = emitRegValue(context, f, true, 0, eltval,
+                                 context.inRange[context.instrIndex]);
       Value *val = new LoadInst(from, "", CB);
-      Value *to = emitRegValue(context, instr.to());
+      Value *to = emitRegValue(context, t);
       new StoreInst(val, to, CB);
     }
 
     void Runtime::ModuleData::emitLLVMCodeLDB(LLVMContext &context,
-                                              const LDBInstr &instr) {
-      uint32_t o = instr.offset();
-      RegId f = instr.from(), t = instr.to();
+                                              const InstrData &instr) {
+      uint32_t o = uint32_t(instr.params[1]);
+      RegId f = RegId(instr.params[0]), t = RegId(instr.params[2]);
       uint32_t fbytes = vtypes[regs[f].vtype].bytes - o;
       uint32_t tbytes = vtypes[regs[t].vtype].bytes;
       uint32_t mbytes = fbytes < tbytes ? fbytes : tbytes;
@@ -610,35 +1428,46 @@ namespace Ant {
     }
 
     void Runtime::ModuleData::emitLLVMCodeLDR(LLVMContext &context,
-                                              const LDRInstr &instr) {
-      uint32_t r = instr.vref();
-      RegId f = instr.from(), t = instr.to();
+                                              const InstrData &instr) {
+      uint32_t r = uint32_t(instr.params[1]);
+      RegId f = RegId(instr.params[0]), t = RegId(instr.params[2]);
       const VarSpec &rvs = vtypes[regs[f].vtype].vrefs[r];
       Type *ty = TYPE_PTR(TYPE_PTR(getEltLLVMType(rvs.vtype)));
       Value *from = emitFieldPtr(CB, emitRegValue(context, f), EFLD_VREFS, r);
       from = new BitCastInst(from, ty, "", CB);
       Value *fval = new LoadInst(from, "", CB);
-      emitIncVarRefCount(CF, CB, fval);
       Value *to = emitRegValue(context, t, false);
-      Value *tval = new LoadInst(to, "", CB);
-      emitIncVarRefCount(CF, CB, tval, &regs[t]);
+
+      // borrowed reference is loaded once, replacing a null one
+      LLVMContext::Frame *frame = context.findFrame(t);
+      if(!frame || !frame->borrowed) {
+        emitIncVarRefCount(CF, CB, fval);
+        Value *tval = new LoadInst(to, "", CB);
+        emitIncVarRefCount(CF, CB, tval, &regs[t]);
+      }
       new StoreInst(fval, to, CB);
+
+      if(frame)
+        frame->forget();
     }
 
     void Runtime::ModuleData::emitLLVMCodeSTE(LLVMContext &context,
-                                              const STEInstr &instr) {
-      Value *from = emitRegValue(context, instr.from());
-      Value *eltptr = BITCAST_PINT(64, emitRegValue(context, instr.elt()), CB);
+                                              const InstrData &instr) {
+      RegId f = RegId(instr.params[0]), t = RegId(instr.params[1]);
+      RegId e = RegId(instr.params[2]);
+      Value *from = emitRegValue(context, f);
+      Value *eltptr = BITCAST_PINT(64, emitRegValue(context, e), CB);
       Value *eltval = new LoadInst(eltptr, "", CB);
-      Value *to = emitRegValue(context, instr.to(), true, 0, eltval);
+      Value *to = emitRegValue(context, t, true, 0, eltval,
+                               context.inRange[context.instrIndex]);
       Value *val = new LoadInst(from, "", CB);
       new StoreInst(val, to, CB);
     }
 
     void Runtime::ModuleData::emitLLVMCodeSTB(LLVMContext &context,
-                                              const STBInstr &instr) {
-      uint32_t o = instr.offset();
-      RegId f = instr.from(), t = instr.to();
+                                              const InstrData &instr) {
+      uint32_t o = uint32_t(instr.params[2]);
+      RegId f = RegId(instr.params[0]), t = RegId(instr.params[1]);
       uint32_t fbytes = vtypes[regs[f].vtype].bytes;
       uint32_t tbytes = vtypes[regs[t].vtype].bytes - o;
       uint32_t mbytes = fbytes < tbytes ? fbytes : tbytes;
@@ -650,9 +1479,9 @@ namespace Ant {
     }
 
     void Runtime::ModuleData::emitLLVMCodeSTR(LLVMContext &context,
-                                              const STRInstr &instr) {
-      uint32_t r = instr.vref();
-      RegId f = instr.from(), t = instr.to();
+                                              const InstrData &instr) {
+      uint32_t r = uint32_t(instr.params[2]);
+      RegId f = RegId(instr.params[0]), t = RegId(instr.params[1]);
       Value *from = emitRegValue(context, f, false);
       Value *fval = new LoadInst(from, "", CB);
       emitIncVarRefCount(CF, CB, fval);
@@ -665,68 +1494,451 @@ namespace Ant {
       new StoreInst(fval, to, CB);
     }
 
-#define TYPE_LPI StructType::get(TYPE_PTR(TYPE_INT(8)), TYPE_INT(32), NULL)
-
-    void Runtime::ModuleData::emitFuncCall(LLVMContext &context,
-                                           Function *func, Value *arg) {
-      vector<Value*> args(1, arg);
-      if(context.frames.size() == 1) {
-        CALL_FUNC(CB, call, func, args);
-        return;
-      }
-
+    // Exceptions are plain branches within a procedure, ED is set on the
+    // way here; the block cleans up frames and enters the handler, or
+    // returns true to tell the caller an exception is propagating
+    BasicBlock *Runtime::ModuleData::emitUnwindBlock(LLVMContext &context) {
       int fi = context.frames.size() - 1;
       BasicBlock *&ublock = context.frames[fi].ublock;
-      if(!ublock) {
-        BasicBlock *block=BasicBlock::Create(llvmModule->getContext(),"",CF,0);
-        Function *pers = llvmModule->getFunction(GXX_PERS_FUNC_NAME);
-        LandingPadInst *lp = LandingPadInst::Create(TYPE_LPI, pers,0,"",block);
-        ublock = block;
-
-        for(; fi > 1; fi--) {
-          LLVMContext::Frame &frame = context.frames[fi];
-          if(frame.ftype == FT_HAND)
-            if(context.instrIndex >= frame.hindex)
-              continue;
-            else break;
+      if(ublock)
+        return ublock;
+
+      BasicBlock *block = BasicBlock::Create(llvmModule->getContext(), "",
+                                             CF, 0);
+      ublock = block;
+
+      for(; fi > 0; fi--) {
+        LLVMContext::Frame &frame = context.frames[fi];
+        if(frame.ftype == FT_HAND)
+          if(context.instrIndex >= frame.hindex)
+            continue;
+          else break;
 
+        if(!frame.borrowed)
           emitCleanupRegFrame(CF, block, frame.reg, frame.ftype == FT_REGR,
                               frame.vptr);
-        }
+      }
 
-        if(fi > 1) {
-          lp->addClause(ConstantPointerNull::get(TYPE_PTR(TYPE_INT(8))));
-          BranchInst::Create(context.branchBlock(context.frames[fi].hindex),
-                             block);
-        } else {
-          lp->setCleanup(true);
-          ResumeInst::Create(lp, block);
-        }
+      if(fi > 0)
+        BranchInst::Create(context.branchBlock(context.frames[fi].hindex),
+                           block);
+      else {
+        emitTailIOCleanup(context, block);
+        ReturnInst::Create(llvmModule->getContext(), CONST_INT(1, 1, false),
+                           block);
+      }
+
+      return ublock;
+    }
+
+    // io of a self tail call is owned by the procedure, it is cleaned up
+    // once the procedure returns or calls itself again
+    void Runtime::ModuleData::emitTailIOCleanup(LLVMContext &context,
+                                                BasicBlock *&block) {
+      if(!context.tailIO)
+        return;
+
+      Value *io = context.tailIO;
+      Value *cond = new ICmpInst(*block, ICmpInst::ICMP_NE, io,
+                                 context.tailIO->getIncomingValue(0));
+      BasicBlock *cblock = BasicBlock::Create(llvmModule->getContext(), "",
+                                              CF, 0);
+      BasicBlock *nblock = BasicBlock::Create(llvmModule->getContext(), "",
+                                              CF, 0);
+      BranchInst::Create(cblock, nblock, cond, block);
+      block = nblock;
+
+      emitCleanupRegFrame(CF, cblock, ptypes[procs[context.proc].ptype].io,
+                          false, io);
+      BranchInst::Create(nblock, cblock);
+    }
+
+    // The callee io is the top frame, so the call cannot reuse the stack
+    // frame of the caller; the top frame moves to the io variable not in
+    // use instead, frames the POPs after the call would clean up are
+    // cleaned up and the procedure starts over
+    void Runtime::ModuleData::emitSelfTailCall(LLVMContext &context,
+                                               size_t pops) {
+      LLVMContext::Frame &top = context.frames.back();
+      Value *io = context.tailIO;
+      Value *isFirst = new ICmpInst(*CB, ICmpInst::ICMP_EQ, io,
+                                    context.tailSlots[0]);
+      Value *next = SelectInst::Create(isFirst, context.tailSlots[1],
+                                       context.tailSlots[0], "", CB);
+
+      RegId ioReg = ptypes[procs[context.proc].ptype].io;
+      Type *type = getEltLLVMType(regs[ioReg].vtype);
+      Type *atype = TYPE_PTR(ArrayType::get(type, regs[ioReg].count));
+      Value *from = new BitCastInst(top.vptr, atype, "", CB);
+      Value *to = new BitCastInst(next, atype, "", CB);
+      new StoreInst(new LoadInst(from, "", CB), to, CB);
+      emitLifetimeMarker(CB, Intrinsic::lifetime_end, top.slot);
+
+      size_t fi = context.frames.size() - 1;
+      for(size_t i = 1; i < pops; i++) {
+        LLVMContext::Frame &frame = context.frames[fi - i];
+        if(!frame.borrowed)
+          emitCleanupRegFrame(CF, CB, frame.reg, frame.ftype == FT_REGR,
+                              frame.vptr);
+        emitLifetimeMarker(CB, Intrinsic::lifetime_end, frame.slot);
       }
+      emitTailIOCleanup(context, CB);
+
+      context.tailIO->addIncoming(next, CB);
+      BranchInst::Create(context.tailIO->getParent(), CB);
+      CB = BasicBlock::Create(llvmModule->getContext(), "", CF, 0);
+    }
+
+    void Runtime::ModuleData::emitFuncCall(LLVMContext &context,
+                                           Function *func, Value *arg) {
+      vector<Value*> args(1, arg);
+      CALL_FUNC(CB, call, func, args);
 
       BasicBlock *nblock =BasicBlock::Create(llvmModule->getContext(),"",CF,0);
-      InvokeInst *inv = InvokeInst::Create(func, nblock, ublock, args, "", CB);
-      inv->setCallingConv(func->getCallingConv());
+      BranchInst::Create(emitUnwindBlock(context), nblock, call, CB);
       CB = nblock;
     }
 
     void Runtime::ModuleData::emitLLVMCodeCALL(LLVMContext &context,
-                                               const CALLInstr &instr) {
-      Function *func = llvmModule->getFunction(funcName(instr.proc()));
+                                               const InstrData &instr) {
+      ProcId proc = ProcId(instr.params[0]);
+
+      // a handler would have to catch what the callee throws
+      size_t pops = selfTailPops(procs[context.proc].instrs, context.proc,
+                                 context.instrIndex);
+      vector<RegId> frames = context.frameRegs();
+      if(pops && pops < frames.size() &&
+         find(frames.begin(), frames.end(), HAND_FRAME_REG) == frames.end()) {
+        emitSelfTailCall(context, pops);
+        return;
+      }
+
+      Function *func = llvmModule->getFunction(funcName(proc));
       emitFuncCall(context, func, context.frames.back().vptr);
+      // callee may replace the reference it gets
+      context.frames.back().forget();
     }
 
     void Runtime::ModuleData::emitLLVMCodeTHROW(LLVMContext &context,
-                                                const THROWInstr &instr) {
-      Function *thrw = llvmModule->getFunction(THROW_FUNC_NAME);
-      Value *edptr =llvmModule->getGlobalVariable(varName(PRESET_REG_ED),true);
-      Value *edval = new LoadInst(BITCAST_PINT(64, edptr, CB), "", CB);
-      emitFuncCall(context, thrw, edval);
+                                                const InstrData &instr) {
+      // ED already holds the exception
+      BranchInst::Create(emitUnwindBlock(context), CB);
+      CB = BasicBlock::Create(llvmModule->getContext(), "", CF, 0);
     }
 
     void Runtime::ModuleData::emitLLVMCodeRET(LLVMContext &context,
-                                              const RETInstr &instr) {
-      ReturnInst::Create(llvmModule->getContext(), CB);
+                                              const InstrData &instr) {
+      emitTailIOCleanup(context, CB);
+      ReturnInst::Create(llvmModule->getContext(), CONST_INT(1, 0, false),
+                         CB);
+    }
+
+    // first word of a word array, count gets its element count
+    Value *Runtime::ModuleData::emitArrayPtr(LLVMContext &context, RegId reg,
+                                             Value *&count) {
+      // array may be empty, so no element is checked
+      LLVMContext::Frame *frame = context.findFrame(reg);
+      if(frame && frame->ftype == FT_REGR) {
+        Value *vptr = emitRefValue(context, reg);
+        count = frame->count ? frame->count
+          : CONST_INT(64, uint64_t(regs[reg].count), false);
+        return BITCAST_PINT(64, vptr, CB);
+      }
+
+      count = CONST_INT(64, uint64_t(regs[reg].count), false);
+      return BITCAST_PINT(64, emitRegValue(context, reg), CB);
+    }
+
+    Value *Runtime::ModuleData::emitArrayOpValue(BasicBlock *block,
+                                                 OpCode op, Value *val1,
+                                                 Value *val2) {
+      ICmpInst::Predicate pred = ICmpInst::ICMP_SGT;
+      switch(op) {
+        case OPCODE_AADD: case OPCODE_ARSUM:
+          return BinaryOperator::Create(Instruction::Add, val1, val2, "",
+                                        block);
+        case OPCODE_ASUB:
+          return BinaryOperator::Create(Instruction::Sub, val1, val2, "",
+                                        block);
+        case OPCODE_AMUL:
+          return BinaryOperator::Create(Instruction::Mul, val1, val2, "",
+                                        block);
+        case OPCODE_AMIN: case OPCODE_ARMIN:
+          pred = ICmpInst::ICMP_SLT;
+        case OPCODE_AMAX: case OPCODE_ARMAX:
+          return SelectInst::Create(new ICmpInst(*block, pred, val1, val2),
+                                    val1, val2, "", block);
+        case OPCODE_ACMPE:
+          pred = ICmpInst::ICMP_EQ;
+        case OPCODE_ACMPG:
+          return new SExtInst(new ICmpInst(*block, pred, val1, val2),
+                              val1->getType(), "", block);
+        default:
+          throw BugException();
+      }
+    }
+
+    // Loop over words [begin, end) of word arrays, width words at a time.
+    // Operands are read from srcs, results written to dst; without srcs
+    // acc is written, without dst it is reduced, the result is returned.
+    Value *Runtime::ModuleData::emitArrayLoop(LLVMContext &context,
+                                              OpCode op, Value *const *srcs,
+                                              Value *dst, Value *begin,
+                                              Value *end, unsigned width,
+                                              Value *acc) {
+      Type *type = TYPE_INT(64);
+      if(width > 1)
+        type = VectorType::get(type, width);
+
+      BasicBlock *pblock = CB;
+      BasicBlock *lblock = BasicBlock::Create(llvmModule->getContext(), "",
+                                              CF, 0);
+      BasicBlock *eblock = BasicBlock::Create(llvmModule->getContext(), "",
+                                              CF, 0);
+      Value *cond = new ICmpInst(*pblock, ICmpInst::ICMP_ULT, begin, end);
+      BranchInst::Create(lblock, eblock, cond, pblock);
+
+      PHINode *index = PHINode::Create(TYPE_INT(64), 2, "", lblock);
+      index->addIncoming(begin, pblock);
+      PHINode *accIn = NULL;
+      if(!dst) {
+        accIn = PHINode::Create(type, 2, "", lblock);
+        accIn->addIncoming(acc, pblock);
+      }
+
+      Value *vals[2] = { NULL, NULL };
+      for(int i = 0; i < 2 && srcs[i]; i++) {
+        Value *sptr = GetElementPtrInst::Create(srcs[i], index, "", lblock);
+        sptr = new BitCastInst(sptr, TYPE_PTR(type), "", lblock);
+        LoadInst *load = new LoadInst(sptr, "", lblock);
+        load->setAlignment(8);
+        vals[i] = load;
+      }
+
+      Value *accOut = acc;
+      if(dst) {
+        Value *val = srcs[0] ? emitArrayOpValue(lblock, op, vals[0], vals[1])
+          : acc;
+        Value *dptr = GetElementPtrInst::Create(dst, index, "", lblock);
+        dptr = new BitCastInst(dptr, TYPE_PTR(type), "", lblock);
+        new StoreInst(val, dptr, false, 8, lblock);
+      }
+      else {
+        accOut = emitArrayOpValue(lblock, op, accIn, vals[0]);
+        accIn->addIncoming(accOut, lblock);
+      }
+
+      Value *next = BinaryOperator::Create(Instruction::Add, index,
+                                           CONST_INT(64, width, false), "",
+                                           lblock);
+      index->addIncoming(next, lblock);
+      cond = new ICmpInst(*lblock, ICmpInst::ICMP_ULT, next, end);
+      BranchInst::Create(lblock, eblock, cond, lblock);
+      CB = eblock;
+
+      if(dst)
+        return acc;
+
+      PHINode *result = PHINode::Create(type, 2, "", eblock);
+      result->addIncoming(acc, pblock);
+      result->addIncoming(accOut, lblock);
+      return result;
+    }
+
+    // Additions are done on vectors of words as long as there are enough
+    // words left, everything else one word at a time
+    Value *Runtime::ModuleData::emitArrayLoops(LLVMContext &context,
+                                               OpCode op, Value *const *srcs,
+                                               Value *dst, Value *count,
+                                               Value *acc) {
+      Value *begin = CONST_INT(64, 0, false);
+
+      if(op == OPCODE_AADD || op == OPCODE_ASUB || op == OPCODE_ARSUM ||
+         op == OPCODE_AFILL) {
+        unsigned width = ARRAY_VECTOR_WIDTH;
+        Value *end = BinaryOperator::Create(Instruction::And, count,
+                                            CONST_INT(64, ~uint64_t(width - 1),
+                                                      false), "", CB);
+        Value *vacc = NULL;
+        if(acc) {
+          vacc = UndefValue::get(VectorType::get(acc->getType(), width));
+          for(unsigned i = 0; i < width; i++)
+            vacc = InsertElementInst::Create(vacc, acc, CONST_INT(32, i, false),
+                                             "", CB);
+        }
+
+        vacc = emitArrayLoop(context, op, srcs, dst, begin, end, width, vacc);
+        if(!dst) // reduces the vector to a single word
+          for(unsigned i = 0; i < width; i++) {
+            Value *val = ExtractElementInst::Create(vacc,
+                                                    CONST_INT(32, i, false),
+                                                    "", CB);
+            acc = i ? emitArrayOpValue(CB, op, acc, val) : val;
+          }
+        begin = end;
+      }
+
+      return emitArrayLoop(context, op, srcs, dst, begin, count, 1, acc);
+    }
+
+    void Runtime::ModuleData::emitLLVMCodeAO(LLVMContext &context,
+                                             const InstrData &instr) {
+      Value *counts[3], *ptrs[3];
+      for(int i = 0; i < 3; i++)
+        ptrs[i] = emitArrayPtr(context, RegId(instr.params[i]), counts[i]);
+
+      Value *cond1 = new ICmpInst(*CB, ICmpInst::ICMP_ULE, counts[2],
+                                  counts[0]);
+      Value *cond2 = new ICmpInst(*CB, ICmpInst::ICMP_ULE, counts[2],
+                                  counts[1]);
+      emitThrowIfNot(context, BinaryOperator::CreateAnd(cond1, cond2, "", CB),
+                     VMECODE_RANGE);
+      emitArrayLoops(context, instr.opcode, ptrs, ptrs[2], counts[2], NULL);
+    }
+
+    void Runtime::ModuleData::emitLLVMCodeAR(LLVMContext &context,
+                                             const InstrData &instr) {
+      RegId f = RegId(instr.params[0]), t = RegId(instr.params[1]);
+      Value *count, *srcs[2] = { emitArrayPtr(context, f, count), NULL };
+
+      uint64_t identity = 0; // of ARSUM
+      if(instr.opcode == OPCODE_ARMIN)
+        identity = uint64_t(INT64_MAX);
+      else if(instr.opcode == OPCODE_ARMAX)
+        identity = uint64_t(INT64_MIN);
+      Value *acc = emitArrayLoops(context, instr.opcode, srcs, NULL, count,
+                                  CONST_INT(64, identity, false));
+
+      new StoreInst(acc, BITCAST_PINT(64, emitRegValue(context, t), CB), CB);
+    }
+
+    void Runtime::ModuleData::emitLLVMCodeAFILL(LLVMContext &context,
+                                                const InstrData &instr) {
+      RegId v = RegId(instr.params[0]), t = RegId(instr.params[1]);
+      Value *val = new LoadInst(BITCAST_PINT(64, emitRegValue(context, v), CB),
+                                "", CB);
+      Value *count, *srcs[2] = { NULL, NULL };
+      Value *dst = emitArrayPtr(context, t, count);
+      emitArrayLoops(context, OPCODE_AFILL, srcs, dst, count, val);
+    }
+
+    void Runtime::ModuleData::emitTierCounter(LLVMContext &context) {
+      Value *counters = llvmModule->getGlobalVariable(COUNTERS_VAR_NAME);
+      Value *index = CONST_INT(64, uint64_t(context.proc), false);
+      Value *cptr = GetElementPtrInst::Create(counters, index, "", CB);
+      Value *count = new LoadInst(cptr, "", CB);
+      count = BinaryOperator::Create(Instruction::Add, count,
+                                     CONST_INT(32, 1, false), "", CB);
+      new StoreInst(count, cptr, CB);
+
+      // promotion is asked for once, when the threshold is reached
+      Value *threshold = CONST_INT(32, optimizedThreshold, false);
+      Value *cond = new ICmpInst(*CB, ICmpInst::ICMP_EQ, count, threshold);
+      BasicBlock *pblock = BasicBlock::Create(llvmModule->getContext(), "",
+                                              CF, 0);
+      BasicBlock *nblock = BasicBlock::Create(llvmModule->getContext(), "",
+                                              CF, 0);
+      BranchInst::Create(pblock, nblock, cond, CB);
+
+      Function *prom = llvmModule->getFunction(PROMOTE_FUNC_NAME);
+      vector<Value*> args;
+      args.push_back(llvmModule->getGlobalVariable(MDATA_VAR_NAME));
+      args.push_back(CONST_INT(32, uint64_t(context.proc), false));
+      CALL_FUNC(pblock, call, prom, args);
+      BranchInst::Create(nblock, pblock);
+
+      CB = nblock;
+    }
+
+    // Emits a preheader for the loop about to start, computing whether all
+    // indexes it will take are in range of the arrays it accesses; checks
+    // still run where they do not, so range errors stay where they were
+    void Runtime::ModuleData::emitRangeGuard(LLVMContext &context) {
+      RangeLoop loop;
+      if(!findRangeLoop(procs[context.proc].instrs, context.instrIndex,
+                        context.frameRegs(), loop))
+        return;
+      if((loop.index.frame != GLOBAL_FRAME &&
+          context.frames[loop.index.frame].ftype == FT_REGR) ||
+         (!loop.immBound && loop.bound.frame != GLOBAL_FRAME &&
+          context.frames[loop.bound.frame].ftype == FT_REGR))
+        return;
+
+      // nothing but the block above branches to the loop yet
+      BasicBlock *head = context.blocks[context.blockIndex + 1];
+      CB = BasicBlock::Create(llvmModule->getContext(), "", CF, head);
+      head->replaceAllUsesWith(CB);
+
+      Value *first = BITCAST_PINT(64, emitRegValue(context, loop.index.reg),
+                                  CB);
+      first = new LoadInst(first, "", CB);
+      Value *bound = CONST_INT(64, uint64_t(loop.boundImm), true);
+      if(!loop.immBound) {
+        bound = BITCAST_PINT(64, emitRegValue(context, loop.bound.reg), CB);
+        bound = new LoadInst(bound, "", CB);
+      }
+      if(!loop.inclusive) // index is never at the bound before the step
+        bound = BinaryOperator::Create(loop.down ? Instruction::Add
+                                       : Instruction::Sub, bound,
+                                       CONST_INT(64, 1, false), "", CB);
+
+      // index before the step is in [low, high], lower and upper end may
+      // be one step further for arrays accessed after it
+      Value *cond = new ICmpInst(*CB, loop.down ? ICmpInst::ICMP_SLT
+                                 : ICmpInst::ICMP_SGT, first, bound);
+      Value *last = SelectInst::Create(cond, first, bound, "", CB);
+      Value *low = loop.down ? last : first, *high = loop.down ? first : last;
+      Value *lowIn = new ICmpInst(*CB, ICmpInst::ICMP_SGE, low,
+                                  CONST_INT(64, 0, false));
+      Value *lowInAfter = lowIn, *highAfter = high;
+      if(loop.down)
+        lowInAfter = new ICmpInst(*CB, ICmpInst::ICMP_SGT, low,
+                                  CONST_INT(64, 0, false));
+      else highAfter = BinaryOperator::Create(Instruction::Add, high,
+                                              CONST_INT(64, 1, false), "",
+                                              CB);
+      cond = ConstantInt::getTrue(llvmModule->getContext());
+
+      std::map<LoopReg, bool>::const_iterator iter;
+      for(iter = loop.arrays.begin(); iter != loop.arrays.end(); iter++) {
+        RegId reg = iter->first.reg;
+        Value *count = CONST_INT(64, uint64_t(regs[reg].count), false);
+
+        // null reference is not an error yet, the loop may not reach it
+        if(context.frames[iter->first.frame].ftype == FT_REGR &&
+           regs[reg].flags & VFLAG_NON_FIXED_REF) {
+          Value *vptr = new LoadInst(context.frames[iter->first.frame].vptr,
+                                     "", CB);
+          PointerType *ptype = static_cast<PointerType*>(vptr->getType());
+          Value *nonNull = new ICmpInst(*CB, ICmpInst::ICMP_NE, vptr,
+                                        ConstantPointerNull::get(ptype));
+          BasicBlock *from = CB;
+          BasicBlock *lblock = BasicBlock::Create(llvmModule->getContext(),
+                                                  "", CF, head);
+          CB = BasicBlock::Create(llvmModule->getContext(), "", CF, head);
+          BranchInst::Create(lblock, CB, nonNull, from);
+          Value *lcount = new LoadInst(emitSpecialPtr(lblock, vptr,
+                                                      SFLD_ELT_COUNT),
+                                       "", lblock);
+          BranchInst::Create(CB, lblock);
+
+          PHINode *phi = PHINode::Create(TYPE_INT(64), 2, "", CB);
+          phi->addIncoming(CONST_INT(64, 0, false), from);
+          phi->addIncoming(lcount, lblock);
+          count = phi;
+        }
+
+        // high is not below low if low is in range, so it is unsigned
+        Value *highIn = new ICmpInst(*CB, ICmpInst::ICMP_ULT, iter->second ?
+                                     highAfter : high, count);
+        cond = BinaryOperator::CreateAnd(cond, iter->second ? lowInAfter
+                                         : lowIn, "", CB);
+        cond = BinaryOperator::CreateAnd(cond, highIn, "", CB);
+      }
+      BranchInst::Create(head, CB);
+
+      for(size_t i = 0; i < loop.accesses.size(); i++)
+        context.inRange[loop.accesses[i]] = cond;
     }
 
 #ifdef CONFIG_DEBUG
@@ -749,8 +1961,6 @@ namespace Ant {
       Function* func = Function::Create(ftype, GlobalValue::ExternalLinkage,
                                         TRACE_FUNC_NAME, llvmModule);
       func->setCallingConv(CallingConv::C);
-
-      llvmEE->addGlobalMapping(func, funcPtrToVoidPtr(&ant_vm_trace));
     }
 
     void Runtime::ModuleData::emitTrace(BasicBlock *block, size_t index,
@@ -767,57 +1977,104 @@ namespace Ant {
       args.push_back(ptr);
       CALL_FUNC(block, call, trc, args);
     }
+
+    extern "C" { uint64_t ant_vm_range_checks = 0; }
+
+    void Runtime::ModuleData::createRangeChecksVar() {
+      new GlobalVariable(*llvmModule, TYPE_INT(64), false,
+                         GlobalValue::ExternalLinkage, 0,
+                         RANGE_CHECKS_VAR_NAME);
+    }
+
+    // Counts range checks run, but not those a loop guard holds for, so
+    // tests can tell that unswitching removed them
+    void Runtime::ModuleData::emitRangeCheckCount(BasicBlock *block,
+                                                  Value *inRange) {
+      Value *ptr = llvmModule->getGlobalVariable(RANGE_CHECKS_VAR_NAME);
+      Value *inc = CONST_INT(64, 1, false);
+      if(inRange)
+        inc = SelectInst::Create(inRange, CONST_INT(64, 0, false), inc, "",
+                                 block);
+      Value *count = new LoadInst(ptr, "", block);
+      count = BinaryOperator::Create(Instruction::Add, count, inc, "", block);
+      new StoreInst(count, ptr, block);
+    }
 #endif
 
 #define UOINSTR_CASE(op, iop, co) \
     case OPCODE_##op: \
-      emitLLVMCodeUO<OPCODE_##op, Instruction::iop, co>( \
-        context, static_cast<UOInstrT<OPCODE_##op>&>(instr)); break;
+      emitLLVMCodeUO<Instruction::iop, co>(context, instr); break;
+
+#define BOINSTR_CASE(op, iop, val) \
+    case OPCODE_##op: \
+      emitLLVMCodeBO<Instruction::iop, val>(context, instr); break;
+
+#define DIVINSTR_CASE(op, iop, val) \
+    case OPCODE_##op: \
+      emitLLVMCodeDIV<Instruction::iop, val>(context, instr); break;
 
-#define BOINSTR_CASE(op, iop) \
+#define BJIINSTR_CASE(op, pr) \
     case OPCODE_##op: \
-      emitLLVMCodeBO<OPCODE_##op, Instruction::iop>( \
-        context, static_cast<BOInstrT<OPCODE_##op>&>(instr)); break;
+      emitLLVMCodeBJI<ICmpInst::pr>(context, instr); break;
+
+#define BOIINSTR_CASE(op, iop) \
+    case OPCODE_##op: \
+      emitLLVMCodeBOI<Instruction::iop>(context, instr); break;
 
 #define CPIINSTR_CASE(op, val) \
     case OPCODE_##op: \
-      emitLLVMCodeCPI<OPCODE_##op, val>( \
-        context, static_cast<CPIInstrT<OPCODE_##op, val>&>(instr)); break;
+      emitLLVMCodeCPI<val>(context, instr); break;
 
 #define UJINSTR_CASE(op, pr, co) \
     case OPCODE_##op: \
-      emitLLVMCodeUJ<OPCODE_##op, ICmpInst::pr, co>( \
-        context, static_cast<UJInstrT<OPCODE_##op>&>(instr)); break;
+      emitLLVMCodeUJ<ICmpInst::pr, co>(context, instr); break;
 
 #define BJINSTR_CASE(op, pr) \
     case OPCODE_##op: \
-      emitLLVMCodeBJ<OPCODE_##op, ICmpInst::pr>( \
-        context, static_cast<BJInstrT<OPCODE_##op>&>(instr)); break;
+      emitLLVMCodeBJ<ICmpInst::pr>(context, instr); break;
 
 #define PUSHINSTR_CASE(op, ref) \
     case OPCODE_##op: \
-      emitLLVMCodePUSH<OPCODE_##op, ref>( \
-        context, static_cast<PUSHInstrT<OPCODE_##op, ref>&>(instr)); break;
+      emitLLVMCodePUSH<ref>(context, instr); break;
+
+#define AOINSTR_CASE(op) \
+    case OPCODE_##op: \
+      emitLLVMCodeAO(context, instr); break;
+
+#define ARINSTR_CASE(op) \
+    case OPCODE_##op: \
+      emitLLVMCodeAR(context, instr); break;
 
 #define INSTR_CASE(op) \
     case OPCODE_##op: \
-      emitLLVMCode##op(context, static_cast<op##Instr&>(instr)); break;
+      emitLLVMCode##op(context, instr); break;
 
     void Runtime::ModuleData::emitLLVMCode(LLVMContext &context) {
-      Instr instr;
-      for(size_t i = 0; i < procs[context.proc].code.size();
-          i += instr.size()) {
-        instr.set(&procs[context.proc].code[i]);
+      const FixedArray<InstrData> &instrs = procs[context.proc].instrs;
+
+      // code below the optimized tier counts calls and loop iterations,
+      // other code guards index ranges of loops where unswitching can
+      // make use of the guards
+      set<size_t> loopHeads;
+      for(size_t i = 0; i < instrs.size(); i++)
+        if(instrs[i].branches && instrs[i].branchIndex <= i)
+          loopHeads.insert(instrs[i].branchIndex);
+      bool counted = tiered && procTiers[context.proc] != TIER_OPTIMIZED;
+      if(counted)
+        emitTierCounter(context);
+
+      for(size_t i = 0; i < instrs.size(); i++) {
+        const InstrData &instr = instrs[i];
 
 #ifdef CONFIG_DEBUG
-        emitTrace(CB, context.instrIndex, instr.opcode());
+        emitTrace(CB, context.instrIndex, instr.opcode);
 #endif
-        switch(instr.opcode()) {
+        switch(instr.opcode) {
           UOINSTR_CASE(INC, Add, 1);
           UOINSTR_CASE(DEC, Sub, 1);
-          BOINSTR_CASE(ADD, Add);
-          BOINSTR_CASE(SUB, Sub);
-          BOINSTR_CASE(MUL, Mul);
+          BOINSTR_CASE(ADD, Add, uint64_t);
+          BOINSTR_CASE(SUB, Sub, uint64_t);
+          BOINSTR_CASE(MUL, Mul, uint64_t);
           UJINSTR_CASE(JNZ, ICMP_NE, 0);
           BJINSTR_CASE(JG, ICMP_SGT);
           BJINSTR_CASE(JNG, ICMP_SLE);
@@ -841,6 +2098,80 @@ namespace Ant {
           INSTR_CASE(CALL);
           INSTR_CASE(THROW);
           INSTR_CASE(RET);
+          AOINSTR_CASE(AADD);
+          AOINSTR_CASE(ASUB);
+          AOINSTR_CASE(AMUL);
+          AOINSTR_CASE(AMIN);
+          AOINSTR_CASE(AMAX);
+          AOINSTR_CASE(ACMPE);
+          AOINSTR_CASE(ACMPG);
+          ARINSTR_CASE(ARSUM);
+          ARINSTR_CASE(ARMIN);
+          ARINSTR_CASE(ARMAX);
+          INSTR_CASE(AFILL);
+          BOINSTR_CASE(ADD1, Add, uint8_t);
+          BOINSTR_CASE(ADD2, Add, uint16_t);
+          BOINSTR_CASE(ADD4, Add, uint32_t);
+          BOINSTR_CASE(SUB1, Sub, uint8_t);
+          BOINSTR_CASE(SUB2, Sub, uint16_t);
+          BOINSTR_CASE(SUB4, Sub, uint32_t);
+          BOINSTR_CASE(MUL1, Mul, uint8_t);
+          BOINSTR_CASE(MUL2, Mul, uint16_t);
+          BOINSTR_CASE(MUL4, Mul, uint32_t);
+          DIVINSTR_CASE(SDIV1, SDiv, int8_t);
+          DIVINSTR_CASE(SDIV2, SDiv, int16_t);
+          DIVINSTR_CASE(SDIV4, SDiv, int32_t);
+          DIVINSTR_CASE(SDIV8, SDiv, int64_t);
+          DIVINSTR_CASE(UDIV1, UDiv, uint8_t);
+          DIVINSTR_CASE(UDIV2, UDiv, uint16_t);
+          DIVINSTR_CASE(UDIV4, UDiv, uint32_t);
+          DIVINSTR_CASE(UDIV8, UDiv, uint64_t);
+          DIVINSTR_CASE(SREM1, SRem, int8_t);
+          DIVINSTR_CASE(SREM2, SRem, int16_t);
+          DIVINSTR_CASE(SREM4, SRem, int32_t);
+          DIVINSTR_CASE(SREM8, SRem, int64_t);
+          DIVINSTR_CASE(UREM1, URem, uint8_t);
+          DIVINSTR_CASE(UREM2, URem, uint16_t);
+          DIVINSTR_CASE(UREM4, URem, uint32_t);
+          DIVINSTR_CASE(UREM8, URem, uint64_t);
+          BOINSTR_CASE(SHL1, Shl, uint8_t);
+          BOINSTR_CASE(SHL2, Shl, uint16_t);
+          BOINSTR_CASE(SHL4, Shl, uint32_t);
+          BOINSTR_CASE(SHL8, Shl, uint64_t);
+          BOINSTR_CASE(SHR1, LShr, uint8_t);
+          BOINSTR_CASE(SHR2, LShr, uint16_t);
+          BOINSTR_CASE(SHR4, LShr, uint32_t);
+          BOINSTR_CASE(SHR8, LShr, uint64_t);
+          BOINSTR_CASE(SAR1, AShr, int8_t);
+          BOINSTR_CASE(SAR2, AShr, int16_t);
+          BOINSTR_CASE(SAR4, AShr, int32_t);
+          BOINSTR_CASE(SAR8, AShr, int64_t);
+          BOINSTR_CASE(AND1, And, uint8_t);
+          BOINSTR_CASE(AND2, And, uint16_t);
+          BOINSTR_CASE(AND4, And, uint32_t);
+          BOINSTR_CASE(AND8, And, uint64_t);
+          BOINSTR_CASE(OR1, Or, uint8_t);
+          BOINSTR_CASE(OR2, Or, uint16_t);
+          BOINSTR_CASE(OR4, Or, uint32_t);
+          BOINSTR_CASE(OR8, Or, uint64_t);
+          BOINSTR_CASE(XOR1, Xor, uint8_t);
+          BOINSTR_CASE(XOR2, Xor, uint16_t);
+          BOINSTR_CASE(XOR4, Xor, uint32_t);
+          BOINSTR_CASE(XOR8, Xor, uint64_t);
+          BOINSTR_CASE(FADD4, FAdd, float);
+          BOINSTR_CASE(FADD8, FAdd, double);
+          BOINSTR_CASE(FSUB4, FSub, float);
+          BOINSTR_CASE(FSUB8, FSub, double);
+          BOINSTR_CASE(FMUL4, FMul, float);
+          BOINSTR_CASE(FMUL8, FMul, double);
+          BOINSTR_CASE(FDIV4, FDiv, float);
+          BOINSTR_CASE(FDIV8, FDiv, double);
+          BJIINSTR_CASE(JEI, ICMP_EQ);
+          BJIINSTR_CASE(JGI, ICMP_SGT);
+          BJIINSTR_CASE(JNGI, ICMP_SLE);
+          BOIINSTR_CASE(ADDI, Add);
+          BOIINSTR_CASE(SUBI, Sub);
+          BOIINSTR_CASE(MULI, Mul);
         }
 
         context.instrIndex++;
@@ -849,25 +2180,57 @@ namespace Ant {
            context.blockIndexes[nextBlockIndex] == context.instrIndex) {
           if(!CB->getTerminator())
             BranchInst::Create(context.blocks[nextBlockIndex], CB);
+          context.passFacts();
+          bool loopHead = loopHeads.count(context.instrIndex);
+          if(loopHead && !counted && optLevel >= OPT_O2)
+            emitRangeGuard(context);
           CB = context.blocks[++context.blockIndex];
+          if(loopHead && counted)
+            emitTierCounter(context);
         }
       }
 
-      if(!context.blocks.back()->getTerminator())
-        ReturnInst::Create(llvmModule->getContext(), context.blocks.back());
+      if(!CB->getTerminator()) {
+        emitTailIOCleanup(context, CB);
+        ReturnInst::Create(llvmModule->getContext(), CONST_INT(1, 0, false),
+                           CB);
+      }
     }
 
     extern "C" void *_ZTIx;
 
     void Runtime::ModuleData::createZTIVar() {
-      GlobalValue *zti = new GlobalVariable(*llvmModule, TYPE_PTR(TYPE_INT(8)),
-                                            true, GlobalValue::ExternalLinkage,
-                                            0, ZTI_VAR_NAME);
-      llvmEE->addGlobalMapping(zti, &_ZTIx);
+      new GlobalVariable(*llvmModule, TYPE_PTR(TYPE_INT(8)), true,
+                         GlobalValue::ExternalLinkage, 0, ZTI_VAR_NAME);
+    }
+
+    void Runtime::ModuleData::createVarSpecVars() {
+      new GlobalVariable(*llvmModule, TYPE_INT(8), true,
+                         GlobalValue::ExternalLinkage, 0, VTYPES_VAR_NAME);
+      new GlobalVariable(*llvmModule, TYPE_PTR(TYPE_INT(8)), true,
+                         GlobalValue::ExternalLinkage, 0, VSPECS_VAR_NAME);
+    }
+
+    void Runtime::ModuleData::createTierVars() {
+      new GlobalVariable(*llvmModule, TYPE_INT(32), false,
+                         GlobalValue::ExternalLinkage, 0, COUNTERS_VAR_NAME);
+      new GlobalVariable(*llvmModule, TYPE_INT(8), false,
+                         GlobalValue::ExternalLinkage, 0, MDATA_VAR_NAME);
+
+      vector<Type*> argTypes;
+      argTypes.push_back(TYPE_PTR(TYPE_INT(8)));
+      argTypes.push_back(TYPE_INT(32));
+      Type *retType = Type::getVoidTy(llvmModule->getContext());
+      FunctionType *ftype = FunctionType::get(retType, argTypes, false);
+
+      Function *func = Function::Create(ftype, GlobalValue::ExternalLinkage,
+                                        PROMOTE_FUNC_NAME, llvmModule);
+      func->setCallingConv(CallingConv::C);
     }
 
     void Runtime::ModuleData::createLLVMPVars() {
       createZTIVar();
+      createVarSpecVars();
 
       for(RegId reg = 0; reg < regs.size(); reg++)
         if(regs[reg].flags & VFLAG_TOP_LEVEL_REG) {
@@ -901,9 +2264,6 @@ namespace Ant {
       Function* func = Function::Create(ftype, GlobalValue::ExternalLinkage,
                                         CXA_EALLOC_FUNC_NAME, llvmModule);
       func->setCallingConv(CallingConv::C);
-
-      llvmEE->addGlobalMapping(func,
-                               funcPtrToVoidPtr(&__cxa_allocate_exception));
     }
 
     extern "C" void __cxa_throw(void*, void*, void*);
@@ -916,21 +2276,6 @@ namespace Ant {
       Function* func = Function::Create(ftype, GlobalValue::ExternalLinkage,
                                         CXA_THROW_FUNC_NAME, llvmModule);
       func->setCallingConv(CallingConv::C);
-
-      llvmEE->addGlobalMapping(func, funcPtrToVoidPtr(&__cxa_throw));
-    }
-
-    extern "C" void __gxx_personality_v0(...);
-
-    void Runtime::ModuleData::createGXXPersFunc() {
-      vector<Type*> argTypes;
-      FunctionType *ftype = FunctionType::get(TYPE_INT(32), argTypes, true);
-
-      Function* func = Function::Create(ftype, GlobalValue::ExternalLinkage,
-                                        GXX_PERS_FUNC_NAME, llvmModule);
-      func->setCallingConv(CallingConv::C);
-
-      llvmEE->addGlobalMapping(func, funcPtrToVoidPtr(&__gxx_personality_v0));
     }
 
     void Runtime::ModuleData::createThrowFunc() {
@@ -982,73 +2327,337 @@ namespace Ant {
       Function* func = Function::Create(ftype, GlobalValue::ExternalLinkage,
                                         DESTROY_FUNC_NAME, llvmModule);
       func->setCallingConv(CallingConv::C);
+    }
 
-      llvmEE->addGlobalMapping(func,
-                               funcPtrToVoidPtr(&ant_vm_destroy_variable));
+    void Runtime::ModuleData::mapLLVMGlobal(const char *name, void *addr) {
+      GlobalValue *gv = llvmModule->getNamedValue(name);
+      if(gv)
+        llvmEE->addGlobalMapping(gv, addr);
     }
 
-    void Runtime::ModuleData::createLLVMFuncs() {
+    void Runtime::ModuleData::mapLLVMGlobals() {
+      vspecPtrs.clear();
+      for(size_t i = 0; i < regs.size(); i++)
+        vspecPtrs.push_back(&regs[i]);
+      for(size_t i = 0; i < vtypes.size(); i++)
+        for(size_t j = 0; j < vtypes[i].vrefs.size(); j++)
+          vspecPtrs.push_back(&vtypes[i].vrefs[j]);
+
+      mapLLVMGlobal(ZTI_VAR_NAME, &_ZTIx);
+      mapLLVMGlobal(VTYPES_VAR_NAME, &vtypes);
+      mapLLVMGlobal(VSPECS_VAR_NAME, vspecPtrs.empty() ? NULL : &vspecPtrs[0]);
+#ifdef CONFIG_DEBUG
+      mapLLVMGlobal(TRACE_FUNC_NAME, funcPtrToVoidPtr(&ant_vm_trace));
+      mapLLVMGlobal(RANGE_CHECKS_VAR_NAME, &ant_vm_range_checks);
+#endif
+      mapLLVMGlobal(CXA_EALLOC_FUNC_NAME,
+                    funcPtrToVoidPtr(&__cxa_allocate_exception));
+      mapLLVMGlobal(CXA_THROW_FUNC_NAME, funcPtrToVoidPtr(&__cxa_throw));
+      mapLLVMGlobal(DESTROY_FUNC_NAME,
+                    funcPtrToVoidPtr(&ant_vm_destroy_variable));
+
+      if(tiered) { // compiled code works on registers of the interpreter
+        uint8_t *globals = reinterpret_cast<uint8_t*>(&interpGlobals[0]);
+        for(RegId reg = 0; reg < regs.size(); reg++)
+          if(regs[reg].flags & VFLAG_TOP_LEVEL_REG)
+            mapLLVMGlobal(varName(reg).c_str(),
+                          globals + interpGlobalOffsets[reg]);
+
+        mapLLVMGlobal(COUNTERS_VAR_NAME,
+                      procCounters.empty() ? NULL : &procCounters[0]);
+        mapLLVMGlobal(MDATA_VAR_NAME, this);
+        mapLLVMGlobal(PROMOTE_FUNC_NAME, funcPtrToVoidPtr(&promoteHotProc));
+      }
+    }
+
+    void Runtime::ModuleData::createLLVMFuncs(bool lazy) {
 #ifdef CONFIG_DEBUG
       createTraceFunc();
+      createRangeChecksVar();
 #endif
       createCXAEAllocFunc();  
       createCXAThrowFunc();
-      createGXXPersFunc();
       createThrowFunc();
       createDestroyFunc();
 
+      // procedures return whether an exception propagates, entries
+      // called from outside of compiled code throw it
       for(ProcId proc = 0; proc < procs.size(); proc++) {
         vector<Type*> argTypes;
         RegId io = ptypes[procs[proc].ptype].io;
         argTypes.push_back(TYPE_PTR(getEltLLVMType(regs[io].vtype)));
-        Type *voidType = Type::getVoidTy(llvmModule->getContext());
-        FunctionType *ftype = FunctionType::get(voidType, argTypes, false);
+        FunctionType *ftype = FunctionType::get(TYPE_INT(1), argTypes, false);
+
+        Function *func = Function::Create(ftype, GlobalValue::InternalLinkage,
+                                          funcName(proc), llvmModule);
+        func->setCallingConv(CallingConv::Fast);
 
         bool external = procs[proc].flags & PFLAG_EXTERNAL;
         GlobalValue::LinkageTypes link = external ?
           GlobalValue::ExternalLinkage : GlobalValue::InternalLinkage;
+        Type *voidType = Type::getVoidTy(llvmModule->getContext());
+        ftype = FunctionType::get(voidType, argTypes, false);
+
+        Function *entry = Function::Create(ftype, link, entryName(proc),
+                                           llvmModule);
+        entry->setCallingConv(CallingConv::C);
+        emitLLVMEntry(entry, func);
+      }
+
+      if(lazy) { // module takes ownership of materializer
+        llvmModule->setMaterializer(new LLVMMaterializer(*this));
+        if(tiered)
+          llvmEE->DisableLazyCompilation(false);
+        return;
+      }
+
+      for(ProcId proc = 0; proc < procs.size(); proc++)
+        emitLLVMFunc(proc, llvmModule->getFunction(funcName(proc)));
+    }
+
+    void Runtime::ModuleData::emitLLVMEntry(Function *entry, Function *func) {
+      BasicBlock *block = BasicBlock::Create(llvmModule->getContext(), "",
+                                             entry, 0);
+      vector<Value*> args(1, entry->arg_begin());
+      CALL_FUNC(block, call, func, args);
+
+      BasicBlock *tblock = BasicBlock::Create(llvmModule->getContext(), "",
+                                              entry, 0);
+      BasicBlock *rblock = BasicBlock::Create(llvmModule->getContext(), "",
+                                              entry, 0);
+      BranchInst::Create(tblock, rblock, call, block);
+
+      Function *thrw = llvmModule->getFunction(THROW_FUNC_NAME);
+      Value *edptr =llvmModule->getGlobalVariable(varName(PRESET_REG_ED),true);
+      args.assign(1, new LoadInst(BITCAST_PINT(64, edptr, tblock), "", tblock));
+      CALL_FUNC(tblock, tcall, thrw, args);
+      new UnreachableInst(llvmModule->getContext(), tblock);
+
+      ReturnInst::Create(llvmModule->getContext(), rblock);
+    }
+
+    void Runtime::ModuleData::emitLLVMFunc(ProcId proc, Function *func) {
+      LLVMContext context = { proc, func, 0, 0 };
+      prepareLLVMContext(context);
+      emitLLVMCode(context);
+
+      if(tiered && procTiers[proc] != TIER_OPTIMIZED)
+        llvmBaseFPM->run(*func);
+      else llvmFPM->run(*func);
+    }
+
+    void Runtime::ModuleData::resolveNativeProcs(bool lazy) {
+      nativeProcs.assign(procs.size(), NULL);
+      if(lazy) // natives stay empty, calls go through compileLazyProc()
+        return;
+
+      for(ProcId proc = 0; proc < procs.size(); proc++) {
+        Function *func = llvmModule->getFunction(entryName(proc));
+        void *vPtr = llvmEE->getPointerToFunction(func);
+        uintptr_t uPtr = reinterpret_cast<uintptr_t>(vPtr);
+
+        nativeProcs[proc] = reinterpret_cast<NativeProc>(uPtr);
+      }
+
+      if(!nativeProcs.empty())
+        natives.set(&nativeProcs[0], nativeProcs.size());
+    }
+
+    void Runtime::ModuleData::prepareLLVMFPM(FunctionPassManager &fpm,
+                                             OptLevel level) {
+      fpm.add(new TargetData(*llvmEE->getTargetData()));
+
+      if(level >= OPT_O1) {
+        fpm.add(createBasicAliasAnalysisPass());
+        fpm.add(createScalarReplAggregatesPass());
+        fpm.add(createPromoteMemoryToRegisterPass());
+        fpm.add(createInstructionCombiningPass());
+        fpm.add(createCFGSimplificationPass());
+      }
+
+      if(level >= OPT_O2) {
+        fpm.add(createEarlyCSEPass());
+        if(level >= OPT_O3) {
+          fpm.add(createJumpThreadingPass());
+          fpm.add(createCorrelatedValuePropagationPass());
+        }
+        fpm.add(createReassociatePass());
+        fpm.add(createLoopRotatePass());
+        fpm.add(createLICMPass());
+        fpm.add(createLoopUnswitchPass());
+        if(level >= OPT_O3) {
+          fpm.add(createIndVarSimplifyPass());
+          fpm.add(createLoopUnrollPass());
+        }
+        fpm.add(createGVNPass());
+        fpm.add(createMemCpyOptPass());
+        fpm.add(createSCCPPass());
+        fpm.add(createInstructionCombiningPass());
+        fpm.add(createDeadStoreEliminationPass());
+        fpm.add(createAggressiveDCEPass());
+        fpm.add(createCFGSimplificationPass());
+      }
+
+      fpm.doInitialization();
+    }
 
-        Function *func = Function::Create(ftype, link, funcName(proc),
-                                          llvmModule);
-        func->setCallingConv(external ? CallingConv::C : CallingConv::Fast);
+    // Calls of procedures within the inlining budget are inlined unless
+    // the callee leads back to the caller, the budget is compared with
+    // bytecode instructions as bodies may already contain inlined code
+    void Runtime::ModuleData::inlineLLVMCalls() {
+      Runtime &rt = Runtime::instance();
+      if(!rt.inlineBudget())
+        return;
+
+      vector<set<ProcId> > callees(procs.size());
+      std::map<Function*, ProcId> funcs;
+      for(ProcId proc = 0; proc < procs.size(); proc++) {
+        const FixedArray<InstrData> &instrs = procs[proc].instrs;
+        for(size_t i = 0; i < instrs.size(); i++)
+          if(instrs[i].opcode == OPCODE_CALL)
+            callees[proc].insert(ProcId(instrs[i].params[0]));
+
+        funcs[llvmModule->getFunction(funcName(proc))] = proc;
       }
 
       for(ProcId proc = 0; proc < procs.size(); proc++) {
         Function *func = llvmModule->getFunction(funcName(proc));
 
-        LLVMContext context = { proc, func, 0, 0 };
-        prepareLLVMContext(context);
-        emitLLVMCode(context);
+        vector<CallInst*> calls;
+        for(Function::iterator b = func->begin(); b != func->end(); b++)
+          for(BasicBlock::iterator i = b->begin(); i != b->end(); i++)
+            if(CallInst *call = dyn_cast<CallInst>(i))
+              if(funcs.count(call->getCalledFunction()))
+                calls.push_back(call);
+
+        bool inlined = false;
+        for(size_t i = 0; i < calls.size(); i++) {
+          ProcId callee = funcs[calls[i]->getCalledFunction()];
+          InlineDecision decision = INLINE_DONE;
+
+          if(reachesProc(callees, callee, proc))
+            decision = INLINE_RECURSIVE;
+          else if(procs[callee].instrs.size() > rt.inlineBudget())
+            decision = INLINE_OVER_BUDGET;
+          else {
+            InlineFunctionInfo info(NULL, llvmEE->getTargetData());
+            if(InlineFunction(calls[i], info))
+              inlined = true;
+            else decision = INLINE_REFUSED;
+          }
+
+          if(rt.inlineHook())
+            rt.inlineHook()(id, proc, callee, decision);
+        }
 
-        llvmFPM->run(*func);
+        // inlined code is optimized along with the code of the caller
+        if(inlined)
+          llvmFPM->run(*func);
       }
     }
 
-    void Runtime::ModuleData::prepareLLVMFPM() {
-      llvmFPM->add(new TargetData(*llvmEE->getTargetData()));
-      // add passes here
-      llvmFPM->doInitialization();
+    void Runtime::ModuleData::runLLVMModulePasses(OptLevel level) {
+      if(level < OPT_O2)
+        return;
+
+      inlineLLVMCalls();
+
+      // function passes have already run on every procedure, module
+      // passes make use of their results to prune exception handling
+      PassManager llvmMPM;
+      llvmMPM.add(new TargetData(*llvmEE->getTargetData()));
+      if(level >= OPT_O3)
+        llvmMPM.add(createIPSCCPPass());
+      llvmMPM.add(createFunctionAttrsPass());
+      llvmMPM.add(createPruneEHPass());
+      llvmMPM.run(*llvmModule);
+    }
+
+    void Runtime::ModuleData::assertUnpackArgs(OptLevel level,
+                                               uint32_t flags) {
+      if(level < OPT_O0 || level >= OPT_LEVEL_COUNT)
+        throw RangeException();
+      if(flags & ~(UFLAG_LAZY | UFLAG_INTERPRET | UFLAG_TIERED))
+        throw FlagsException();
+      if((flags & UFLAG_TIERED) && (flags & (UFLAG_LAZY | UFLAG_INTERPRET)))
+        throw FlagsException();
     }
 
-    void Runtime::ModuleData::unpack() {
+    void Runtime::ModuleData::unpack(OptLevel level, uint32_t flags) {
       assertNotDropped();
+      assertUnpackArgs(level, flags);
 
-      if(isPacked())
+      waitUnpacked();
+      compile(level, flags);
+    }
+
+    void Runtime::ModuleData::unpackAsync(OptLevel level, uint32_t flags) {
+      assertNotDropped();
+      assertUnpackArgs(level, flags);
+
+      Runtime &rt = Runtime::instance();
+      MutexLock lock(rt.unpackMutex);
+      if(unpackPending || llvmModule || interpreted)
+        return;
+
+      rt.queueUnpack(*this, level, flags);
+      unpackPending = true;
+    }
+
+    bool Runtime::ModuleData::isUnpacking() const {
+      Runtime &rt = Runtime::instance();
+      MutexLock lock(rt.unpackMutex);
+      return unpackPending;
+    }
+
+    void Runtime::ModuleData::waitUnpacked() const {
+      Runtime &rt = Runtime::instance();
+      MutexLock lock(rt.unpackMutex);
+      while(unpackPending)
+        rt.unpackDone.wait(rt.unpackMutex);
+    }
+
+    void Runtime::ModuleData::compile(OptLevel level, uint32_t flags) {
+      if(llvmModule || interpreted)
+        return;
+
+      if(flags & (UFLAG_INTERPRET | UFLAG_TIERED)) {
         try {
-          string err, idStr = id.str();
-          llvmModule = new llvm::Module(idStr, getGlobalContext());
-          llvmFPM = new FunctionPassManager(llvmModule);
-          llvmEE = EngineBuilder(llvmModule).setErrorStr(&err).create();
-          if(!llvmEE) {
-#ifdef CONFIG_DEBUG
-            cerr << endl << "Cannot load JIT (" << err << ")" << endl << endl;
-#endif
-            throw EnvironmentException();
-          }
+          prepareInterp();
+          if(flags & UFLAG_TIERED)
+            compileTiered(level);
+        }
+        catch(...) { releaseInterp(); throw; }
+        return;
+      }
 
-          prepareLLVMFPM();
-          createLLVMPVars();
-          createLLVMFuncs();
+      MutexLock lock(Runtime::instance().llvmMutex);
+      lazy = flags & UFLAG_LAZY;
+
+      if(!llvmModule)
+        try {
+          string idStr = id.str();
+          string cachePath = codeCachePath(level);
+          if(!cachePath.empty())
+            llvmModule = loadLLVMCache(cachePath, lazy);
+          bool cached = llvmModule;
+          if(!cached)
+            llvmModule = new llvm::Module(idStr, getGlobalContext());
+          createLLVMEngine();
+
+          if(!cached) { // otherwise bitcode has already been optimized
+            optLevel = level;
+            prepareLLVMFPM(*llvmFPM, level);
+            createLLVMPVars();
+            createLLVMFuncs(lazy);
+            if(!lazy) { // module passes need all procedure bodies
+              runLLVMModulePasses(level);
+              if(!cachePath.empty())
+                saveLLVMCache(cachePath);
+            }
+          }
+          mapLLVMGlobals();
+          resolveNativeProcs(lazy);
 
 #ifdef CONFIG_DEBUG
           cerr << endl;
@@ -1058,7 +2667,143 @@ namespace Ant {
             throw BugException();
 #endif
         }
-        catch(...) { pack(); throw; }
+        catch(...) { releaseLLVM(); throw; }
+    }
+
+    void Runtime::ModuleData::createLLVMEngine() {
+      string err;
+      llvmFPM = new FunctionPassManager(llvmModule);
+      llvmEE = EngineBuilder(llvmModule).setErrorStr(&err).create();
+      if(!llvmEE) {
+#ifdef CONFIG_DEBUG
+        cerr << endl << "Cannot load JIT (" << err << ")" << endl << endl;
+#endif
+        throw EnvironmentException();
+      }
+    }
+
+    // Procedures start in the interpreter, which must have been prepared,
+    // and are compiled one by one as they get hot
+    void Runtime::ModuleData::compileTiered(OptLevel level) {
+      Runtime &rt = Runtime::instance();
+      MutexLock lock(rt.llvmMutex);
+
+      try {
+        llvmModule = new llvm::Module(id.str(), getGlobalContext());
+        createLLVMEngine();
+        llvmBaseFPM = new FunctionPassManager(llvmModule);
+
+        tiered = true;
+        baselineThreshold = rt.tierThreshold(TIER_BASELINE);
+        optimizedThreshold = rt.tierThreshold(TIER_OPTIMIZED);
+        procTiers.assign(procs.size(), TIER_INTERPRETED);
+        procCounters.assign(procs.size(), 0);
+        nativeProcs.assign(procs.size(), NULL); // natives stay empty
+
+        optLevel = level;
+        prepareLLVMFPM(*llvmFPM, level);
+        prepareLLVMFPM(*llvmBaseFPM, min(level, OPT_O1));
+        createLLVMPVars();
+        createTierVars();
+        createLLVMFuncs(true);
+        mapLLVMGlobals();
+      }
+      catch(...) { releaseLLVM(); throw; }
+    }
+
+    // Called by the interpreter, promotion is asked for once, when the
+    // threshold is reached, and a failed one leaves the procedure in the
+    // interpreter, like a failed promotion of compiled code does
+    void Runtime::ModuleData::countHotProc(ProcId proc) {
+      if(++procCounters[proc] == baselineThreshold &&
+         procTiers[proc] == TIER_INTERPRETED)
+        try { promoteProc(proc, TIER_BASELINE); }
+        catch(...) {}
+    }
+
+    void Runtime::ModuleData::promoteProc(ProcId proc, ProcTier tier) {
+      // same locking order as when the JIT materializes a procedure
+      MutexGuard engineLock(llvmEE->lock);
+      MutexLock lock(Runtime::instance().llvmMutex);
+      if(procTiers[proc] >= tier)
+        return;
+
+      Function *func = llvmModule->getFunction(funcName(proc));
+      if(tier == TIER_OPTIMIZED) {
+        // counting body is replaced, its code is patched to jump to the
+        // new one, activations running it keep running it
+        procTiers[proc] = tier;
+        GlobalValue::LinkageTypes link = func->getLinkage();
+        func->deleteBody();
+        func->setLinkage(link);
+        emitLLVMFunc(proc, func);
+        llvmEE->recompileAndRelinkFunction(func);
+      }
+      else {
+        if(func->empty()) // materializer would wait for llvmMutex
+          emitLLVMFunc(proc, func);
+        llvmEE->getPointerToFunction(func);
+        procCounters[proc] = 0;
+      }
+
+      Function *entry = llvmModule->getFunction(entryName(proc));
+      void *vPtr = llvmEE->getPointerToFunction(entry);
+      procTiers[proc] = tier;
+      uintptr_t uPtr = reinterpret_cast<uintptr_t>(vPtr);
+      __sync_synchronize(); // entry is swapped after the code is complete
+      nativeProcs[proc] = reinterpret_cast<NativeProc>(uPtr);
+    }
+
+    // Procedure is compiled on its first call along with all procedures it
+    // may call, so the JIT never resolves a stub on its own and llvmMutex
+    // covers materialization, from the code cache too, and code generation
+    NativeProc Runtime::ModuleData::compileLazyProc(ProcId proc) {
+      // same locking order as when the JIT materializes a procedure
+      MutexGuard engineLock(llvmEE->lock);
+      MutexLock lock(Runtime::instance().llvmMutex);
+      if(nativeProcs[proc])
+        return nativeProcs[proc];
+
+      vector<Function*> funcs;
+      funcs.push_back(llvmModule->getFunction(entryName(proc)));
+      funcs.push_back(llvmModule->getFunction(THROW_FUNC_NAME));
+      vector<bool> reached(procs.size(), false);
+      vector<ProcId> callees(1, proc);
+      reached[proc] = true;
+
+      while(!callees.empty()) {
+        ProcId callee = callees.back();
+        callees.pop_back();
+        funcs.push_back(llvmModule->getFunction(funcName(callee)));
+
+        const FixedArray<InstrData> &instrs = procs[callee].instrs;
+        for(size_t i = 0; i < instrs.size(); i++) {
+          ProcId target = ProcId(instrs[i].params[0]);
+          if(instrs[i].opcode == OPCODE_CALL && !reached[target]) {
+            reached[target] = true;
+            callees.push_back(target);
+          }
+        }
+      }
+
+      string err; // cached bitcode may lack procedures inlined everywhere
+      for(size_t i = 0; i < funcs.size(); i++)
+        if(funcs[i] && funcs[i]->Materialize(&err))
+          throw EncodingException();
+
+      void *vPtr = llvmEE->getPointerToFunction(funcs[0]);
+      uintptr_t uPtr = reinterpret_cast<uintptr_t>(vPtr);
+      __sync_synchronize(); // entry is set after the code is complete
+      nativeProcs[proc] = reinterpret_cast<NativeProc>(uPtr);
+      return nativeProcs[proc];
+    }
+
+    // Called by procedures of the baseline tier, a failed promotion leaves
+    // them as they are
+    void Runtime::ModuleData::promoteHotProc(ModuleData *moduleData,
+                                             uint32_t proc) {
+      try { moduleData->promoteProc(ProcId(proc), TIER_OPTIMIZED); }
+      catch(...) {}
     }
 
     void Runtime::ModuleData::drop() {
@@ -1072,24 +2817,43 @@ namespace Ant {
       regs.clear();
       procs.clear();
       code.clear();
+      instrs.clear();
+      unmap();
 
       dropped = true;
     }
 
     void Runtime::ModuleData::callProc(ProcId proc, Variable &io) {
+      waitUnpacked();
       assertUnpacked();
 
-      Function *func = llvmModule->getFunction(funcName(proc));
-      if(!func)
+      if(proc >= procs.size())
         throw NotFoundException();
 
-      void *vPtr = llvmEE->getPointerToFunction(func);
-      uintptr_t uPtr = reinterpret_cast<uintptr_t>(vPtr);
-
-      try { reinterpret_cast<void (*)(Variable&)>(uPtr)(io); }
+      try {
+        if(interpreted)
+          interpret(proc, reinterpret_cast<uint8_t*>(&io));
+        else if(lazy) {
+          NativeProc native = nativeProcs[proc];
+          (native ? native : compileLazyProc(proc))(io);
+        }
+        else natives[proc](io);
+      }
       catch(int64_t) { throw RuntimeException(); }
     }
 
+    ProcTier Runtime::ModuleData::procTier(ProcId proc) {
+      waitUnpacked();
+      assertUnpacked();
+
+      if(proc >= procs.size())
+        throw NotFoundException();
+
+      if(tiered)
+        return procTiers[proc];
+      return interpreted ? TIER_INTERPRETED : TIER_OPTIMIZED;
+    }
+
     void Runtime::ModuleData::take(ModuleData& moduleData) {
       vtypes.swap(moduleData.vtypes);
       ptypes.swap(moduleData.ptypes);
@@ -1098,6 +2862,10 @@ namespace Ant {
       regs.swap(moduleData.regs);
       procs.swap(moduleData.procs);
       code.swap(moduleData.code);
+      instrs.swap(moduleData.instrs);
+      swap(image, moduleData.image);
+      swap(imageSize, moduleData.imageSize);
+      swap(dropped, moduleData.dropped);
     }
 
   }
@@ -2,10 +2,13 @@
 #define __VM_MDATA_INCLUDED__
 
 #include <stdint.h>
+#include <string>
 
 #include "../retained.h"
+#include "interp.h"
 #include "llvm/ExecutionEngine/ExecutionEngine.h"
 #include "llvm/Instructions.h"
+#include "llvm/Intrinsics.h"
 #include "llvm/Module.h"
 #include "llvm/PassManager.h"
 #include "runtime.h"
@@ -15,10 +18,12 @@ namespace Ant {
 
     struct Runtime::ModuleData : Retained<ModuleData> {
       struct LLVMContext;
+      struct LLVMMaterializer;
       enum SpeField { SFLD_REF_COUNT, SFLD_ELT_COUNT };
       enum EltField { EFLD_BYTES, EFLD_VREFS, EFLD_PREFS };
 
       ModuleData(const UUID &id);
+      ~ModuleData();
 
       uint32_t varTypeCount() const;
       uint32_t procTypeCount() const;
@@ -34,34 +39,98 @@ namespace Ant {
       bool isDropped() const;
 
       void pack();
-      void unpack();
+      void unpack(OptLevel level, uint32_t flags);
+      void unpackAsync(OptLevel level, uint32_t flags);
+      bool isUnpacking() const;
+      void waitUnpacked() const;
       void drop();
 
       void callProc(ProcId proc, Variable &io);
+      ProcTier procTier(ProcId proc);
 
       void take(ModuleData& moduleData);
 
+      void save(const char *path) const;
+      void map(const char *path, UUID &imageId);
+      void relocate(UUID &imageId);
+      void unmap();
+
+      uint64_t codeCacheKey(OptLevel level) const;
+      std::string codeCachePath(OptLevel level) const;
+      llvm::Module *loadLLVMCache(const std::string &path, bool lazy);
+      void saveLLVMCache(const std::string &path);
+
       void assertNotDropped() const;
       void assertUnpacked() const;
-
-      void prepareLLVMFPM();
+      static void assertUnpackArgs(OptLevel level, uint32_t flags);
+
+      void compile(OptLevel level, uint32_t flags);
+      void compileTiered(OptLevel level);
+      void createLLVMEngine();
+      void releaseLLVM();
+
+      void countHotProc(ProcId proc);
+      void promoteProc(ProcId proc, ProcTier tier);
+      static void promoteHotProc(ModuleData *moduleData, uint32_t proc);
+      NativeProc compileLazyProc(ProcId proc);
+
+      size_t eltSize(VarTypeId vtype) const;
+      size_t vrefsOffset(VarTypeId vtype) const;
+      InterpReg interpReg(const std::vector<InterpFrame> &frames,
+                          RegId reg) const;
+      void prepareInterpLanding(InterpProc &iproc, InterpInstr &instr,
+                                size_t index,
+                                const std::vector<InterpFrame> &frames);
+      void prepareInterpProc(ProcId proc, InterpProc &iproc);
+      void prepareInterp();
+      void releaseInterp();
+      void cleanupInterpFrames(const InterpProc &iproc, size_t begin,
+                               size_t end, uint8_t *frame);
+      void interpret(ProcId proc, uint8_t *io);
+
+      void prepareLLVMFPM(llvm::FunctionPassManager &fpm, OptLevel level);
+      void inlineLLVMCalls();
+      void runLLVMModulePasses(OptLevel level);
       void createLLVMPVars();
       void createZTIVar();
-      void createLLVMFuncs();
+      void createVarSpecVars();
+      void createTierVars();
+      void createLLVMFuncs(bool lazy);
+      void emitLLVMEntry(llvm::Function *entry, llvm::Function *func);
+      void emitLLVMFunc(ProcId proc, llvm::Function *func);
+      void mapLLVMGlobal(const char *name, void *addr);
+      void mapLLVMGlobals();
+      void resolveNativeProcs(bool lazy);
       void createCXAEAllocFunc();
       void createCXAThrowFunc();
-      void createGXXPersFunc();
       void createThrowFunc();
       void createDestroyFunc();
       void createTraceFunc();
+      void createRangeChecksVar();
       void prepareLLVMContext(LLVMContext &context);
       void emitLLVMCode(LLVMContext &context);
+      void emitTierCounter(LLVMContext &context);
+      void emitRangeGuard(LLVMContext &context);
+      void findWrittenBytes(ProcId proc, size_t push,
+                            std::vector<bool> &written) const;
+      void emitZeroFrame(LLVMContext &context, RegId reg, llvm::Value *vptr);
+      void emitZeroStore(llvm::BasicBlock *block, llvm::Value *ptr,
+                         llvm::Type *type);
+      void emitRangeCheckCount(llvm::BasicBlock *block, llvm::Value *inRange);
       void emitTrace(llvm::BasicBlock *block, size_t index, OpCode op,
                      llvm::Value *ptr = NULL);
-      void emitThrowIfNot(llvm::Function *func, llvm::BasicBlock *&block,
-                          llvm::Value *cond, int64_t edValue);
+      void emitThrowIfNot(LLVMContext &context, llvm::Value *cond,
+                          int64_t edValue);
+      llvm::BasicBlock *emitUnwindBlock(LLVMContext &context);
+      void emitTailIOCleanup(LLVMContext &context, llvm::BasicBlock *&block);
+      void emitSelfTailCall(LLVMContext &context, size_t pops);
+      size_t varSpecIndex(const VarSpec *vspec) const;
+      llvm::Value *emitVarSpecPtr(llvm::BasicBlock *block,
+                                  const VarSpec *vspec);
       void emitIncVarRefCount(llvm::Function *func, llvm::BasicBlock *&block,
                          llvm::Value *vptr, const VarSpec *vspecForDec = NULL);
+      void emitCleanupElt(llvm::Function *func, llvm::BasicBlock *&block,
+                          const FixedArray<VarSpec> &vrefs, llvm::Value *eptr);
       void emitCleanupRegFrame(llvm::Function *func, llvm::BasicBlock *&block,
                                RegId reg, bool ref, llvm::Value *vptr);
       void emitFuncCall(LLVMContext &context, llvm::Function *func,
@@ -70,46 +139,69 @@ namespace Ant {
                                 EltField efld, uint32_t eltc = 0);
       llvm::Value *emitSpecialPtr(llvm::BasicBlock *block, llvm::Value *vptr,
                                   SpeField sfld);
-      llvm::Value *emitElementPtr(llvm::Function *func,
-                                  llvm::BasicBlock *&block, RegId reg,
-                                  bool ref, llvm::Value *vptr, size_t eltc = 0,
-                                  llvm::Value *eltv = NULL);
+      llvm::Value *emitRefValue(LLVMContext &context, RegId reg);
+      llvm::Value *emitElementPtr(LLVMContext &context, RegId reg, bool ref,
+                                  llvm::Value *vptr, size_t eltc = 0,
+                                  llvm::Value *eltv = NULL,
+                                  llvm::Value *ecval = NULL,
+                                  llvm::Value *inRange = NULL);
       llvm::Value *emitRegValue(LLVMContext &context, RegId reg,
                                 bool dereferenceIfNeeded = true,
-                                size_t eltc = 0, llvm::Value *eltv = NULL);
-      llvm::Value *emitZeroVariable(llvm::BasicBlock *block,
-                                    llvm::Value *vptr, llvm::Value *count);
-      template<uint8_t OP, llvm::Instruction::BinaryOps, uint64_t>
-        void emitLLVMCodeUO(LLVMContext &context, const UOInstrT<OP> &instr);
-      template<uint8_t OP, llvm::Instruction::BinaryOps>
-        void emitLLVMCodeBO(LLVMContext &context, const BOInstrT<OP> &instr);
-      template<uint8_t OP, llvm::ICmpInst::Predicate, uint64_t>
-        void emitLLVMCodeUJ(LLVMContext &context, const UJInstrT<OP> &instr);
-      template<uint8_t OP, llvm::ICmpInst::Predicate>
-        void emitLLVMCodeBJ(LLVMContext &context, const BJInstrT<OP> &instr);
-      template<uint8_t OP, class VAL>
-        void emitLLVMCodeCPI(LLVMContext &context,
-                             const CPIInstrT<OP, VAL> &instr);
-      template<uint8_t OP, bool REF>
-        void emitLLVMCodePUSH(LLVMContext &context,
-                              const PUSHInstrT<OP, REF> &instr);
-      void emitLLVMCodePUSHH(LLVMContext &context, const PUSHHInstr &instr);
-      void emitLLVMCodePOP(LLVMContext &context, const POPInstr &instr);
-      void emitLLVMCodeJMP(LLVMContext &context, const JMPInstr &instr);
-      void emitLLVMCodeCPB(LLVMContext &context, const CPBInstr &instr);
-      void emitLLVMCodeLDE(LLVMContext &context, const LDEInstr &instr);
-      void emitLLVMCodeLDB(LLVMContext &context, const LDBInstr &instr);
-      void emitLLVMCodeLDR(LLVMContext &context, const LDRInstr &instr);
-      void emitLLVMCodeSTE(LLVMContext &context, const STEInstr &instr);
-      void emitLLVMCodeSTB(LLVMContext &context, const STBInstr &instr);
-      void emitLLVMCodeSTR(LLVMContext &context, const STRInstr &instr);
-      void emitLLVMCodeCALL(LLVMContext &context, const CALLInstr &instr);
-      void emitLLVMCodeTHROW(LLVMContext &context, const THROWInstr &instr);
-      void emitLLVMCodeRET(LLVMContext &context, const RETInstr &instr);
+                                size_t eltc = 0, llvm::Value *eltv = NULL,
+                                llvm::Value *inRange = NULL);
+      void emitLifetimeMarker(llvm::BasicBlock *block, llvm::Intrinsic::ID id,
+                              llvm::Value *slot);
+      template<llvm::Instruction::BinaryOps, uint64_t>
+        void emitLLVMCodeUO(LLVMContext &context, const InstrData &instr);
+      template<llvm::Instruction::BinaryOps, class>
+        void emitLLVMCodeBO(LLVMContext &context, const InstrData &instr);
+      template<llvm::Instruction::BinaryOps, class>
+        void emitLLVMCodeDIV(LLVMContext &context, const InstrData &instr);
+      template<llvm::ICmpInst::Predicate, uint64_t>
+        void emitLLVMCodeUJ(LLVMContext &context, const InstrData &instr);
+      template<llvm::ICmpInst::Predicate>
+        void emitLLVMCodeBJ(LLVMContext &context, const InstrData &instr);
+      template<llvm::ICmpInst::Predicate>
+        void emitLLVMCodeBJI(LLVMContext &context, const InstrData &instr);
+      template<llvm::Instruction::BinaryOps>
+        void emitLLVMCodeBOI(LLVMContext &context, const InstrData &instr);
+      template<class VAL>
+        void emitLLVMCodeCPI(LLVMContext &context, const InstrData &instr);
+      template<bool REF>
+        void emitLLVMCodePUSH(LLVMContext &context, const InstrData &instr);
+      void emitLLVMCodePUSHH(LLVMContext &context, const InstrData &instr);
+      void emitLLVMCodePOP(LLVMContext &context, const InstrData &instr);
+      void emitLLVMCodeJMP(LLVMContext &context, const InstrData &instr);
+      void emitLLVMCodeCPB(LLVMContext &context, const InstrData &instr);
+      void emitLLVMCodeLDE(LLVMContext &context, const InstrData &instr);
+      void emitLLVMCodeLDB(LLVMContext &context, const InstrData &instr);
+      void emitLLVMCodeLDR(LLVMContext &context, const InstrData &instr);
+      void emitLLVMCodeSTE(LLVMContext &context, const InstrData &instr);
+      void emitLLVMCodeSTB(LLVMContext &context, const InstrData &instr);
+      void emitLLVMCodeSTR(LLVMContext &context, const InstrData &instr);
+      void emitLLVMCodeCALL(LLVMContext &context, const InstrData &instr);
+      void emitLLVMCodeTHROW(LLVMContext &context, const InstrData &instr);
+      void emitLLVMCodeRET(LLVMContext &context, const InstrData &instr);
+      llvm::Value *emitArrayPtr(LLVMContext &context, RegId reg,
+                                llvm::Value *&count);
+      llvm::Value *emitArrayOpValue(llvm::BasicBlock *block, OpCode op,
+                                    llvm::Value *val1, llvm::Value *val2);
+      llvm::Value *emitArrayLoop(LLVMContext &context, OpCode op,
+                                 llvm::Value *const *srcs, llvm::Value *dst,
+                                 llvm::Value *begin, llvm::Value *end,
+                                 unsigned width, llvm::Value *acc);
+      llvm::Value *emitArrayLoops(LLVMContext &context, OpCode op,
+                                  llvm::Value *const *srcs, llvm::Value *dst,
+                                  llvm::Value *count, llvm::Value *acc);
+      void emitLLVMCodeAO(LLVMContext &context, const InstrData &instr);
+      void emitLLVMCodeAR(LLVMContext &context, const InstrData &instr);
+      void emitLLVMCodeAFILL(LLVMContext &context, const InstrData &instr);
       llvm::Type *getEltLLVMType(VarTypeId vtype) const;
+      template<class VAL> llvm::Type *getValLLVMType() const;
 
       const UUID &id;
       bool dropped;
+      bool unpackPending; // guarded by Runtime::unpackMutex
 
       std::vector<VarTypeData> vtypes;
       std::vector<ProcType> ptypes;
@@ -118,10 +210,37 @@ namespace Ant {
       std::vector<VarSpec> regs;
       std::vector<ProcData> procs;
       std::vector<VMCodeByte> code;
+      std::vector<InstrData> instrs;
+
+      void *image;
+      size_t imageSize;
+
+      std::vector<NativeProc> nativeProcs;
+      FixedArray<NativeProc> natives; // empty while packed
+      std::vector<const VarSpec*> vspecPtrs; // empty while packed
+
+      bool interpreted; // unpacked for the interpreter instead of JIT
+      std::vector<InterpProc> interpProcs;
+      std::vector<uint64_t> interpGlobals;
+      std::vector<size_t> interpGlobalOffsets;
+
+      // tiered modules share registers of the interpreter with compiled
+      // code, procedures are entered through compiled code once it exists
+      bool tiered;
+      uint32_t baselineThreshold, optimizedThreshold;
+      std::vector<ProcTier> procTiers;
+      std::vector<uint32_t> procCounters; // calls and loop iterations
+
+      // procedures are compiled on their first call and entered through
+      // nativeProcs, which are set as they get compiled
+      bool lazy;
 
       llvm::Module *llvmModule;
       llvm::FunctionPassManager *llvmFPM;
+      llvm::FunctionPassManager *llvmBaseFPM; // of baseline tier
       llvm::ExecutionEngine *llvmEE;
+      OptLevel optLevel; // of llvmFPM
+
     };
 
   }
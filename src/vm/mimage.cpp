@@ -0,0 +1,344 @@
+#ifdef PLATFORM_LINUX
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <fstream>
+#include <string.h>
+
+#include "../exception.h"
+#include "instr.h"
+#include "mdata.h"
+#include "mimage.h"
+
+namespace {
+
+  using namespace std;
+  using namespace Ant;
+  using namespace Ant::VM;
+
+  inline uint64_t alignImageOffset(uint64_t offset) {
+    return (offset + MODULE_IMAGE_ALIGNMENT - 1)
+      & ~uint64_t(MODULE_IMAGE_ALIGNMENT - 1);
+  }
+
+  template<class T> inline uint64_t layoutImageSection(
+      ModuleImageSection &section, uint64_t offset, uint64_t count) {
+    section.offset = offset, section.count = count;
+    return alignImageOffset(offset + count * sizeof(T));
+  }
+
+  class ImageWriter {
+  public:
+    ImageWriter(const char *path)
+      : out(path, ios::out | ios::binary | ios::trunc), offset(0) {
+      if(!out)
+        throw IOException();
+    }
+
+    void write(const void *data, size_t size) {
+      if(!out.write(static_cast<const char*>(data), size))
+        throw IOException();
+      offset += size;
+    }
+
+    template<class T> void write(const T &value) { write(&value, sizeof(T)); }
+
+    void seek(const ModuleImageSection &section) {
+      const char zero[MODULE_IMAGE_ALIGNMENT] = { 0 };
+
+      while(offset < section.offset)
+        write(zero, min(size_t(section.offset - offset), sizeof(zero)));
+    }
+
+    void close() {
+      out.close();
+      if(!out)
+        throw IOException();
+    }
+
+  protected:
+    ofstream out;
+    uint64_t offset;
+  };
+
+  template<class T> inline T *imageSection(void *image, size_t size,
+                                           const ModuleImageSection &section) {
+    if(section.offset % MODULE_IMAGE_ALIGNMENT || section.offset > size
+       || section.count > (size - section.offset) / sizeof(T))
+      throw EncodingException();
+    return reinterpret_cast<T*>(static_cast<uint8_t*>(image) + section.offset);
+  }
+
+  inline void assertImageRange(uint64_t index, uint64_t count, uint64_t size) {
+    if(index > size || count > size - index)
+      throw EncodingException();
+  }
+
+  inline void assertImageIndex(uint64_t index, uint64_t size) {
+    if(index >= size)
+      throw EncodingException();
+  }
+
+  inline void assertImageInstr(const InstrData &idata, uint64_t instrsCount,
+                               uint64_t regsCount, uint64_t procsCount) {
+    if(idata.opcode >= OPCODE_COUNT)
+      throw EncodingException();
+
+    const Instr::Spec &spec = Instr::spec(idata.opcode);
+    if(idata.branches != spec.branches)
+      throw EncodingException();
+
+    for(int i = 0; i < spec.paramCount; i++)
+      if(spec.paramKinds[i] == PKIND_REG)
+        assertImageIndex(idata.params[i], regsCount);
+      else if(spec.paramKinds[i] == PKIND_PROC)
+        assertImageIndex(idata.params[i], procsCount);
+      else if(spec.paramKinds[i] == PKIND_OFFSET)
+        assertImageIndex(idata.branchIndex, instrsCount);
+  }
+
+}
+
+namespace Ant {
+  namespace VM {
+
+    using namespace std;
+
+    void Runtime::ModuleData::save(const char *path) const {
+      assertNotDropped();
+
+      ModuleImageHeader header;
+      memset(&header, 0, sizeof(header));
+      memcpy(header.magic, MODULE_IMAGE_MAGIC, sizeof(header.magic));
+      header.version = MODULE_IMAGE_VERSION;
+      header.byteOrder = MODULE_IMAGE_BYTE_ORDER;
+      header.sizeBytes = sizeof(size_t);
+      header.varSpecBytes = sizeof(VarSpec);
+      header.procTypeBytes = sizeof(ProcType);
+      header.instrDataBytes = sizeof(InstrData);
+      memcpy(header.id, id.data(), sizeof(header.id));
+
+      uint64_t vrefCount = 0, prefCount = 0, codeSize = 0, instrCount = 0;
+      for(size_t i = 0; i < vtypes.size(); i++) {
+        vrefCount += vtypes[i].vrefs.size();
+        prefCount += vtypes[i].prefs.size();
+      }
+      for(size_t i = 0; i < procs.size(); i++) {
+        codeSize += procs[i].code.size();
+        instrCount += procs[i].instrs.size();
+      }
+
+      uint64_t offset = alignImageOffset(sizeof(header));
+      offset = layoutImageSection<VarTypeImage>(header.vtypes, offset,
+                                                vtypes.size());
+      offset = layoutImageSection<ProcType>(header.ptypes, offset,
+                                            ptypes.size());
+      offset = layoutImageSection<VarSpec>(header.vrefs, offset, vrefCount);
+      offset = layoutImageSection<ProcTypeId>(header.prefs, offset, prefCount);
+      offset = layoutImageSection<VarSpec>(header.regs, offset, regs.size());
+      offset = layoutImageSection<ProcImage>(header.procs, offset,
+                                             procs.size());
+      offset = layoutImageSection<VMCodeByte>(header.code, offset, codeSize);
+      layoutImageSection<InstrData>(header.instrs, offset, instrCount);
+
+      ImageWriter writer(path);
+      writer.write(header);
+
+      writer.seek(header.vtypes);
+      for(size_t i = 0, vi = 0, pi = 0; i < vtypes.size(); i++) {
+        const VarTypeData &vtype = vtypes[i];
+        VarTypeImage vtypeImage;
+
+        vtypeImage.bytes = vtype.bytes;
+        vtypeImage.vrefsIndex = vi, vtypeImage.vrefsCount = vtype.vrefs.size();
+        vtypeImage.prefsIndex = pi, vtypeImage.prefsCount = vtype.prefs.size();
+        vi += vtype.vrefs.size(), pi += vtype.prefs.size();
+
+        writer.write(vtypeImage);
+      }
+
+      writer.seek(header.ptypes);
+      for(size_t i = 0; i < ptypes.size(); i++)
+        writer.write(ptypes[i]);
+
+      writer.seek(header.vrefs);
+      for(size_t i = 0; i < vtypes.size(); i++)
+        writer.write(vtypes[i].vrefs.begin(),
+                     vtypes[i].vrefs.size() * sizeof(VarSpec));
+
+      writer.seek(header.prefs);
+      for(size_t i = 0; i < vtypes.size(); i++)
+        writer.write(vtypes[i].prefs.begin(),
+                     vtypes[i].prefs.size() * sizeof(ProcTypeId));
+
+      writer.seek(header.regs);
+      for(size_t i = 0; i < regs.size(); i++)
+        writer.write(regs[i]);
+
+      writer.seek(header.procs);
+      for(size_t i = 0, ci = 0, ii = 0; i < procs.size(); i++) {
+        const ProcData &proc = procs[i];
+        ProcImage procImage;
+
+        procImage.flags = proc.flags, procImage.ptype = proc.ptype;
+        procImage.codeIndex = ci, procImage.codeSize = proc.code.size();
+        procImage.instrsIndex = ii, procImage.instrsCount = proc.instrs.size();
+        ci += proc.code.size(), ii += proc.instrs.size();
+
+        writer.write(procImage);
+      }
+
+      writer.seek(header.code);
+      for(size_t i = 0; i < procs.size(); i++)
+        writer.write(procs[i].code.begin(), procs[i].code.size());
+
+      writer.seek(header.instrs);
+      for(size_t i = 0; i < procs.size(); i++)
+        writer.write(procs[i].instrs.begin(),
+                     procs[i].instrs.size() * sizeof(InstrData));
+
+      writer.close();
+    }
+
+    void Runtime::ModuleData::map(const char *path, UUID &imageId) {
+      int fd = open(path, O_RDONLY);
+      if(fd < 0)
+        throw IOException();
+
+      struct stat st;
+      if(fstat(fd, &st) || st.st_size < off_t(sizeof(ModuleImageHeader))) {
+        ::close(fd);
+        throw EncodingException();
+      }
+
+      void *addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      ::close(fd);
+      if(addr == MAP_FAILED)
+        throw IOException();
+
+      image = addr, imageSize = st.st_size;
+
+      try {
+        relocate(imageId);
+      }
+      catch(...) {
+        vtypes.clear();
+        ptypes.clear();
+        regs.clear();
+        procs.clear();
+        unmap();
+        throw;
+      }
+    }
+
+    void Runtime::ModuleData::relocate(UUID &imageId) {
+      const ModuleImageHeader &header =
+        *static_cast<const ModuleImageHeader*>(image);
+
+      if(memcmp(header.magic, MODULE_IMAGE_MAGIC, sizeof(header.magic))
+         || header.version != MODULE_IMAGE_VERSION)
+        throw EncodingException();
+
+      if(header.byteOrder != MODULE_IMAGE_BYTE_ORDER
+         || header.sizeBytes != sizeof(size_t)
+         || header.varSpecBytes != sizeof(VarSpec)
+         || header.procTypeBytes != sizeof(ProcType)
+         || header.instrDataBytes != sizeof(InstrData))
+        throw EnvironmentException();
+
+      const VarTypeImage *vtypeImages =
+        imageSection<VarTypeImage>(image, imageSize, header.vtypes);
+      const ProcType *ptypeImages =
+        imageSection<ProcType>(image, imageSize, header.ptypes);
+      VarSpec *vrefImages = imageSection<VarSpec>(image, imageSize,
+                                                  header.vrefs);
+      ProcTypeId *prefImages = imageSection<ProcTypeId>(image, imageSize,
+                                                        header.prefs);
+      const VarSpec *regImages = imageSection<VarSpec>(image, imageSize,
+                                                       header.regs);
+      const ProcImage *procImages =
+        imageSection<ProcImage>(image, imageSize, header.procs);
+      VMCodeByte *codeImage = imageSection<VMCodeByte>(image, imageSize,
+                                                       header.code);
+      InstrData *instrImages = imageSection<InstrData>(image, imageSize,
+                                                       header.instrs);
+
+      if(header.vtypes.count > MODULE_VTYPES_MAX
+         || header.ptypes.count > MODULE_PTYPES_MAX
+         || header.regs.count > MODULE_REGS_MAX
+         || header.procs.count > MODULE_PROCS_MAX)
+        throw EncodingException();
+
+      // Only indices that are used for addressing are checked here, code
+      // is trusted as it was written by save(), decoded instructions are
+      // checked as far as they address registers, procedures and branches
+
+      vtypes.resize(header.vtypes.count);
+      for(size_t i = 0; i < vtypes.size(); i++) {
+        const VarTypeImage &vtypeImage = vtypeImages[i];
+        VarTypeData &vtype = vtypes[i];
+
+        assertImageRange(vtypeImage.vrefsIndex, vtypeImage.vrefsCount,
+                         header.vrefs.count);
+        assertImageRange(vtypeImage.prefsIndex, vtypeImage.prefsCount,
+                         header.prefs.count);
+
+        vtype.count = 0;
+        vtype.bytes = vtypeImage.bytes;
+        vtype.vrefs.set(vrefImages + vtypeImage.vrefsIndex,
+                        vtypeImage.vrefsCount);
+        vtype.prefs.set(prefImages + vtypeImage.prefsIndex,
+                        vtypeImage.prefsCount);
+      }
+
+      for(size_t i = 0; i < header.vrefs.count; i++)
+        assertImageIndex(vrefImages[i].vtype, header.vtypes.count);
+      for(size_t i = 0; i < header.prefs.count; i++)
+        assertImageIndex(prefImages[i], header.ptypes.count);
+
+      ptypes.assign(ptypeImages, ptypeImages + header.ptypes.count);
+      for(size_t i = 0; i < ptypes.size(); i++)
+        assertImageIndex(ptypes[i].io, header.regs.count);
+
+      regs.assign(regImages, regImages + header.regs.count);
+      for(size_t i = 0; i < regs.size(); i++)
+        assertImageIndex(regs[i].vtype, header.vtypes.count);
+
+      procs.resize(header.procs.count);
+      for(size_t i = 0; i < procs.size(); i++) {
+        const ProcImage &procImage = procImages[i];
+        ProcData &proc = procs[i];
+
+        assertImageIndex(procImage.ptype, header.ptypes.count);
+        assertImageRange(procImage.codeIndex, procImage.codeSize,
+                         header.code.count);
+        assertImageRange(procImage.instrsIndex, procImage.instrsCount,
+                         header.instrs.count);
+
+        for(size_t j = 0; j < procImage.instrsCount; j++)
+          assertImageInstr(instrImages[procImage.instrsIndex + j],
+                           procImage.instrsCount, header.regs.count,
+                           header.procs.count);
+
+        proc.flags = procImage.flags;
+        proc.ptype = procImage.ptype;
+        proc.code.set(codeImage + procImage.codeIndex, procImage.codeSize);
+        proc.instrs.set(instrImages + procImage.instrsIndex,
+                        procImage.instrsCount);
+      }
+
+      imageId = UUID(header.id);
+    }
+
+    void Runtime::ModuleData::unmap() {
+      if(image) {
+        munmap(image, imageSize);
+        image = NULL, imageSize = 0;
+      }
+    }
+
+  }
+}
@@ -0,0 +1,63 @@
+#ifndef __VM_MIMAGE_INCLUDED__
+#define __VM_MIMAGE_INCLUDED__
+
+#include <stdint.h>
+
+#include "../uuid.h"
+#include "vmdefs.h"
+
+namespace Ant {
+  namespace VM {
+
+    // Binary module image. All sections are referenced by offsets from the
+    // beginning of the image, so it can be mapped at any address. Pools are
+    // stored in their in-memory layout and are used in place after mapping,
+    // which ties an image to the data layout of the platform that saved it.
+
+    const char MODULE_IMAGE_MAGIC[8] = { 'A', 'n', 't', 'V', 'M', 'I', 'm', 'g' };
+    const uint32_t MODULE_IMAGE_VERSION = 1;
+    const uint32_t MODULE_IMAGE_BYTE_ORDER = 0x01020304;
+    const size_t MODULE_IMAGE_ALIGNMENT = 8;
+
+    struct ModuleImageSection { // for internal use
+      uint64_t offset;
+      uint64_t count;
+    };
+
+    struct ModuleImageHeader { // for internal use
+      char magic[sizeof(MODULE_IMAGE_MAGIC)];
+      uint32_t version;
+      uint32_t byteOrder;
+      uint8_t sizeBytes;
+      uint8_t varSpecBytes;
+      uint8_t procTypeBytes;
+      uint8_t instrDataBytes;
+      uint32_t reserved;
+      unsigned char id[UUID_SIZE];
+      ModuleImageSection vtypes; // VarTypeImage
+      ModuleImageSection ptypes; // ProcType
+      ModuleImageSection vrefs; // VarSpec
+      ModuleImageSection prefs; // ProcTypeId
+      ModuleImageSection regs; // VarSpec
+      ModuleImageSection procs; // ProcImage
+      ModuleImageSection code; // VMCodeByte
+      ModuleImageSection instrs; // InstrData
+    };
+
+    struct VarTypeImage { // for internal use
+      uint64_t bytes;
+      uint64_t vrefsIndex, vrefsCount;
+      uint64_t prefsIndex, prefsCount;
+    };
+
+    struct ProcImage { // for internal use
+      uint32_t flags;
+      ProcTypeId ptype;
+      uint64_t codeIndex, codeSize;
+      uint64_t instrsIndex, instrsCount;
+    };
+
+  }
+}
+
+#endif // __VM_MIMAGE_INCLUDED__
@@ -8,6 +8,46 @@ namespace Ant {
     using namespace std;
     using namespace Ant;
 
+    namespace {
+
+      const FixedArray<NativeProc> noNatives;
+
+    }
+
+    ProcHandle &ProcHandle::operator=(const ProcHandle &handle) {
+      if(handle.iter != iter) {
+        Runtime &rt = Runtime::instance();
+        if(handle.iter != rt.modules.end())
+          handle.iter->second->retain();
+        reset();
+        iter = handle.iter;
+      }
+
+      natives = handle.natives, proc = handle.proc;
+      return *this;
+    }
+
+    void ProcHandle::init() {
+      iter = Runtime::instance().modules.end();
+      natives = &noNatives, proc = 0;
+    }
+
+    void ProcHandle::reset() {
+      Runtime &rt = Runtime::instance();
+      if(iter != rt.modules.end()) {
+        rt.releaseModuleData(iter);
+        iter = rt.modules.end();
+      }
+      natives = &noNatives;
+    }
+
+    void ProcHandle::callModule(Variable &io) const {
+      if(iter == Runtime::instance().modules.end())
+        throw OperationException();
+
+      iter->second->callProc(proc, io);
+    }
+
     void Module::id(const UUID &id) {
       _id = id;
 
@@ -72,16 +112,58 @@ namespace Ant {
     }
 
     void Module::unpack() {
-      moduleData().unpack();
+      moduleData().unpack(Runtime::instance().optLevel(), 0);
+    }
+
+    void Module::unpack(OptLevel level, uint32_t flags) {
+      moduleData().unpack(level, flags);
+    }
+
+    void Module::unpackAsync() {
+      moduleData().unpackAsync(Runtime::instance().optLevel(), 0);
+    }
+
+    void Module::unpackAsync(OptLevel level, uint32_t flags) {
+      moduleData().unpackAsync(level, flags);
+    }
+
+    bool Module::isUnpacking() const {
+      return moduleData().isUnpacking();
+    }
+
+    void Module::waitUnpacked() const {
+      moduleData().waitUnpacked();
     }
 
     void Module::drop() {
       moduleData().drop();
     }
 
+    void Module::save(const char *path) const {
+      moduleData().save(path);
+    }
+
     void Module::callProc(ProcId proc, Variable &io) {
       moduleData().callProc(proc, io);
     }
 
+    ProcTier Module::procTier(ProcId proc) const {
+      return moduleData().procTier(proc);
+    }
+
+    ProcHandle Module::procHandle(ProcId proc) const {
+      Runtime::ModuleData &data = moduleData();
+      if(proc >= data.procCount())
+        throw NotFoundException();
+      // handle reads natives without locking, they must not change meanwhile
+      data.waitUnpacked();
+
+      ProcHandle handle;
+      handle.iter = iter, handle.natives = &data.natives, handle.proc = proc;
+      data.retain();
+
+      return handle;
+    }
+
   }
 }
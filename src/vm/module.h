@@ -5,12 +5,45 @@
 #include <stdint.h>
 #include <vector>
 
+#include "../exception.h"
+#include "../farray.h"
 #include "../uuid.h"
 #include "runtime.h"
 
 namespace Ant {
   namespace VM {
 
+    class ProcHandle {
+      friend class Module;
+    public:
+      ProcHandle() { init(); }
+      ProcHandle(const ProcHandle &handle) { init(); *this = handle; }
+      ~ProcHandle() { reset(); }
+
+      ProcHandle &operator=(const ProcHandle &handle);
+
+      // native procedures table is empty while module is packed,
+      // interpreted or lazily unpacked, the call then goes through the module
+      void operator()(Variable &io) const {
+        if(proc >= natives->size()) {
+          callModule(io);
+          return;
+        }
+
+        try { (*natives)[proc](io); }
+        catch(int64_t) { throw RuntimeException(); }
+      }
+
+    protected:
+      void init();
+      void reset();
+      void callModule(Variable &io) const;
+
+      Runtime::ModuleDataIterator iter;
+      const FixedArray<NativeProc> *natives;
+      ProcId proc;
+    };
+
     class Module {
     public:
       Module() { init(UUID()); }
@@ -35,9 +68,20 @@ namespace Ant {
 
       void pack();
       void unpack();
+      void unpack(OptLevel level, uint32_t flags = 0);
+      // returns at once, the module is compiled by a runtime worker thread;
+      // calls made meanwhile wait until compilation finishes
+      void unpackAsync();
+      void unpackAsync(OptLevel level, uint32_t flags = 0);
+      bool isUnpacking() const;
+      void waitUnpacked() const;
       void drop();
 
+      void save(const char *path) const;
+
       void callProc(ProcId proc, Variable &io);
+      ProcHandle procHandle(ProcId proc) const;
+      ProcTier procTier(ProcId proc) const;
 
     protected:
       void init(const UUID &id) {
@@ -1,5 +1,4 @@
-#include <memory>
-
+#include "../exception.h"
 #include "mdata.h"
 
 namespace Ant {
@@ -7,6 +6,18 @@ namespace Ant {
 
     using namespace std;
 
+    Runtime::~Runtime() {
+      // queued modules are still compiled, they may be waited for
+      {
+        MutexLock lock(unpackMutex);
+        unpackWorkerStopping = true;
+        unpackQueued.signal();
+      }
+
+      if(unpackWorkerStarted)
+        pthread_join(unpackWorker, NULL);
+    }
+
     Runtime::ModuleDataIterator Runtime::retainModuleData(const UUID &id) {
       ModuleDataIterator i = modules.find(id);
 
@@ -29,15 +40,95 @@ namespace Ant {
     }
 
     void Runtime::insertModuleData(const UUID &id, ModuleData &moduleData) {
-      auto_ptr<ModuleData> ptr(new ModuleData(id));
-      ModuleDataPair p(id, ptr.get());
+      ModuleDataPair p(id, NULL);
       pair<ModuleDataIterator, bool> ip = modules.insert(p);
 
-      if(ip.second)
-        ptr.release();
+      if(ip.second) {
+        // module data refers to the map key, which outlives the caller's id
+        try {
+          ip.first->second = new ModuleData(ip.first->first);
+        }
+        catch(...) {
+          modules.erase(ip.first);
+          throw;
+        }
+      }
 
       ip.first->second->take(moduleData);
     }
 
+    void Runtime::optLevel(OptLevel level) {
+      if(level < OPT_O0 || level >= OPT_LEVEL_COUNT)
+        throw RangeException();
+      _optLevel = level;
+    }
+
+    uint32_t Runtime::tierThreshold(ProcTier tier) const {
+      if(tier <= TIER_INTERPRETED || tier >= TIER_COUNT)
+        throw RangeException();
+      return tierThresholds[tier];
+    }
+
+    void Runtime::tierThreshold(ProcTier tier, uint32_t threshold) {
+      if(tier <= TIER_INTERPRETED || tier >= TIER_COUNT || !threshold)
+        throw RangeException();
+      tierThresholds[tier] = threshold;
+    }
+
+    // must be called with unpackMutex locked
+    void Runtime::queueUnpack(ModuleData &moduleData, OptLevel level,
+                              uint32_t flags) {
+      if(!unpackWorkerStarted) {
+        if(pthread_create(&unpackWorker, NULL, &runUnpackWorker, this))
+          throw EnvironmentException();
+        unpackWorkerStarted = true;
+      }
+
+      UnpackJob job = { &moduleData, level, flags };
+      unpackJobs.push_back(job);
+      unpackQueued.signal();
+    }
+
+    void *Runtime::runUnpackWorker(void *runtime) {
+      static_cast<Runtime*>(runtime)->runUnpackJobs();
+      return NULL;
+    }
+
+    void Runtime::runUnpackJobs() {
+      for(;;) {
+        UnpackJob job;
+        {
+          MutexLock lock(unpackMutex);
+          while(unpackJobs.empty() && !unpackWorkerStopping)
+            unpackQueued.wait(unpackMutex);
+          if(unpackJobs.empty())
+            return;
+          job = unpackJobs.front();
+          unpackJobs.pop_front();
+        }
+
+        // a failed module stays packed, waiting callers find it so
+        try { job.moduleData->compile(job.level, job.flags); }
+        catch(...) {}
+
+        MutexLock lock(unpackMutex);
+        job.moduleData->unpackPending = false;
+        unpackDone.broadcast();
+      }
+    }
+
+    UUID Runtime::load(const char *path) {
+      UUID id;
+      ModuleData moduleData(id);
+      moduleData.map(path, id);
+
+      ModuleDataIterator i = modules.find(id);
+      if(i != modules.end() && !i->second->isDropped())
+        throw OperationException();
+
+      insertModuleData(id, moduleData);
+      return id;
+    }
+
   }
 }
@@ -1,10 +1,13 @@
 #ifndef __VM_RUNTIME_INCLUDED__
 #define __VM_RUNTIME_INCLUDED__
 
+#include <deque>
 #include <map>
 #include <stdint.h>
 
+#include "../mutex.h"
 #include "../singleton.h"
+#include "../string.h"
 #include "../uuid.h"
 #include "vmdefs.h"
 
@@ -15,20 +18,82 @@ namespace Ant {
       friend class Singleton<Runtime>;
       friend class ModuleBuilder;
       friend class Module;
+      friend class ProcHandle;
+    public:
+      UUID load(const char *path);
+
+      OptLevel optLevel() const { return _optLevel; }
+      void optLevel(OptLevel level);
+
+      // directory of compiled code cache, caching is disabled if empty
+      const String &codeCacheDir() const { return _codeCacheDir; }
+      void codeCacheDir(const String &dir) { _codeCacheDir = dir; }
+
+      // calls and loop iterations after which a procedure of a module
+      // unpacked with UFLAG_TIERED enters the tier
+      uint32_t tierThreshold(ProcTier tier) const;
+      void tierThreshold(ProcTier tier, uint32_t threshold);
+
+      // instructions a procedure may have to be inlined at calls of
+      // procedures compiled at OPT_O2 or above, inlining is disabled if 0
+      uint32_t inlineBudget() const { return _inlineBudget; }
+      void inlineBudget(uint32_t budget) { _inlineBudget = budget; }
+
+      // Called for every call considered for inlining while a module is
+      // compiled, possibly by the unpack worker, so it must not unpack or
+      // pack modules. Not called for code loaded from the code cache.
+      typedef void (*InlineHook)(const UUID &module, ProcId caller,
+                                 ProcId callee, InlineDecision decision);
+      InlineHook inlineHook() const { return _inlineHook; }
+      void inlineHook(InlineHook hook) { _inlineHook = hook; }
+
     protected:
       struct ModuleData;
       typedef std::map<UUID, ModuleData*> ModuleDataMap;
       typedef ModuleDataMap::value_type ModuleDataPair;
       typedef ModuleDataMap::iterator ModuleDataIterator;
 
+      struct UnpackJob {
+        ModuleData *moduleData;
+        OptLevel level;
+        uint32_t flags;
+      };
+
       ModuleDataIterator retainModuleData(const UUID &id);
       void releaseModuleData(ModuleDataIterator moduleDataIter);
       void insertModuleData(const UUID &id, ModuleData &moduleData);
 
+      void queueUnpack(ModuleData &moduleData, OptLevel level,
+                       uint32_t flags);
+      static void *runUnpackWorker(void *runtime);
+      void runUnpackJobs();
+
       ModuleDataMap modules;
+      OptLevel _optLevel;
+      String _codeCacheDir;
+      uint32_t tierThresholds[TIER_COUNT];
+      uint32_t _inlineBudget;
+      InlineHook _inlineHook;
+
+      // LLVM shares one global context, so only one module may be unpacked
+      // or packed at a time no matter which thread does it
+      Mutex llvmMutex;
+
+      Mutex unpackMutex; // guards everything below and pending unpacks
+      Condition unpackQueued, unpackDone;
+      std::deque<UnpackJob> unpackJobs;
+      pthread_t unpackWorker;
+      bool unpackWorkerStarted, unpackWorkerStopping;
 
     private:
-      Runtime() : Singleton<Runtime>(0) {}
+      Runtime() : Singleton<Runtime>(0), _optLevel(OPT_O2),
+                  _inlineBudget(64), _inlineHook(NULL),
+                  unpackWorkerStarted(false), unpackWorkerStopping(false) {
+        tierThresholds[TIER_INTERPRETED] = 0;
+        tierThresholds[TIER_BASELINE] = 1000;
+        tierThresholds[TIER_OPTIMIZED] = 10000;
+      }
+      ~Runtime();
     };
 
   }
@@ -1,3 +1,5 @@
+#include <string.h>
+
 #include "../../string.h"
 #include "../../test/test.h"
 #include "../instr.h"
@@ -333,6 +335,154 @@ namespace {
     return printTestResult(subj, "callConsistency", passed);
   }
 
+  bool testInstrSpecs() {
+    bool passed = true;
+
+    try {
+      for(int op = OPCODE_INC; passed && op < OPCODE_COUNT; op++) {
+        const Instr::Spec &spec = Instr::spec(OpCode(op));
+        passed = spec.mnemonic && spec.assertConsistency;
+        passed = passed && spec.paramCount <= INSTR_PARAMS_MAX;
+      }
+
+      passed = passed && Instr::spec(OpCode(OPCODE_COUNT)).mnemonic ==
+        Instr::spec(OPCODE_ILL).mnemonic;
+      passed = passed && !strcmp(Instr::opcodeMnemonic(OPCODE_PUSHH), "PUSHH");
+      passed = passed && !Instr().size();
+      passed = passed && POPInstr().size() == 1;
+      passed = passed && LDBInstr(1, 300, 2).size() == 5;
+      passed = passed && CPI8Instr(uint64_t(-1), 3).size() == 11;
+      passed = passed && JNGInstr(1, 2, -9).size() == 4;
+      passed = passed && JMPInstr(-9).branchIndex(10) == 1;
+      passed = passed && RETInstr().branchIndex(10) == 11;
+      passed = passed && !CALLInstr(1).branches();
+    }
+    catch(...) { passed = false; }
+
+    return printTestResult(subj, "instrSpecs", passed);
+  }
+
+  bool testInstrDecoding() {
+    bool passed = true;
+
+    try {
+      InstrData idata;
+
+      JNZInstr(5, -2).decode(7, 20, idata);
+      passed = idata.opcode == OPCODE_JNZ && idata.offset == 20;
+      passed = passed && idata.params[0] == 5;
+      passed = passed && int64_t(idata.params[1]) == -2;
+      passed = passed && idata.branches && idata.branchIndex == 5;
+
+      LDBInstr(1, 300, 2).decode(0, 0, idata);
+      passed = passed && idata.opcode == OPCODE_LDB && !idata.branches;
+      passed = passed && idata.params[0] == 1;
+      passed = passed && idata.params[1] == 300;
+      passed = passed && idata.params[2] == 2;
+
+      CPI8Instr(uint64_t(-1), 3).decode(0, 0, idata);
+      passed = passed && idata.params[0] == uint64_t(-1);
+      passed = passed && idata.params[1] == 3;
+
+      JGIInstr(300, INT64_MIN, -3).decode(6, 0, idata);
+      passed = passed && idata.opcode == OPCODE_JGI && idata.params[0] == 300;
+      passed = passed && int64_t(idata.params[1]) == INT64_MIN;
+      passed = passed && idata.branches && idata.branchIndex == 3;
+
+      ADDIInstr(300, -5, 301).decode(0, 0, idata);
+      passed = passed && int64_t(idata.params[1]) == -5;
+      passed = passed && idata.params[2] == 301 && !idata.branches;
+
+      RETInstr().decode(4, 9, idata);
+      passed = passed && idata.branches && idata.branchIndex == 5;
+
+      ASSERT_THROW({Instr().decode(0, 0, idata);}, EncodingException);
+    }
+    catch(...) { passed = false; }
+
+    return printTestResult(subj, "instrDecoding", passed);
+  }
+
+  // immediate comes back from encoding, accessor and decoding alike
+  bool checkImmInstrs(int64_t imm) {
+    InstrData idata;
+
+    ADDIInstr addi(300, imm, 301);
+    addi.decode(0, 0, idata);
+    if(addi.operand2() != imm || addi.result() != 301 ||
+       int64_t(idata.params[1]) != imm || idata.params[2] != 301)
+      return false;
+
+    JGIInstr jgi(300, imm, -3);
+    jgi.decode(6, 0, idata);
+    return jgi.operand2() == imm && jgi.offset() == -3 &&
+      int64_t(idata.params[1]) == imm && idata.branchIndex == 3;
+  }
+
+  bool testImmInstrs() {
+    bool passed = true;
+
+    try {
+      for(int64_t v = -(int64_t(1) << 21); passed && v <= 1 << 21; v++)
+        passed = checkImmInstrs(v);
+
+      for(int i = 0; passed && i < 64; i++) {
+        int64_t pow = int64_t(uint64_t(1) << i);
+        for(int64_t d = -2; passed && d <= 2; d++)
+          passed = checkImmInstrs(pow + d) && checkImmInstrs(-pow + d);
+      }
+    }
+    catch(...) { passed = false; }
+
+    return printTestResult(subj, "immInstrs", passed);
+  }
+
+  bool testBulkInstrs() {
+    bool passed = true;
+
+    try {
+      ModuleBuilder b;
+      VarTypeId vt = b.addVarType(8);
+      RegId io = b.addReg(0, vt);
+      ProcTypeId pt = b.addProcType(0, io);
+      ProcId p1 = b.addProc(0, pt), p2 = b.addProc(0, pt);
+      ProcId p3 = b.addProc(0, pt);
+      RegId pr = b.addReg(0, vt);
+      const Instr instrs[] = {
+        JNZInstr(io, 3), CPI8Instr(1, io), RETInstr(), PUSHInstr(pr),
+        CPI8Instr(1, pr), MULInstr(io, pr, pr), DECInstr(io),
+        JNZInstr(io, -2), CPBInstr(pr, io), POPInstr(), RETInstr() };
+      const Instr bad[] = { CPI8Instr(1, io), DECInstr(io), POPInstr() };
+      Proc proc1, proc2;
+
+      passed = b.addProcInstrs(p1, instrs, instrs + 11) == 0;
+      b.procById(p1, proc1);
+
+      try { b.addProcInstrs(p2, bad, bad + 3); passed = false; }
+      catch(const InstrException &e) {
+        passed = passed && e.index == 2 &&
+          !strcmp(e.what(), OperationException().what());
+      }
+      b.procById(p2, proc2);
+      passed = passed && proc2.code.empty();
+
+      passed = passed &&
+        b.appendProcCode(p2, &proc1.code[0], proc1.code.size()) == 0;
+      b.procById(p2, proc2);
+      passed = passed && proc2.code == proc1.code;
+
+      try { b.appendProcCode(p3, &proc1.code[0], 1); passed = false; }
+      catch(const InstrException &e) {
+        passed = passed && e.index == 0 &&
+          !strcmp(e.what(), EncodingException().what());
+      }
+      passed = passed && b.addProcInstrs(p3, instrs, instrs + 11) == 0;
+    }
+    catch(...) { passed = false; }
+
+    return printTestResult(subj, "bulkInstrs", passed);
+  }
+
   bool testFactorialVTypes(const Module &module) {
     VarType vtype;
     bool passed;
@@ -720,6 +870,10 @@ namespace Ant {
         passed = passed && testByteConsistency();
         passed = passed && testRefConsistency();
         passed = passed && testCallConsistency();
+        passed = passed && testInstrSpecs();
+        passed = passed && testInstrDecoding();
+        passed = passed && testImmInstrs();
+        passed = passed && testBulkInstrs();
         passed = passed && testFactorial();
         passed = passed && testQSort();
         passed = passed && testEH();
@@ -1,11 +1,26 @@
+#include <dirent.h>
+#include <fstream>
+#include <iterator>
+#include <limits>
+#include <sstream>
+#include <string>
 #include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
 
 #include "../../exception.h"
 #include "../../string.h"
 #include "../../test/test.h"
+#include "../mimage.h"
 #include "../module.h"
 #include "vm.test.h"
 
+#ifdef CONFIG_DEBUG
+// range checks run by compiled code
+extern "C" uint64_t ant_vm_range_checks;
+#endif
+
 namespace {
 
   using namespace std;
@@ -16,6 +31,14 @@ namespace {
 
   const String subj = "Ant::VM::Runtime::ModuleData";
 
+  // tests loop over OPT_O0 to OPT_LEVEL_COUNT, the last one stands for the
+  // interpreter
+  void unpackForLevel(Module &module, int level) {
+    if(level == OPT_LEVEL_COUNT)
+      module.unpack(OPT_O0, UFLAG_INTERPRET);
+    else module.unpack(OptLevel(level));
+  }
+
   bool testFactorial() {
     bool passed = true;
     Module module;
@@ -52,6 +75,17 @@ namespace {
       module.callProc(proc, io);
       if(val != 2432902008176640000LLU)
         throw Exception();
+
+      ProcHandle handle = module.procHandle(proc);
+      val = 5;
+      handle(io);
+      if(val != 120)
+        throw Exception();
+
+      ASSERT_THROW({ module.procHandle(1); }, NotFoundException);
+      module.pack();
+      ASSERT_THROW({ handle(io); }, OperationException);
+      ASSERT_THROW({ ProcHandle()(io); }, OperationException);
     }
     catch(...) { passed = false; }
 
@@ -60,6 +94,192 @@ namespace {
     return printTestResult(subj, "factorial", passed);
   }
 
+  bool testAsync() {
+    bool passed = true;
+    Module module, lazyModule;
+
+    try {
+      SVariable<8, 0, 0> io;
+      uint64_t &val = *reinterpret_cast<uint64_t*>(io.elts[0].bytes);
+      ProcId proc = 0;
+
+      createFactorialModule(module);
+      module.unpackAsync();
+      module.unpackAsync(); // already pending
+
+      // waits for the worker
+      val = 10;
+      module.callProc(proc, io);
+      if(val != 3628800 || module.isUnpacking() || module.isPacked())
+        throw Exception();
+
+      module.pack();
+      module.unpackAsync(OPT_O1);
+      module.waitUnpacked();
+      if(module.isUnpacking() || module.isPacked())
+        throw Exception();
+
+      module.pack();
+      ASSERT_THROW({ module.unpackAsync(OPT_LEVEL_COUNT); }, RangeException);
+      ASSERT_THROW({ module.unpackAsync(OPT_O0, UFLAG_FIRST_RESERVED); },
+                   FlagsException);
+      module.unpackAsync();
+
+      // compiled on the first call while the worker unpacks
+      createFactorialModule(lazyModule);
+      lazyModule.unpack(OPT_O2, UFLAG_LAZY);
+      {
+        ProcHandle handle = lazyModule.procHandle(proc);
+        val = 10;
+        handle(io);
+        if(val != 3628800)
+          throw Exception();
+      }
+      val = 5;
+      lazyModule.callProc(proc, io);
+      if(val != 120)
+        throw Exception();
+    }
+    catch(...) { passed = false; }
+
+    IGNORE_THROW(lazyModule.drop());
+    IGNORE_THROW(module.drop()); // waits for the pending unpack
+
+    return printTestResult(subj, "async", passed);
+  }
+
+  // unique to the process, so that concurrent runs do not share files
+  string testPath(const char *name) {
+    ostringstream out;
+    out << "/tmp/ant.vm.test." << name << '.' << getpid();
+    return out.str();
+  }
+
+  // image is written with its first decoded instruction replaced
+  void loadPatchedImage(const char *path, const string &image,
+                        const InstrData &idata) {
+    ModuleImageHeader header;
+    memcpy(&header, image.data(), sizeof(header));
+    string patched = image;
+    memcpy(&patched[header.instrs.offset], &idata, sizeof(idata));
+
+    ofstream out(path, ios::binary);
+    out.write(patched.data(), patched.size());
+    out.close();
+    Runtime::instance().load(path);
+  }
+
+  bool testImage() {
+    bool passed = true;
+    Module module;
+    string pathStr = testPath("image");
+    const char *path = pathStr.c_str();
+
+    try {
+      SVariable<8, 0, 0> io;
+      uint64_t &val = *reinterpret_cast<uint64_t*>(io.elts[0].bytes);
+      ProcId proc = 0;
+      Proc procBefore, procAfter;
+
+      createFactorialModule(module);
+      module.procById(proc, procBefore);
+      module.save(path);
+
+      ASSERT_THROW({ Runtime::instance().load(path); }, OperationException);
+
+      module.drop();
+      module.id(Runtime::instance().load(path));
+      module.procById(proc, procAfter);
+      if(procAfter.ptype != procBefore.ptype
+         || procAfter.code != procBefore.code)
+        throw Exception();
+
+      module.unpack();
+
+      val = 10;
+      module.callProc(proc, io);
+      if(val != 3628800)
+        throw Exception();
+
+      // decoded instructions must not address beyond the image
+      module.drop();
+      ifstream in(path, ios::binary);
+      string image((istreambuf_iterator<char>(in)),
+                   istreambuf_iterator<char>());
+      in.close();
+      ModuleImageHeader header;
+      memcpy(&header, image.data(), sizeof(header));
+      InstrData idata, bad;
+      memcpy(&idata, image.data() + header.instrs.offset, sizeof(idata));
+
+      bad = idata, bad.opcode = OPCODE_COUNT;
+      ASSERT_THROW({ loadPatchedImage(path, image, bad); }, EncodingException);
+      bad = idata, bad.params[0] = header.regs.count;
+      ASSERT_THROW({ loadPatchedImage(path, image, bad); }, EncodingException);
+      bad = idata, bad.branchIndex = header.instrs.count;
+      ASSERT_THROW({ loadPatchedImage(path, image, bad); }, EncodingException);
+    }
+    catch(...) { passed = false; }
+
+    IGNORE_THROW(module.drop());
+    unlink(path);
+
+    ASSERT_THROW({ Runtime::instance().load(path); }, IOException);
+
+    return printTestResult(subj, "image", passed);
+  }
+
+  void removeDirFiles(const char *path) {
+    DIR *dir = opendir(path);
+    if(!dir)
+      return;
+
+    while(dirent *entry = readdir(dir))
+      if(entry->d_name[0] != '.')
+        unlink((string(path) + '/' + entry->d_name).c_str());
+
+    closedir(dir);
+  }
+
+  bool testCodeCache() {
+    bool passed = true;
+    Module module;
+    string pathStr = testPath("cache");
+    const char *path = pathStr.c_str();
+
+    mkdir(path, 0700);
+    removeDirFiles(path);
+    Runtime::instance().codeCacheDir(path);
+
+    try {
+      SVariable<8, 0, 0> io;
+      uint64_t &val = *reinterpret_cast<uint64_t*>(io.elts[0].bytes);
+      ProcId proc = 0;
+
+      createFactorialModule(module);
+
+      // compiled and stored, then loaded eagerly and lazily
+      for(int i = 0; i < 3; i++) {
+        module.unpack(OPT_O2, i == 2 ? UFLAG_LAZY : 0);
+
+        val = 10;
+        module.callProc(proc, io);
+        if(val != 3628800)
+          throw Exception();
+
+        module.pack();
+      }
+    }
+    catch(...) { passed = false; }
+
+    IGNORE_THROW(module.drop());
+    Runtime::instance().codeCacheDir("");
+    removeDirFiles(path);
+    rmdir(path);
+
+    return printTestResult(subj, "codeCache", passed);
+  }
+
 #define QSORT_ARR_COUNT 16
 
   bool testQSort() {
@@ -80,13 +300,36 @@ namespace {
       io.elts[0].vrefs[0] = &a.var;
 
       ProcId proc = 1;
+      for(int level = OPT_O0; level < OPT_LEVEL_COUNT; level++) {
+        createQSortModule(module);
+        module.unpack(OptLevel(level));
+
+        memcpy(a.var.elts[0].bytes, in, sizeof(in));
+        a.refCount = 1;
+        module.callProc(proc, io);
+        if(memcmp(a.var.elts[0].bytes, out, sizeof(out)) || a.refCount != 1)
+          throw Exception();
+
+        // partition loop starts below the array
+        *reinterpret_cast<int64_t*>(&io.elts[0].bytes[0]) = -1;
+        ASSERT_THROW({ module.callProc(proc, io); }, RuntimeException);
+        *reinterpret_cast<uint64_t*>(&io.elts[0].bytes[0]) = 0;
+
+        module.drop();
+      }
+
       createQSortModule(module);
-      module.unpack();
+      ASSERT_THROW({ module.unpack(OPT_O2, UFLAG_FIRST_RESERVED); },
+                   FlagsException);
+      module.unpack(OPT_O2, UFLAG_LAZY);
 
       memcpy(a.var.elts[0].bytes, in, sizeof(in));
       module.callProc(proc, io);
       if(memcmp(a.var.elts[0].bytes, out, sizeof(out)))
         throw Exception();
+
+      ASSERT_THROW({ Runtime::instance().optLevel(OPT_LEVEL_COUNT); },
+                   RangeException);
     }
     catch(...) { passed = false; }
 
@@ -95,6 +338,385 @@ namespace {
     return printTestResult(subj, "qsort", passed);
   }
 
+  bool testRangeLoop() {
+    bool passed = true;
+    Module module;
+
+    try {
+      SVariable<16, 1, 0> io;
+      SVContainer<8, 0, 0, RANGE_ARR_COUNT, true, true> a;
+      int64_t &h = *reinterpret_cast<int64_t*>(&io.elts[0].bytes[0]);
+      int64_t &s = *reinterpret_cast<int64_t*>(&io.elts[0].bytes[8]);
+      int64_t *elts = reinterpret_cast<int64_t*>(a.var.elts[0].bytes);
+      a.refCount = 1, a.eltCount = RANGE_ARR_COUNT;
+      io.elts[0].vrefs[0] = &a.var;
+      for(size_t i = 0; i < RANGE_ARR_COUNT; i++)
+        elts[i] = i + 1;
+      int64_t sum = RANGE_ARR_COUNT * (RANGE_ARR_COUNT + 1);
+
+      // loops over the whole array, up to its last element and down to
+      // the first one, run no range checks once they are unswitched
+      for(int level = OPT_O0; level <= OPT_LEVEL_COUNT; level++) {
+        createRangeLoopModule(module);
+        unpackForLevel(module, level);
+
+        h = RANGE_ARR_COUNT - 1, s = 0;
+#ifdef CONFIG_DEBUG
+        uint64_t checks = ant_vm_range_checks;
+#endif
+        module.callProc(0, io);
+        if(s != sum)
+          throw Exception();
+#ifdef CONFIG_DEBUG
+        checks = ant_vm_range_checks - checks;
+        if(level < OPT_O2 && checks != 2 * RANGE_ARR_COUNT)
+          throw Exception();
+        if(level >= OPT_O2 && level < OPT_LEVEL_COUNT && checks)
+          throw Exception();
+#endif
+
+        h = RANGE_ARR_COUNT;
+        ASSERT_THROW({ module.callProc(0, io); }, RuntimeException);
+
+        module.drop();
+      }
+    }
+    catch(...) { passed = false; }
+
+    IGNORE_THROW(module.drop());
+
+    return printTestResult(subj, "rangeLoop", passed);
+  }
+
+  bool testTailCall() {
+    bool passed = true;
+    Module module;
+
+    try {
+      SVariable<8, 0, 0> io;
+      uint64_t &val = *reinterpret_cast<uint64_t*>(io.elts[0].bytes);
+      ProcId proc = 0;
+
+      // deep enough to overflow the stack unless calls loop instead
+      for(int level = OPT_O0; level < OPT_LEVEL_COUNT; level++) {
+        createCountModule(module);
+        module.unpack(OptLevel(level));
+
+        val = 1 << 24;
+        module.callProc(proc, io);
+        if(val != 1 << 24)
+          throw Exception();
+
+        module.drop();
+      }
+    }
+    catch(...) { passed = false; }
+
+    IGNORE_THROW(module.drop());
+
+    return printTestResult(subj, "tailCall", passed);
+  }
+
+  bool testArray() {
+    bool passed = true;
+    Module module;
+
+    try {
+      const int64_t in[ARRAY_ARR_COUNT] = { 1, -2, 3, 4, -5, 6, 7 };
+      const int64_t out[ARRAY_ARR_COUNT] = { 3, 3, 9, 12, 3, 18, 21 };
+
+      SVariable<8, 1, 0> io;
+      SVContainer<8, 0, 0, ARRAY_ARR_COUNT + 1, true, true> a;
+      int64_t &val = *reinterpret_cast<int64_t*>(io.elts[0].bytes);
+      a.refCount = 1;
+      io.elts[0].vrefs[0] = &a.var;
+
+      // vector and remaining words, then an array longer than the frame's
+      // and an empty one
+      for(int level = OPT_O0; level <= OPT_LEVEL_COUNT; level++) {
+        createArrayModule(module);
+        unpackForLevel(module, level);
+
+        memcpy(a.var.elts[0].bytes, in, sizeof(in));
+        a.eltCount = ARRAY_ARR_COUNT, val = 3;
+        module.callProc(0, io);
+        if(memcmp(a.var.elts[0].bytes, out, sizeof(out)) || val != 69)
+          throw Exception();
+
+        memcpy(a.var.elts[0].bytes, in, sizeof(in));
+        a.eltCount = ARRAY_ARR_COUNT - 1, val = -1;
+        module.callProc(0, io);
+        if(val != 3 || reinterpret_cast<int64_t*>(a.var.elts[0].bytes)[6] != 7)
+          throw Exception();
+
+        a.eltCount = ARRAY_ARR_COUNT + 1;
+        ASSERT_THROW({ module.callProc(0, io); }, RuntimeException);
+
+        // empty array is no error, it reduces to the identity
+        a.eltCount = 0, val = 3;
+        module.callProc(0, io);
+        if(val)
+          throw Exception();
+        module.callProc(1, io);
+        if(val != numeric_limits<int64_t>::max())
+          throw Exception();
+
+        memcpy(a.var.elts[0].bytes, in, sizeof(in));
+        a.eltCount = ARRAY_ARR_COUNT, val = 0;
+        module.callProc(1, io);
+        if(val != -5)
+          throw Exception();
+
+        module.drop();
+      }
+    }
+    catch(...) { passed = false; }
+
+    IGNORE_THROW(module.drop());
+
+    return printTestResult(subj, "array", passed);
+  }
+
+  bool testDiv() {
+    bool passed = true;
+    Module module;
+
+    try {
+      SVariable<16, 0, 0> io;
+      int64_t &x = *reinterpret_cast<int64_t*>(&io.elts[0].bytes[0]);
+      int64_t &d = *reinterpret_cast<int64_t*>(&io.elts[0].bytes[8]);
+
+      for(int level = OPT_O0; level <= OPT_LEVEL_COUNT; level++) {
+        createDivModule(module);
+        unpackForLevel(module, level);
+
+        x = 100, d = -3;
+        module.callProc(0, io);
+        if(x != -33 * 16 + 1)
+          throw Exception();
+
+        // least value by -1 wraps around
+        x = INT64_MIN, d = -1;
+        module.callProc(0, io);
+        if(x != 0)
+          throw Exception();
+
+        x = 1, d = 0;
+        ASSERT_THROW({ module.callProc(0, io); }, RuntimeException);
+
+        module.drop();
+      }
+    }
+    catch(...) { passed = false; }
+
+    IGNORE_THROW(module.drop());
+
+    return printTestResult(subj, "div", passed);
+  }
+
+  bool testImm() {
+    bool passed = true;
+    Module module;
+
+    try {
+      SVariable<8, 0, 0> io;
+      int64_t &val = *reinterpret_cast<int64_t*>(io.elts[0].bytes);
+
+      for(int level = OPT_O0; level <= OPT_LEVEL_COUNT; level++) {
+        createImmModule(module);
+        unpackForLevel(module, level);
+
+        val = 1;
+        module.callProc(0, io);
+        if(val != -100)
+          throw Exception();
+
+        module.drop();
+      }
+    }
+    catch(...) { passed = false; }
+
+    IGNORE_THROW(module.drop());
+
+    return printTestResult(subj, "imm", passed);
+  }
+
+  bool testFrameLoop() {
+    bool passed = true;
+    Module module;
+
+    try {
+      SVariable<16, 0, 0> io;
+      int64_t &n = *reinterpret_cast<int64_t*>(&io.elts[0].bytes[0]);
+      int64_t &s = *reinterpret_cast<int64_t*>(&io.elts[0].bytes[8]);
+
+      // frame is zeroed again on every iteration
+      for(int level = OPT_O0; level <= OPT_LEVEL_COUNT; level++) {
+        createFrameLoopModule(module);
+        unpackForLevel(module, level);
+
+        n = LOOP_ARR_COUNT, s = -1;
+        module.callProc(0, io);
+        if(n != LOOP_ARR_COUNT || s)
+          throw Exception();
+
+        module.drop();
+      }
+    }
+    catch(...) { passed = false; }
+
+    IGNORE_THROW(module.drop());
+
+    return printTestResult(subj, "frameLoop", passed);
+  }
+
+  bool testPartialWrite() {
+    bool passed = true;
+    Module module;
+
+    try {
+      SVariable<32, 0, 0> io;
+      int64_t *w = reinterpret_cast<int64_t*>(&io.elts[0].bytes[0]);
+
+      // bytes read before being written stay zeroed, stack is dirtied first
+      for(int level = OPT_O0; level <= OPT_LEVEL_COUNT; level++) {
+        createPartialWriteModule(module);
+        unpackForLevel(module, level);
+
+        w[0] = -1;
+        module.callProc(1, io);
+        w[0] = 5, w[1] = w[2] = w[3] = -1;
+        module.callProc(0, io);
+        if(w[0] != 5 || w[1] != 2 || w[2] || w[3])
+          throw Exception();
+
+        module.drop();
+      }
+    }
+    catch(...) { passed = false; }
+
+    IGNORE_THROW(module.drop());
+
+    return printTestResult(subj, "partialWrite", passed);
+  }
+
+  bool testReplaceRef() {
+    bool passed = true;
+    Module module;
+
+    try {
+      SVariable<32, 1, 0> io;
+      SVContainer<8, 1, 0, 1, true, true> nodes[3];
+      int64_t *v = reinterpret_cast<int64_t*>(io.elts[0].bytes);
+      for(size_t i = 0; i < 3; i++) {
+        nodes[i].refCount = 1, nodes[i].eltCount = 1;
+        *reinterpret_cast<int64_t*>(nodes[i].var.elts[0].bytes) = i + 1;
+        nodes[i].var.elts[0].vrefs[0] = i < 2 ? &nodes[i + 1].var : NULL;
+      }
+      io.elts[0].vrefs[0] = &nodes[0].var;
+
+      // reference replaced by LDR, directly or from a variable a callee
+      // changed, is loaded again in the next block
+      for(int level = OPT_O0; level <= OPT_LEVEL_COUNT; level++) {
+        createReplaceRefModule(module);
+        unpackForLevel(module, level);
+
+        v[0] = v[1] = v[2] = v[3] = 0;
+        module.callProc(1, io);
+        if(v[0] != 1 || v[1] != 2 || v[2] != 2 || v[3] != 3)
+          throw Exception();
+        for(size_t i = 0; i < 3; i++)
+          if(nodes[i].refCount != 1)
+            throw Exception();
+
+        module.drop();
+      }
+    }
+    catch(...) { passed = false; }
+
+    IGNORE_THROW(module.drop());
+
+    return printTestResult(subj, "replaceRef", passed);
+  }
+
+  bool testRefs() {
+    bool passed = true;
+    Module module;
+
+    try {
+      SVariable<8, 1, 0> io;
+      SVContainer<8, 0, 0, 1, true, true> a;
+      int64_t &val = *reinterpret_cast<int64_t*>(io.elts[0].bytes);
+      a.refCount = 1, a.eltCount = 1;
+      io.elts[0].vrefs[0] = &a.var;
+
+      // frame references are released in a loop on POP and on unwinding
+      for(int level = OPT_O0; level <= OPT_LEVEL_COUNT; level++) {
+        createRefsModule(module);
+        unpackForLevel(module, level);
+
+        val = 0;
+        module.callProc(0, io);
+        if(a.refCount != 1)
+          throw Exception();
+
+        val = 1;
+        ASSERT_THROW({ module.callProc(0, io); }, RuntimeException);
+        if(a.refCount != 1)
+          throw Exception();
+
+        module.drop();
+      }
+    }
+    catch(...) { passed = false; }
+
+    IGNORE_THROW(module.drop());
+
+    return printTestResult(subj, "refs", passed);
+  }
+
+  bool testChecks() {
+    bool passed = true;
+    Module module;
+
+    try {
+      SVariable<16, 2, 0> io;
+      SVContainer<8, 0, 0, 2, true, true> a, n;
+      int64_t &i = *reinterpret_cast<int64_t*>(&io.elts[0].bytes[0]);
+      int64_t &r = *reinterpret_cast<int64_t*>(&io.elts[0].bytes[8]);
+      a.refCount = 1, a.eltCount = 2, n.refCount = 1, n.eltCount = 2;
+      reinterpret_cast<int64_t*>(a.var.elts[0].bytes)[1] = 5;
+      reinterpret_cast<int64_t*>(n.var.elts[0].bytes)[1] = 7;
+      io.elts[0].vrefs[0] = &a.var;
+
+      // failed checks are caught by the handlers of the procedure itself
+      for(int level = OPT_O0; level <= OPT_LEVEL_COUNT; level++) {
+        createCheckModule(module);
+        unpackForLevel(module, level);
+
+        io.elts[0].vrefs[1] = NULL;
+        i = 2, r = 0;
+        module.callProc(0, io);
+        if(i != VMECODE_NULL_REFERENCE || r != VMECODE_RANGE ||
+           a.refCount != 1)
+          throw Exception();
+
+        io.elts[0].vrefs[1] = &n.var;
+        i = 1, r = 0;
+        module.callProc(0, io);
+        if(i != 1 || r != 7 || a.refCount != 1 || n.refCount != 1)
+          throw Exception();
+
+        module.drop();
+      }
+    }
+    catch(...) { passed = false; }
+
+    IGNORE_THROW(module.drop());
+
+    return printTestResult(subj, "checks", passed);
+  }
+
   bool testEH() {
     bool passed = true;
     Module module;
@@ -127,6 +749,225 @@ namespace {
     return printTestResult(subj, "EH", passed);
   }
 
+  bool testInterpreter() {
+    bool passed = true;
+    Module module;
+
+    try {
+      SVariable<8, 0, 0> io;
+      uint64_t &val = *reinterpret_cast<uint64_t*>(io.elts[0].bytes);
+
+      createFactorialModule(module);
+      module.unpack(OPT_O0, UFLAG_INTERPRET);
+      if(module.isPacked())
+        throw Exception();
+
+      val = 20;
+      module.callProc(0, io);
+      if(val != 2432902008176640000LLU)
+        throw Exception();
+
+      ProcHandle handle = module.procHandle(0);
+      val = 5;
+      handle(io);
+      if(val != 120)
+        throw Exception();
+
+      module.pack();
+      ASSERT_THROW({ handle(io); }, OperationException);
+      module.unpack(OPT_O0, UFLAG_INTERPRET | UFLAG_LAZY);
+      val = 10;
+      handle(io);
+      if(val != 3628800)
+        throw Exception();
+      module.drop();
+
+      createEHTestModule(module);
+      module.unpack(OPT_O0, UFLAG_INTERPRET);
+
+      val = 0;
+      module.callProc(1, io);
+      if(val != -1)
+        throw Exception();
+
+      val = 1;
+      module.callProc(1, io);
+      if(val != -2)
+        throw Exception();
+
+      val = 2;
+      ASSERT_THROW({module.callProc(1, io);}, RuntimeException);
+      module.drop();
+
+      const int64_t in[QSORT_ARR_COUNT] = {
+	123, 34, -23, 0, 876, 34, 268, 994, -74, -222, 43, 13, -1, 6, 78, 56 };
+      const int64_t out[QSORT_ARR_COUNT] = {
+	-222, -74, -23, -1, 0, 6, 13, 34, 34, 43, 56, 78, 123, 268, 876, 994 };
+
+      SVariable<16, 1, 0> qio;
+      SVContainer<8, 0, 0, QSORT_ARR_COUNT, true, true> a;
+      *reinterpret_cast<uint64_t*>(&qio.elts[0].bytes[0]) = 0;
+      *reinterpret_cast<uint64_t*>(&qio.elts[0].bytes[8]) = QSORT_ARR_COUNT - 1;
+      a.refCount = 1, a.eltCount = QSORT_ARR_COUNT;
+      qio.elts[0].vrefs[0] = &a.var;
+
+      createQSortModule(module);
+      module.unpackAsync(OPT_O0, UFLAG_INTERPRET);
+
+      memcpy(a.var.elts[0].bytes, in, sizeof(in));
+      module.callProc(1, qio);
+      if(memcmp(a.var.elts[0].bytes, out, sizeof(out)) || a.refCount != 1)
+        throw Exception();
+    }
+    catch(...) { passed = false; }
+
+    IGNORE_THROW(module.drop());
+
+    return printTestResult(subj, "interpreter", passed);
+  }
+
+  bool testTiered() {
+    bool passed = true;
+    Runtime &rt = Runtime::instance();
+    uint32_t baseline = rt.tierThreshold(TIER_BASELINE);
+    uint32_t optimized = rt.tierThreshold(TIER_OPTIMIZED);
+    Module module;
+
+    try {
+      SVariable<8, 0, 0> io;
+      uint64_t &val = *reinterpret_cast<uint64_t*>(io.elts[0].bytes);
+
+      ASSERT_THROW({ rt.tierThreshold(TIER_INTERPRETED, 1); },
+                   RangeException);
+      ASSERT_THROW({ rt.tierThreshold(TIER_BASELINE, 0); }, RangeException);
+      rt.tierThreshold(TIER_BASELINE, 2);
+      rt.tierThreshold(TIER_OPTIMIZED, 50);
+
+      createFactorialModule(module);
+      ASSERT_THROW({ module.unpack(OPT_O2, UFLAG_TIERED | UFLAG_LAZY); },
+                   FlagsException);
+      module.unpack(OPT_O2, UFLAG_TIERED);
+      if(module.procTier(0) != TIER_INTERPRETED)
+        throw Exception();
+      ASSERT_THROW({ module.procTier(1); }, NotFoundException);
+
+      // promoted while running, then entered through compiled code
+      ProcHandle handle = module.procHandle(0);
+      for(int i = 0; i < 10; i++) {
+        val = 20;
+        handle(io);
+        if(val != 2432902008176640000LLU)
+          throw Exception();
+      }
+      if(module.procTier(0) != TIER_OPTIMIZED)
+        throw Exception();
+
+      module.pack();
+      ASSERT_THROW({ module.procTier(0); }, OperationException);
+      module.drop();
+
+      // interpreted and compiled procedures unwind through each other
+      createEHTestModule(module);
+      module.unpack(OPT_O2, UFLAG_TIERED);
+      for(int i = 0; i < 10; i++) {
+        val = 0;
+        module.callProc(1, io);
+        if(val != -1)
+          throw Exception();
+
+        val = 1;
+        module.callProc(1, io);
+        if(val != -2)
+          throw Exception();
+
+        val = 2;
+        ASSERT_THROW({module.callProc(1, io);}, RuntimeException);
+      }
+      if(module.procTier(1) == TIER_INTERPRETED)
+        throw Exception();
+    }
+    catch(...) { passed = false; }
+
+    IGNORE_THROW(module.drop());
+    rt.tierThreshold(TIER_BASELINE, baseline);
+    rt.tierThreshold(TIER_OPTIMIZED, optimized);
+
+    return printTestResult(subj, "tiered", passed);
+  }
+
+  struct InlineCall {
+    ProcId caller, callee;
+    InlineDecision decision;
+  };
+
+  vector<InlineCall> inlineCalls;
+
+  void recordInlineCall(const UUID &module, ProcId caller, ProcId callee,
+                        InlineDecision decision) {
+    InlineCall call = { caller, callee, decision };
+    inlineCalls.push_back(call);
+  }
+
+  bool hasInlineCall(ProcId caller, ProcId callee, InlineDecision decision) {
+    for(size_t i = 0; i < inlineCalls.size(); i++)
+      if(inlineCalls[i].caller == caller && inlineCalls[i].callee == callee
+         && inlineCalls[i].decision == decision)
+        return true;
+    return false;
+  }
+
+  bool testInline() {
+    bool passed = true;
+    Runtime &rt = Runtime::instance();
+    uint32_t budget = rt.inlineBudget();
+    Module module;
+
+    try {
+      SVariable<16, 1, 0> io;
+      SVContainer<8, 0, 0, 2, true, true> a;
+      int64_t *elts = reinterpret_cast<int64_t*>(a.var.elts[0].bytes);
+      *reinterpret_cast<uint64_t*>(&io.elts[0].bytes[0]) = 0;
+      *reinterpret_cast<uint64_t*>(&io.elts[0].bytes[8]) = 1;
+      a.refCount = 1, a.eltCount = 2;
+      io.elts[0].vrefs[0] = &a.var;
+      rt.inlineHook(recordInlineCall);
+
+      // partition is inlined, recursive calls of qsort are not
+      for(int i = 0; i < 2; i++) {
+        inlineCalls.clear();
+        rt.inlineBudget(i ? 8 : budget);
+        createQSortModule(module);
+        module.unpack(OPT_O2);
+
+        if(inlineCalls.size() != 3 || !hasInlineCall(1, 1, INLINE_RECURSIVE)
+           || !hasInlineCall(1, 0, i ? INLINE_OVER_BUDGET : INLINE_DONE))
+          throw Exception();
+
+        elts[0] = 2, elts[1] = 1;
+        module.callProc(1, io);
+        if(elts[0] != 1 || elts[1] != 2)
+          throw Exception();
+
+        module.drop();
+      }
+
+      // nothing is considered if inlining is disabled
+      inlineCalls.clear();
+      rt.inlineBudget(0);
+      createQSortModule(module);
+      module.unpack(OPT_O2);
+      if(!inlineCalls.empty())
+        throw Exception();
+    }
+    catch(...) { passed = false; }
+
+    IGNORE_THROW(module.drop());
+    rt.inlineBudget(budget);
+    rt.inlineHook(NULL);
+
+    return printTestResult(subj, "inline", passed);
+  }
+
 }
 
 namespace Ant {
@@ -137,8 +978,24 @@ namespace Ant {
         bool passed;
 
         passed = testFactorial();
+        passed = passed && testAsync();
+        passed = passed && testImage();
+        passed = passed && testCodeCache();
 	passed = passed && testQSort();
+        passed = passed && testTailCall();
+        passed = passed && testRangeLoop();
+        passed = passed && testArray();
+        passed = passed && testDiv();
+        passed = passed && testImm();
+        passed = passed && testFrameLoop();
+        passed = passed && testPartialWrite();
+        passed = passed && testRefs();
+        passed = passed && testReplaceRef();
+        passed = passed && testChecks();
         passed = passed && testEH();
+        passed = passed && testInterpreter();
+        passed = passed && testTiered();
+        passed = passed && testInline();
 
         return passed;
       }
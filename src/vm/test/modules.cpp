@@ -1,5 +1,6 @@
 #include "../instr.h"
 #include "../mbuilder.h"
+#include "vm.test.h"
 
 namespace Ant {
   namespace VM {
@@ -146,6 +147,488 @@ namespace Ant {
         builder.createModule(module);
       }
 
+      void createCountModule(Module &module) {
+        ModuleBuilder builder;
+
+        // void count(unsigned int *io) {
+        //   if(*io)
+        //     goto l1;
+        //   return;
+        // l1:
+        //   {
+        //     unsigned int cio = *io - 1;
+        //     count(&cio);
+        //   }
+        // }
+        VarTypeId vtype = builder.addVarType(8);
+        RegId io = builder.addReg(0, vtype);
+        ProcTypeId ptype = builder.addProcType(0, io);
+        ProcId proc = builder.addProc(PFLAG_EXTERNAL, ptype);
+        builder.addProcInstr(proc, JNZInstr(io, 2));
+        builder.addProcInstr(proc, RETInstr());
+        RegId cio = builder.addReg(0, vtype);
+        builder.addProcInstr(proc, PUSHInstr(cio));
+        builder.addProcInstr(proc, CPBInstr(io, cio));
+        builder.addProcInstr(proc, DECInstr(cio));
+        builder.addProcInstr(proc, CALLInstr(proc));
+        builder.addProcInstr(proc, POPInstr());
+        builder.addProcInstr(proc, RETInstr());
+
+        builder.createModule(module);
+      }
+
+      void createArrayModule(Module &module) {
+        ModuleBuilder builder;
+
+        // struct ioType { int v, *a; };
+        VarTypeId wordType = builder.addVarType(8);
+        VarTypeId ioType = builder.addVarType(8);
+        builder.addVarTypeVRef(ioType, VFLAG_NON_FIXED_REF, wordType);
+
+        // void scale(struct ioType *io) {
+        //   int *a = io->a, t[ARRAY_ARR_COUNT];
+        //   for(i = 0; i < count(a); i++)
+        //     t[i] = io->v, a[i] = max(a[i] * t[i], t[i]);
+        //   io->v = sum(a);
+        // }
+        RegId io = builder.addReg(0, ioType);
+        ProcTypeId ptype = builder.addProcType(0, io);
+        ProcId scale = builder.addProc(PFLAG_EXTERNAL, ptype);
+        RegId a = builder.addReg(VFLAG_NON_FIXED_REF, wordType);
+        builder.addProcInstr(scale, PUSHRInstr(a));
+        builder.addProcInstr(scale, LDRInstr(io, 0, a));
+        RegId t = builder.addReg(0, wordType, ARRAY_ARR_COUNT);
+        builder.addProcInstr(scale, PUSHInstr(t));
+        builder.addProcInstr(scale, AFILLInstr(io, t));
+        builder.addProcInstr(scale, AMULInstr(a, t, a));
+        builder.addProcInstr(scale, AMAXInstr(a, t, a));
+        builder.addProcInstr(scale, ARSUMInstr(a, io));
+        builder.addProcInstr(scale, POPInstr());
+        builder.addProcInstr(scale, POPInstr());
+        builder.addProcInstr(scale, RETInstr());
+
+        // void least(struct ioType *io) {
+        //   int *a = io->a;
+        //   io->v = min(a);
+        // }
+        ProcId least = builder.addProc(PFLAG_EXTERNAL, ptype);
+        builder.addProcInstr(least, PUSHRInstr(a));
+        builder.addProcInstr(least, LDRInstr(io, 0, a));
+        builder.addProcInstr(least, ARMINInstr(a, io));
+        builder.addProcInstr(least, POPInstr());
+        builder.addProcInstr(least, RETInstr());
+
+        builder.createModule(module);
+      }
+
+      void createDivModule(Module &module) {
+        ModuleBuilder builder;
+
+        // struct ioType { int x, d; };
+        VarTypeId wordType = builder.addVarType(8);
+        VarTypeId ioType = builder.addVarType(16);
+
+        // void divide(struct ioType *io) {
+        //   int d = io->d, q = io->x / d;
+        //   io->x = (q << 4) + io->x % d;
+        // }
+        RegId io = builder.addReg(0, ioType);
+        ProcTypeId ptype = builder.addProcType(0, io);
+        ProcId divide = builder.addProc(PFLAG_EXTERNAL, ptype);
+        RegId d = builder.addReg(0, wordType);
+        builder.addProcInstr(divide, PUSHInstr(d));
+        builder.addProcInstr(divide, LDBInstr(io, 8, d));
+        RegId q = builder.addReg(0, wordType);
+        builder.addProcInstr(divide, PUSHInstr(q));
+        builder.addProcInstr(divide, SDIV8Instr(io, d, q));
+        builder.addProcInstr(divide, SREM8Instr(io, d, io));
+        builder.addProcInstr(divide, CPI8Instr(4, d));
+        builder.addProcInstr(divide, SHL8Instr(q, d, q));
+        builder.addProcInstr(divide, ADDInstr(q, io, io));
+        builder.addProcInstr(divide, POPInstr());
+        builder.addProcInstr(divide, POPInstr());
+        builder.addProcInstr(divide, RETInstr());
+
+        builder.createModule(module);
+      }
+
+      void createImmModule(Module &module) {
+        ModuleBuilder builder;
+
+        // void imm(int *io) {
+        //   int s = 0, i = 0;
+        // l1:
+        //   s += i++;
+        //   if(i <= 10)
+        //     goto l1;
+        //   *io = (s - 5) * -2;
+        //   if(*io == -100)
+        //     return;
+        //   *io = 0;
+        // }
+        VarTypeId vtype = builder.addVarType(8);
+        RegId io = builder.addReg(0, vtype);
+        ProcTypeId ptype = builder.addProcType(0, io);
+        ProcId imm = builder.addProc(PFLAG_EXTERNAL, ptype);
+        RegId s = builder.addReg(0, vtype);
+        builder.addProcInstr(imm, PUSHInstr(s));
+        RegId i = builder.addReg(0, vtype);
+        builder.addProcInstr(imm, PUSHInstr(i));
+        builder.addProcInstr(imm, ADDInstr(s, i, s));
+        builder.addProcInstr(imm, ADDIInstr(i, 1, i));
+        builder.addProcInstr(imm, JNGIInstr(i, 10, -2));
+        builder.addProcInstr(imm, SUBIInstr(s, 5, s));
+        builder.addProcInstr(imm, MULIInstr(s, -2, io));
+        builder.addProcInstr(imm, JEIInstr(io, -100, 2));
+        builder.addProcInstr(imm, CPI8Instr(0, io));
+        builder.addProcInstr(imm, POPInstr());
+        builder.addProcInstr(imm, POPInstr());
+        builder.addProcInstr(imm, RETInstr());
+
+        builder.createModule(module);
+      }
+
+      void createCheckModule(Module &module) {
+        ModuleBuilder builder;
+
+        // struct ioType { int i, r, *a, *n; };
+        VarTypeId wordType = builder.addVarType(8);
+        VarTypeId ioType = builder.addVarType(16);
+        builder.addVarTypeVRef(ioType, VFLAG_NON_FIXED_REF, wordType);
+        builder.addVarTypeVRef(ioType, VFLAG_NON_FIXED_REF, wordType);
+
+        // void check(struct ioType *io) {
+        //   int *a = io->a;
+        //   try { int *t = io->a, v = a[io->i]; io->r = v; }
+        //   catch(...) { io->r = ed; }
+        //   try { int *t = io->a, *n = io->n, v = n[io->i]; io->r = v; }
+        //   catch(...) { io->i = ed; }
+        // }
+        RegId ed = PRESET_REG_ED, io = builder.addReg(0, ioType);
+        ProcTypeId ptype = builder.addProcType(0, io);
+        ProcId check = builder.addProc(PFLAG_EXTERNAL, ptype);
+        RegId a = builder.addReg(VFLAG_NON_FIXED_REF, wordType);
+        RegId t = builder.addReg(VFLAG_NON_FIXED_REF, wordType);
+        RegId n = builder.addReg(VFLAG_NON_FIXED_REF, wordType);
+        RegId v = builder.addReg(0, wordType);
+        builder.addProcInstr(check, PUSHRInstr(a));
+        builder.addProcInstr(check, LDRInstr(io, 0, a));
+        builder.addProcInstr(check, PUSHHInstr(9));
+        builder.addProcInstr(check, PUSHRInstr(t));
+        builder.addProcInstr(check, LDRInstr(io, 0, t));
+        builder.addProcInstr(check, PUSHInstr(v));
+        builder.addProcInstr(check, LDEInstr(a, io, v));
+        builder.addProcInstr(check, STBInstr(v, io, 8));
+        builder.addProcInstr(check, POPInstr());
+        builder.addProcInstr(check, POPInstr());
+        builder.addProcInstr(check, JMPInstr(2));
+        builder.addProcInstr(check, STBInstr(ed, io, 8));
+        builder.addProcInstr(check, POPInstr());
+        builder.addProcInstr(check, PUSHHInstr(12));
+        builder.addProcInstr(check, PUSHRInstr(t));
+        builder.addProcInstr(check, LDRInstr(io, 0, t));
+        builder.addProcInstr(check, PUSHRInstr(n));
+        builder.addProcInstr(check, LDRInstr(io, 1, n));
+        builder.addProcInstr(check, PUSHInstr(v));
+        builder.addProcInstr(check, LDEInstr(n, io, v));
+        builder.addProcInstr(check, STBInstr(v, io, 8));
+        builder.addProcInstr(check, POPInstr());
+        builder.addProcInstr(check, POPInstr());
+        builder.addProcInstr(check, POPInstr());
+        builder.addProcInstr(check, JMPInstr(2));
+        builder.addProcInstr(check, CPBInstr(ed, io));
+        builder.addProcInstr(check, POPInstr());
+        builder.addProcInstr(check, POPInstr());
+        builder.addProcInstr(check, RETInstr());
+
+        builder.createModule(module);
+      }
+
+      void createRefsModule(Module &module) {
+        ModuleBuilder builder;
+
+        // struct ioType { int v, *a; };
+        // struct refsType { int *r[REFS_COUNT]; };
+        VarTypeId wordType = builder.addVarType(8);
+        VarTypeId ioType = builder.addVarType(8);
+        builder.addVarTypeVRef(ioType, VFLAG_NON_FIXED_REF, wordType);
+        VarTypeId refsType = builder.addVarType(0);
+        for(size_t k = 0; k < REFS_COUNT; k++)
+          builder.addVarTypeVRef(refsType, VFLAG_NON_FIXED_REF, wordType);
+
+        // void hold(struct ioType *io) {
+        //   int *a = io->a;
+        //   struct refsType s;
+        //   for(k = 0; k < REFS_COUNT; k++)
+        //     s.r[k] = a;
+        //   if(io->v)
+        //     throw ed = io->v;
+        // }
+        RegId ed = PRESET_REG_ED, io = builder.addReg(0, ioType);
+        ProcTypeId ptype = builder.addProcType(0, io);
+        ProcId hold = builder.addProc(PFLAG_EXTERNAL, ptype);
+        RegId a = builder.addReg(VFLAG_NON_FIXED_REF, wordType);
+        builder.addProcInstr(hold, PUSHRInstr(a));
+        builder.addProcInstr(hold, LDRInstr(io, 0, a));
+        RegId s = builder.addReg(0, refsType);
+        builder.addProcInstr(hold, PUSHInstr(s));
+        for(uint32_t k = 0; k < REFS_COUNT; k++)
+          builder.addProcInstr(hold, STRInstr(a, s, k));
+        builder.addProcInstr(hold, JNZInstr(io, 2));
+        builder.addProcInstr(hold, JMPInstr(3));
+        builder.addProcInstr(hold, CPBInstr(io, ed));
+        builder.addProcInstr(hold, THROWInstr());
+        builder.addProcInstr(hold, POPInstr());
+        builder.addProcInstr(hold, POPInstr());
+        builder.addProcInstr(hold, RETInstr());
+
+        builder.createModule(module);
+      }
+
+      void createFrameLoopModule(Module &module) {
+        ModuleBuilder builder;
+
+        // struct ioType { int n, s; };
+        VarTypeId wordType = builder.addVarType(8);
+        VarTypeId ioType = builder.addVarType(16);
+
+        // void sum(struct ioType *io) {
+        //   int n = io->n, s = 0;
+        // l1:
+        //   {
+        //     int t[LOOP_ARR_COUNT], v = t[--n];
+        //     s += v;
+        //     fill(t, n);
+        //   }
+        //   if(n)
+        //     goto l1;
+        //   io->s = s;
+        // }
+        RegId io = builder.addReg(0, ioType);
+        ProcTypeId ptype = builder.addProcType(0, io);
+        ProcId sum = builder.addProc(PFLAG_EXTERNAL, ptype);
+        RegId n = builder.addReg(0, wordType);
+        builder.addProcInstr(sum, PUSHInstr(n));
+        builder.addProcInstr(sum, CPBInstr(io, n));
+        RegId s = builder.addReg(0, wordType);
+        builder.addProcInstr(sum, PUSHInstr(s));
+        RegId t = builder.addReg(0, wordType, LOOP_ARR_COUNT);
+        builder.addProcInstr(sum, PUSHInstr(t));
+        RegId v = builder.addReg(0, wordType);
+        builder.addProcInstr(sum, PUSHInstr(v));
+        builder.addProcInstr(sum, DECInstr(n));
+        builder.addProcInstr(sum, LDEInstr(t, n, v));
+        builder.addProcInstr(sum, ADDInstr(s, v, s));
+        builder.addProcInstr(sum, AFILLInstr(n, t));
+        builder.addProcInstr(sum, POPInstr());
+        builder.addProcInstr(sum, POPInstr());
+        builder.addProcInstr(sum, JNZInstr(n, -8));
+        builder.addProcInstr(sum, STBInstr(s, io, 8));
+        builder.addProcInstr(sum, POPInstr());
+        builder.addProcInstr(sum, POPInstr());
+        builder.addProcInstr(sum, RETInstr());
+
+        builder.createModule(module);
+      }
+
+      void createPartialWriteModule(Module &module) {
+        ModuleBuilder builder;
+
+        // struct ioType { int n, a, b, c; };
+        VarTypeId wordType = builder.addVarType(8);
+        VarTypeId pairType = builder.addVarType(16);
+        VarTypeId ioType = builder.addVarType(32);
+
+        // void partial(struct ioType *io) {
+        //   int n = io->n;
+        //   { int x; *(int32_t*)&x = 1; io->a = x + x; }
+        //   { int y; { struct { int l, h; } p; p.h = n; y = p.l; } io->b = y; }
+        //   { int z; if(!n) z = 3; io->c = z; }
+        // }
+        RegId io = builder.addReg(0, ioType);
+        ProcTypeId ptype = builder.addProcType(0, io);
+        ProcId partial = builder.addProc(PFLAG_EXTERNAL, ptype);
+        RegId n = builder.addReg(0, wordType);
+        builder.addProcInstr(partial, PUSHInstr(n));
+        builder.addProcInstr(partial, CPBInstr(io, n));
+        RegId x = builder.addReg(0, wordType);
+        builder.addProcInstr(partial, PUSHInstr(x));
+        builder.addProcInstr(partial, CPI4Instr(1, x));
+        builder.addProcInstr(partial, ADDInstr(x, x, x));
+        builder.addProcInstr(partial, STBInstr(x, io, 8));
+        builder.addProcInstr(partial, POPInstr());
+        RegId y = builder.addReg(0, wordType);
+        builder.addProcInstr(partial, PUSHInstr(y));
+        RegId p = builder.addReg(0, pairType);
+        builder.addProcInstr(partial, PUSHInstr(p));
+        builder.addProcInstr(partial, STBInstr(n, p, 8));
+        builder.addProcInstr(partial, LDBInstr(p, 0, y));
+        builder.addProcInstr(partial, POPInstr());
+        builder.addProcInstr(partial, STBInstr(y, io, 16));
+        builder.addProcInstr(partial, POPInstr());
+        RegId z = builder.addReg(0, wordType);
+        builder.addProcInstr(partial, PUSHInstr(z));
+        builder.addProcInstr(partial, JNZInstr(n, 2));
+        builder.addProcInstr(partial, CPI8Instr(3, z));
+        builder.addProcInstr(partial, STBInstr(z, io, 24));
+        builder.addProcInstr(partial, POPInstr());
+        builder.addProcInstr(partial, POPInstr());
+        builder.addProcInstr(partial, RETInstr());
+
+        // void dirty(struct ioType *io) {
+        //   int t[DIRTY_ARR_COUNT];
+        //   fill(t, io->n);
+        // }
+        ProcId dirty = builder.addProc(PFLAG_EXTERNAL, ptype);
+        RegId v = builder.addReg(0, wordType);
+        builder.addProcInstr(dirty, PUSHInstr(v));
+        builder.addProcInstr(dirty, CPBInstr(io, v));
+        RegId t = builder.addReg(0, wordType, DIRTY_ARR_COUNT);
+        builder.addProcInstr(dirty, PUSHInstr(t));
+        builder.addProcInstr(dirty, AFILLInstr(v, t));
+        builder.addProcInstr(dirty, POPInstr());
+        builder.addProcInstr(dirty, POPInstr());
+        builder.addProcInstr(dirty, RETInstr());
+
+        builder.createModule(module);
+      }
+
+      void createReplaceRefModule(Module &module) {
+        ModuleBuilder builder;
+
+        // struct nodeType { int v; struct nodeType *next; };
+        // struct ioType { int v1, v2, v3, v4; struct nodeType *head; };
+        VarTypeId wordType = builder.addVarType(8);
+        VarTypeId nodeType = builder.addVarType(8);
+        builder.addVarTypeVRef(nodeType, VFLAG_NON_FIXED_REF, nodeType);
+        VarTypeId ioType = builder.addVarType(32);
+        builder.addVarTypeVRef(ioType, VFLAG_NON_FIXED_REF, nodeType);
+
+        // void next(struct ioType *io) {
+        //   struct nodeType *m = io->head;
+        //   m = m->next, io->head = m;
+        // }
+        RegId io = builder.addReg(0, ioType);
+        ProcTypeId ptype = builder.addProcType(0, io);
+        ProcId next = builder.addProc(0, ptype);
+        RegId m = builder.addReg(VFLAG_NON_FIXED_REF, nodeType);
+        builder.addProcInstr(next, PUSHRInstr(m));
+        builder.addProcInstr(next, LDRInstr(io, 0, m));
+        builder.addProcInstr(next, LDRInstr(m, 0, m));
+        builder.addProcInstr(next, STRInstr(m, io, 0));
+        builder.addProcInstr(next, POPInstr());
+        builder.addProcInstr(next, RETInstr());
+
+        // void walk(struct ioType *io) {
+        //   int s, t;
+        //   struct nodeType *r = io->head;
+        //   struct ioType c;
+        //   s = r->v;
+        //   if(s) {}
+        //   r = r->next;
+        //   if(s) {}
+        //   t = r->v, io->v2 = t;
+        //   c.head = r;
+        //   next(&c);
+        //   if(s) {}
+        //   t = r->v, io->v3 = t;
+        //   r = c.head;
+        //   if(s) {}
+        //   t = r->v, io->v4 = t;
+        //   io->v1 = s;
+        // }
+        ProcId walk = builder.addProc(PFLAG_EXTERNAL, ptype);
+        RegId s = builder.addReg(0, wordType);
+        builder.addProcInstr(walk, PUSHInstr(s));
+        RegId t = builder.addReg(0, wordType);
+        builder.addProcInstr(walk, PUSHInstr(t));
+        RegId r = builder.addReg(VFLAG_NON_FIXED_REF, nodeType);
+        builder.addProcInstr(walk, PUSHRInstr(r));
+        RegId c = builder.addReg(0, ioType);
+        builder.addProcInstr(walk, PUSHInstr(c));
+        builder.addProcInstr(walk, LDRInstr(io, 0, r));
+        builder.addProcInstr(walk, LDBInstr(r, 0, s));
+        builder.addProcInstr(walk, JNZInstr(s, 1));
+        builder.addProcInstr(walk, LDRInstr(r, 0, r));
+        builder.addProcInstr(walk, JNZInstr(s, 1));
+        builder.addProcInstr(walk, LDBInstr(r, 0, t));
+        builder.addProcInstr(walk, STBInstr(t, io, 8));
+        builder.addProcInstr(walk, STRInstr(r, c, 0));
+        builder.addProcInstr(walk, CALLInstr(next));
+        builder.addProcInstr(walk, JNZInstr(s, 1));
+        builder.addProcInstr(walk, LDBInstr(r, 0, t));
+        builder.addProcInstr(walk, STBInstr(t, io, 16));
+        builder.addProcInstr(walk, LDRInstr(c, 0, r));
+        builder.addProcInstr(walk, JNZInstr(s, 1));
+        builder.addProcInstr(walk, LDBInstr(r, 0, t));
+        builder.addProcInstr(walk, STBInstr(t, io, 24));
+        builder.addProcInstr(walk, STBInstr(s, io, 0));
+        builder.addProcInstr(walk, POPInstr());
+        builder.addProcInstr(walk, POPInstr());
+        builder.addProcInstr(walk, POPInstr());
+        builder.addProcInstr(walk, POPInstr());
+        builder.addProcInstr(walk, RETInstr());
+
+        builder.createModule(module);
+      }
+
+      void createRangeLoopModule(Module &module) {
+        ModuleBuilder builder;
+
+        // struct ioType { int h, s, *a; };
+        VarTypeId wordType = builder.addVarType(8);
+        VarTypeId ioType = builder.addVarType(16);
+        builder.addVarTypeVRef(ioType, VFLAG_NON_FIXED_REF, wordType);
+
+        // void sum(struct ioType *io) {
+        //   int i = 0, h = io->h, s = 0, v, *a = io->a, z = 0;
+        // l1:
+        //   v = a[i], s += v;
+        //   if(!(++i > h))
+        //     goto l1;
+        // l2:
+        //   v = a[h], s += v;
+        //   if(!(z > --h))
+        //     goto l2;
+        //   io->s = s;
+        // }
+        RegId io = builder.addReg(0, ioType);
+        ProcTypeId ptype = builder.addProcType(0, io);
+        ProcId sum = builder.addProc(PFLAG_EXTERNAL, ptype);
+        RegId i = builder.addReg(0, wordType);
+        builder.addProcInstr(sum, PUSHInstr(i));
+        RegId h = builder.addReg(0, wordType);
+        builder.addProcInstr(sum, PUSHInstr(h));
+        builder.addProcInstr(sum, CPBInstr(io, h));
+        RegId s = builder.addReg(0, wordType);
+        builder.addProcInstr(sum, PUSHInstr(s));
+        RegId v = builder.addReg(0, wordType);
+        builder.addProcInstr(sum, PUSHInstr(v));
+        RegId a = builder.addReg(VFLAG_NON_FIXED_REF, wordType);
+        builder.addProcInstr(sum, PUSHRInstr(a));
+        builder.addProcInstr(sum, LDRInstr(io, 0, a));
+        RegId z = builder.addReg(0, wordType);
+        builder.addProcInstr(sum, PUSHInstr(z));
+        builder.addProcInstr(sum, LDEInstr(a, i, v));
+        builder.addProcInstr(sum, ADDInstr(s, v, s));
+        builder.addProcInstr(sum, INCInstr(i));
+        builder.addProcInstr(sum, JNGInstr(i, h, -3));
+        builder.addProcInstr(sum, LDEInstr(a, h, v));
+        builder.addProcInstr(sum, ADDInstr(s, v, s));
+        builder.addProcInstr(sum, DECInstr(h));
+        builder.addProcInstr(sum, JNGInstr(z, h, -3));
+        builder.addProcInstr(sum, STBInstr(s, io, 8));
+        builder.addProcInstr(sum, POPInstr());
+        builder.addProcInstr(sum, POPInstr());
+        builder.addProcInstr(sum, POPInstr());
+        builder.addProcInstr(sum, POPInstr());
+        builder.addProcInstr(sum, POPInstr());
+        builder.addProcInstr(sum, POPInstr());
+        builder.addProcInstr(sum, RETInstr());
+
+        builder.createModule(module);
+      }
+
       void createEHTestModule(Module &module) {
         ModuleBuilder builder;
 
@@ -1,5 +1,8 @@
 #include <sstream>
+#include <string.h>
+#include <vector>
 
+#include "../../exception.h"
 #include "../../string.h"
 #include "../../test/test.h"
 #include "../util.h"
@@ -76,6 +79,130 @@ namespace {
     return printTestResult(subj, "mbInts", passed);
   }
 
+  bool testMBBuffers() {
+    uint8_t buf[MB_SIZE_MAX], sbuf[MB_SIZE_MAX];
+    uint64_t uval;
+    int64_t val;
+    bool passed = true;
+
+    try {
+      for(int i = 1; passed && i <= 9; i++) {
+        uint64_t uvals[] = { MB_UINT_MAX(i), MB_UINT_MAX(i) + 1 };
+        int64_t vals[] = { MB_INT_MAX(i), MB_INT_MIN(i), 0, 0 };
+        if(i < 9)
+          vals[2] = MB_INT_MAX(i) + 1, vals[3] = MB_INT_MIN(i) - 1;
+
+        for(int j = 0; passed && j < (i < 9 ? 2 : 1); j++) {
+          stringstream io;
+          size_t size = writeMBUInt(uvals[j], buf);
+          passed = writeMBUInt(uvals[j], io) == size;
+          io.read(reinterpret_cast<char*>(sbuf), size);
+          passed = passed && !memcmp(buf, sbuf, size);
+          passed = passed && readMBUInt(buf, buf + size, uval) == size;
+          passed = passed && uval == uvals[j];
+          ASSERT_THROW({readMBUInt(buf, buf + size - 1, uval);},
+                       EndOfFileException);
+        }
+
+        for(int j = 0; passed && j < (i < 9 ? 4 : 2); j++) {
+          stringstream io;
+          size_t size = writeMBInt(vals[j], buf);
+          passed = writeMBInt(vals[j], io) == size;
+          io.read(reinterpret_cast<char*>(sbuf), size);
+          passed = passed && !memcmp(buf, sbuf, size);
+          passed = passed && readMBInt(buf, buf + size, val) == size;
+          passed = passed && val == vals[j];
+        }
+      }
+    }
+    catch(...) { passed = false; }
+
+    return printTestResult(subj, "mbBuffers", passed);
+  }
+
+  // every value must come back from the fewest bytes that can hold it
+  bool checkMBInt(int64_t value) {
+    uint8_t buf[MB_SIZE_MAX];
+    int64_t val;
+
+    size_t size = writeMBInt(value, buf);
+    if(readMBInt(buf, buf + size, val) != size || val != value)
+      return false;
+
+    return size == 1 ||
+      value < MB_INT_MIN(size - 1) || value > MB_INT_MAX(size - 1);
+  }
+
+  bool testMBSigned() {
+    bool passed = true;
+
+    try {
+      for(int64_t v = -(int64_t(1) << 24); passed && v <= 1 << 24; v++)
+        passed = checkMBInt(v);
+
+      for(int i = 0; passed && i < 64; i++) {
+        int64_t pow = int64_t(uint64_t(1) << i);
+        for(int64_t d = -2; passed && d <= 2; d++)
+          passed = checkMBInt(pow + d) && checkMBInt(-pow + d);
+      }
+
+      uint64_t seed = 0x9E3779B97F4A7C15LLU;
+      for(int i = 0; passed && i < 1 << 20; i++) {
+        seed = seed * 6364136223846793005LLU + 1442695040888963407LLU;
+        passed = checkMBInt(int64_t(seed) >> (seed & 63));
+      }
+    }
+    catch(...) { passed = false; }
+
+    return printTestResult(subj, "mbSigned", passed);
+  }
+
+  bool testInstrScan() {
+    uint8_t paramCounts[256];
+    memset(paramCounts, MB_SCAN_BAD_OPCODE, sizeof(paramCounts));
+    paramCounts[1] = 0, paramCounts[2] = 1, paramCounts[3] = 3;
+
+    vector<uint8_t> code;
+    vector<size_t> offsets, expected;
+    bool passed = true;
+
+    try {
+      for(int i = 0, k = 0; i < 200; i++) {
+        uint8_t op = uint8_t(1 + i % 3);
+        expected.push_back(code.size());
+        code.push_back(op);
+
+        for(int j = 0; j < paramCounts[op]; j++, k++) {
+          uint8_t buf[MB_SIZE_MAX];
+          size_t size = writeMBUInt(MB_UINT_MAX(1 + k % 9), buf);
+          code.insert(code.end(), buf, buf + size);
+        }
+      }
+
+      vector<uint64_t> bits((code.size() + 63) / 64), sbits(bits.size());
+      markMBEnds(&code[0], code.size(), &bits[0]);
+      markMBEndsScalar(&code[0], code.size(), &sbits[0]);
+      passed = bits == sbits;
+
+      scanInstrOffsets(&code[0], code.size(), paramCounts, offsets);
+      passed = passed && offsets == expected;
+
+      offsets.clear();
+      ASSERT_THROW({scanInstrOffsets(&code[0], code.size() - 1, paramCounts,
+                                     offsets);}, EndOfFileException);
+      passed = passed && offsets.back() == expected.back();
+
+      offsets.clear();
+      code[expected[7]] = 0;
+      ASSERT_THROW({scanInstrOffsets(&code[0], code.size(), paramCounts,
+                                     offsets);}, EncodingException);
+      passed = passed && offsets.size() == 8;
+    }
+    catch(...) { passed = false; }
+
+    return printTestResult(subj, "instrScan", passed);
+  }
+
 }
 
 namespace Ant {
@@ -87,6 +214,9 @@ namespace Ant {
 
         passed = testMBUInts();
         passed = passed && testMBInts();
+        passed = passed && testMBBuffers();
+        passed = passed && testMBSigned();
+        passed = passed && testInstrScan();
 
         return passed;
       }
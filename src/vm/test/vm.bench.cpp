@@ -0,0 +1,149 @@
+#include <algorithm>
+#include <ctime>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+#include "../../string.h"
+#include "../instr.h"
+#include "../module.h"
+#include "vm.test.h"
+
+namespace {
+
+  using namespace std;
+  using namespace Ant;
+  using namespace Ant::VM;
+  using namespace Ant::VM::Test;
+
+  void printBenchResult(const String subj, const String test, clock_t ticks,
+                        size_t runs) {
+    static const int LINE_WIDTH = 80;
+    double ns = 1e9 * ticks / CLOCKS_PER_SEC / runs;
+    int c = LINE_WIDTH - subj.size() - test.size() - 4;
+    cout << subj << " (" << test << ")" << setfill('.');
+    cout << setw(c) << fixed << setprecision(1) << ns << " ns" << endl;
+  }
+
+#define BENCH_INSTR_COUNT 100000
+
+  void createBenchCode(vector<VMCodeByte> &code) {
+    const Instr instrs[] = {
+      LDBInstr(1, 300, 2), CPI8Instr(1, 3), JNGInstr(1, 2, -9),
+      ADDInstr(1, 2, 3), INCInstr(200), STEInstr(1, 2, 3), POPInstr(),
+      CPI1Instr(7, 4), LDEInstr(40000, 2, 3), CALLInstr(12) };
+    const size_t count = sizeof(instrs) / sizeof(instrs[0]);
+
+    for(size_t i = 0; i < BENCH_INSTR_COUNT; i++) {
+      const Instr &instr = instrs[i % count];
+      code.insert(code.end(), instr.data(), instr.data() + instr.size());
+    }
+  }
+
+  void benchInstrScan() {
+    vector<VMCodeByte> code;
+    vector<size_t> offsets;
+    const size_t runs = 100;
+
+    createBenchCode(code);
+    offsets.reserve(BENCH_INSTR_COUNT);
+
+    clock_t start = clock();
+    for(size_t r = 0; r < runs; r++) {
+      offsets.clear();
+      Instr instr;
+      for(size_t k = 0; k < code.size(); k += instr.size()) {
+        instr.set(&code[k]);
+        offsets.push_back(k);
+      }
+    }
+    printBenchResult("Ant::VM::Instr", "instrSize", clock() - start, runs);
+
+    start = clock();
+    for(size_t r = 0; r < runs; r++) {
+      offsets.clear();
+      Instr::scanOffsets(&code[0], code.size(), offsets);
+    }
+    printBenchResult("Ant::VM::Instr", "scanOffsets", clock() - start, runs);
+  }
+
+#define BENCH_QSORT_ARR_COUNT 10000
+
+  void benchQSort() {
+    static const char *tests[OPT_LEVEL_COUNT] = {
+      "qsortO0", "qsortO1", "qsortO2", "qsortO3" };
+    static SVContainer<8, 0, 0, BENCH_QSORT_ARR_COUNT, true, true> a;
+    vector<int64_t> in(BENCH_QSORT_ARR_COUNT);
+    SVariable<16, 1, 0> io;
+    const size_t runs = 20;
+
+    for(size_t i = 0, x = 1; i < in.size(); i++)
+      in[i] = int64_t(x = x * 1103515245 + 12345) >> 8;
+
+    for(int level = OPT_O0; level < OPT_LEVEL_COUNT; level++) {
+      Module module;
+      createQSortModule(module);
+      module.unpack(OptLevel(level));
+
+      clock_t ticks = 0;
+      for(size_t r = 0; r < runs; r++) {
+        uint64_t *bounds = reinterpret_cast<uint64_t*>(io.elts[0].bytes);
+        bounds[0] = 0, bounds[1] = BENCH_QSORT_ARR_COUNT - 1;
+        a.refCount = 1, a.eltCount = BENCH_QSORT_ARR_COUNT;
+        io.elts[0].vrefs[0] = &a.var;
+        copy(in.begin(), in.end(),
+             reinterpret_cast<int64_t*>(a.var.elts[0].bytes));
+
+        clock_t start = clock();
+        module.callProc(1, io);
+        ticks += clock() - start;
+      }
+
+      module.drop();
+      printBenchResult("Ant::VM::Runtime::ModuleData", tests[level], ticks,
+                       runs);
+    }
+  }
+
+  void benchProcHandle() {
+    SVariable<8, 0, 0> io;
+    uint64_t &val = *reinterpret_cast<uint64_t*>(io.elts[0].bytes);
+    const size_t runs = 1000000;
+    Module module;
+
+    createFactorialModule(module);
+    module.unpack();
+
+    clock_t start = clock();
+    for(size_t r = 0; r < runs; r++) {
+      val = 1;
+      module.callProc(0, io);
+    }
+    printBenchResult("Ant::VM::Module", "callProc", clock() - start, runs);
+
+    ProcHandle handle = module.procHandle(0);
+    start = clock();
+    for(size_t r = 0; r < runs; r++) {
+      val = 1;
+      handle(io);
+    }
+    printBenchResult("Ant::VM::Module", "procHandle", clock() - start, runs);
+
+    module.drop();
+  }
+
+}
+
+namespace Ant {
+  namespace VM {
+    namespace Test {
+
+      void benchVM() {
+        benchInstrScan();
+        benchQSort();
+        benchProcHandle();
+      }
+
+    }
+  }
+}
@@ -7,15 +7,33 @@ namespace Ant {
   namespace VM {
     namespace Test {
 
+      const size_t ARRAY_ARR_COUNT = 7; // elements processed by array module
+      const size_t REFS_COUNT = 20; // references held by refs module frame
+      const size_t LOOP_ARR_COUNT = 16; // elements of frame pushed in a loop
+      const size_t DIRTY_ARR_COUNT = 64; // elements filled to dirty the stack
+      const size_t RANGE_ARR_COUNT = 10; // elements summed by range loops
+
       void createFactorialModule(Module &module);
       void createQSortModule(Module &module);
       void createEHTestModule(Module &module);
+      void createCountModule(Module &module);
+      void createArrayModule(Module &module);
+      void createDivModule(Module &module);
+      void createImmModule(Module &module);
+      void createCheckModule(Module &module);
+      void createRefsModule(Module &module);
+      void createFrameLoopModule(Module &module);
+      void createPartialWriteModule(Module &module);
+      void createReplaceRefModule(Module &module);
+      void createRangeLoopModule(Module &module);
 
       bool testUtil();
       bool testModuleBuilder();
       bool testModuleData();
 
       bool testVM();
+
+      void benchVM();
     }
   }
 }
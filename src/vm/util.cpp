@@ -1,5 +1,12 @@
+#include <algorithm>
 #include <cstdio>
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #include "../exception.h"
 #include "util.h"
 
@@ -7,28 +14,54 @@ namespace {
 
   using namespace Ant;
 
-  size_t writeMBUIntEx(uint64_t value, std::ostream &out, bool extend) {
-    uint8_t byte;
+  void writeBytes(const uint8_t *buf, size_t size, std::ostream &out) {
+    out.write(reinterpret_cast<const char*>(buf), size);
+
+    if(out.bad())
+      throw IOException();
+  }
+
+  size_t readBytes(std::istream &in, uint8_t *buf) {
     size_t size = 0;
+    int chr;
 
     do {
-      bool last = ++size == 9;
-
-      if(last)
-        extend = false;
+      chr = in.get();
+      if(chr == EOF)
+        throw EndOfFileException();
+      if(in.bad())
+        throw IOException();
 
-      byte = value & (last ? 0xFF : 0x7F);
+      buf[size++] = uint8_t(chr);
+    }
+    while((chr & 0x80) && size < MB_SIZE_MAX);
 
-      if((value >>= (last ? 8 : 7)) || extend)
-        out.put(byte | 0x80);
-      else out.put(byte);
+    return size;
+  }
 
-      if(out.bad())
-        throw IOException();
+  inline uint64_t markMBEnds64(const uint8_t *in) {
+#if defined(__AVX2__)
+    __m256i lo = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in));
+    __m256i hi = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + 32));
+    return ~(uint64_t(uint32_t(_mm256_movemask_epi8(lo)))
+             | uint64_t(uint32_t(_mm256_movemask_epi8(hi))) << 32);
+#elif defined(__SSE2__)
+    uint64_t mask = 0;
+    for(int i = 0; i < 4; i++) {
+      __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + 16 * i));
+      mask |= uint64_t(uint16_t(_mm_movemask_epi8(v))) << (16 * i);
     }
-    while(value);
+    return ~mask;
+#else
+    uint64_t mask = 0;
+    for(int i = 0; i < 64; i++)
+      mask |= uint64_t(~in[i] >> 7 & 1) << i;
+    return mask;
+#endif
+  }
 
-    return size;
+  inline int lowestBit(uint64_t word) {
+    return __builtin_ctzll(word);
   }
 
 }
@@ -41,80 +74,126 @@ namespace Ant {
       0x1FFFFFFFFFFFFLLU, 0xFFFFFFFFFFFFFFLLU, 0xFFFFFFFFFFFFFFFFLLU
     };
 
-    size_t writeMBUInt(uint64_t value, std::ostream &out) {
-      return writeMBUIntEx(value, out, false);
-    }
-
-    size_t readMBUInt(std::istream &in, uint64_t &value) { 
-      uint64_t tmp, val = 0;
+    size_t writeMBUInt(uint64_t value, uint8_t *out) {
+      uint8_t byte;
       size_t size = 0;
-      int chr;
 
-      for(;;) {
-        chr = in.get();
-        if(chr == EOF)
-          throw EndOfFileException();
-        if(in.bad())
-          throw IOException();
+      do {
+        bool last = ++size == 9;
+        byte = value & (last ? 0xFF : 0x7F);
 
-        bool last = size == 8;
+        if(value >>= (last ? 8 : 7))
+          *out++ = byte | 0x80;
+        else *out++ = byte;
+      }
+      while(value);
 
-        tmp = last ? chr : (chr & 0x7F);
-        tmp <<= 7 * size++;
-        val |= tmp;
+      return size;
+    }
 
-        if(last || !(chr & 0x80))
-          break;
-      };
+    // Value is written in the fewest bytes readMBInt() sign-extends back
+    // to it: 7 bits per byte, all 8 bits of the ninth one
+    size_t writeMBInt(int64_t value, uint8_t *out) {
+      size_t size = 1;
+      while(size < MB_SIZE_MAX &&
+            (value < MB_INT_MIN(size) || value > MB_INT_MAX(size)))
+        size++;
+
+      uint64_t bits = uint64_t(value);
+      for(size_t i = 0; i < size; i++) {
+        uint8_t byte = i == 8 ? uint8_t(bits >> 56) : (bits >> 7 * i) & 0x7F;
+        out[i] = i + 1 < size ? byte | 0x80 : byte;
+      }
 
-      value = val;
       return size;
     }
 
-    size_t writeMBInt(int64_t value, std::ostream &out) {
-      bool neg = value < 0;
-      bool extend = false;
-      uint8_t extention;
-
-      uint8_t byte = uint8_t(value >> 56);
-      if(!byte || byte == 0xFF)
-        for(int i = 49; i >= 0; i -= 7) {
-          byte = uint8_t(value >> i) & 0x7F;
-
-          if(!i || (neg ? (byte != 0x7F) : byte)) {
-            bool hbit = byte & 0x40;
-            if(neg && !hbit)
-              extend = true, extention = (i == 49) ? 0xFF : 0x7F;
-            else if(!neg && hbit)
-              extend = true, extention = 0;
-
-            value &= uint64_t(-1) >> (57 - i);
-            break;
-          }
-        }
+    void markMBEnds(const uint8_t *in, size_t size, uint64_t *bits) {
+      size_t words = size / 64;
+
+      for(size_t i = 0; i < words; i++)
+        bits[i] = markMBEnds64(in + 64 * i);
+
+      if(size % 64)
+        markMBEndsScalar(in + 64 * words, size % 64, bits + words);
+    }
 
-      size_t size = writeMBUIntEx(uint64_t(value), out, extend);
-      if(extend) {
-        out.put(extention);
+    void markMBEndsScalar(const uint8_t *in, size_t size, uint64_t *bits) {
+      for(size_t i = 0; i < size; i += 64) {
+        uint64_t mask = 0;
 
-        if(out.bad())
-          throw IOException();
+        for(size_t j = 0, n = std::min(size - i, size_t(64)); j < n; j++)
+          mask |= uint64_t(~in[i + j] >> 7 & 1) << j;
+
+        bits[i / 64] = mask;
       }
+    }
 
-      return size + size_t(extend);
+    void scanInstrOffsets(const uint8_t *code, size_t size,
+                          const uint8_t paramCounts[256],
+                          std::vector<size_t> &offsets) {
+      std::vector<uint64_t> bits((size + 63) / 64);
+      if(size)
+        markMBEnds(code, size, &bits[0]);
+
+      for(size_t pos = 0; pos < size;) {
+        offsets.push_back(pos);
+
+        uint8_t count = paramCounts[code[pos++]];
+        if(count == MB_SCAN_BAD_OPCODE)
+          throw EncodingException();
+
+        for(uint8_t i = 0; i < count; i++) {
+          if(pos == size)
+            throw EndOfFileException();
+
+          // an MB integer ends at the first byte with clear high bit, but
+          // spans MB_SIZE_MAX bytes at most
+          size_t word = pos / 64;
+          uint64_t ends = bits[word] >> (pos % 64);
+          size_t length;
+
+          if(ends)
+            length = lowestBit(ends) + 1;
+          else if(++word < bits.size() && bits[word])
+            length = 64 * word + lowestBit(bits[word]) - pos + 1;
+          else length = MB_SIZE_MAX;
+
+          if(length > MB_SIZE_MAX)
+            length = MB_SIZE_MAX;
+          if(length > size - pos)
+            throw EndOfFileException();
+
+          pos += length;
+        }
+      }
     }
 
-    size_t readMBInt(std::istream &in, int64_t &value) {
-      uint64_t val;
-      size_t size = readMBUInt(in, val);
+    size_t writeMBUInt(uint64_t value, std::ostream &out) {
+      uint8_t buf[MB_SIZE_MAX];
+      size_t size = writeMBUInt(value, buf);
+      writeBytes(buf, size, out);
+      return size;
+    }
 
-      int offset = 7 * size;
-      if(size < 9 && (val >> (offset - 1)) & 1)
-        val |= uint64_t(-1) << offset; 
+    size_t readMBUInt(std::istream &in, uint64_t &value) {
+      uint8_t buf[MB_SIZE_MAX];
+      size_t size = readBytes(in, buf);
+      return readMBUInt(buf, buf + size, value);
+    }
 
-      value = int64_t(val);
+    size_t writeMBInt(int64_t value, std::ostream &out) {
+      uint8_t buf[MB_SIZE_MAX];
+      size_t size = writeMBInt(value, buf);
+      writeBytes(buf, size, out);
       return size;
     }
 
+    size_t readMBInt(std::istream &in, int64_t &value) {
+      uint8_t buf[MB_SIZE_MAX];
+      size_t size = readBytes(in, buf);
+      return readMBInt(buf, buf + size, value);
+    }
+
   }
 }
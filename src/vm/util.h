@@ -5,6 +5,9 @@
 #include <istream>
 #include <ostream>
 #include <stdint.h>
+#include <vector>
+
+#include "../exception.h"
 
 namespace Ant {
   namespace VM {
@@ -15,6 +18,79 @@ namespace Ant {
 #define MB_INT_MAX(size) int64_t(MB_MASKS[(size) - 1] >> 1)
 #define MB_INT_MIN(size) (-int64_t(MB_MASKS[(size) - 1] >> 1) - 1)
 
+#define MB_SIZE_MAX 9
+
+    // buffer variants: 'out' must have room for MB_SIZE_MAX bytes
+    size_t writeMBUInt(uint64_t value, uint8_t *out);
+    size_t writeMBInt(int64_t value, uint8_t *out);
+
+    inline size_t skipMB(const uint8_t *in, const uint8_t *end) {
+      size_t size = 0;
+
+      do {
+        if(in + size == end)
+          throw EndOfFileException();
+      }
+      while((in[size++] & 0x80) && size < MB_SIZE_MAX);
+
+      return size;
+    }
+
+    inline size_t readMBUInt(const uint8_t *in, const uint8_t *end,
+                             uint64_t &value) {
+      if(in == end)
+        throw EndOfFileException();
+
+      uint64_t byte = *in;
+      if(!(byte & 0x80)) { // most of operands are one byte long
+        value = byte;
+        return 1;
+      }
+
+      uint64_t val = byte & 0x7F;
+      size_t size = 1;
+
+      do {
+        if(in + size == end)
+          throw EndOfFileException();
+
+        byte = in[size];
+        val |= (size == 8 ? byte : (byte & 0x7F)) << (7 * size);
+      }
+      while((byte & 0x80) && ++size < 9);
+
+      value = val;
+      return size + (size < 9);
+    }
+
+    inline size_t readMBInt(const uint8_t *in, const uint8_t *end,
+                            int64_t &value) {
+      uint64_t val;
+      size_t size = readMBUInt(in, end, val);
+
+      int offset = 7 * size;
+      if(size < 9 && (val >> (offset - 1)) & 1)
+        val |= uint64_t(-1) << offset;
+
+      value = int64_t(val);
+      return size;
+    }
+
+    // sets bit i of 'bits' if byte i of 'in' ends an MB integer (its high
+    // bit is clear), 'bits' must have room for (size + 63) / 64 words
+    void markMBEnds(const uint8_t *in, size_t size, uint64_t *bits);
+    void markMBEndsScalar(const uint8_t *in, size_t size, uint64_t *bits);
+
+    const uint8_t MB_SCAN_BAD_OPCODE = 0xFF;
+
+    // appends offsets of instructions found in 'code', which is a sequence
+    // of opcode bytes each followed by paramCounts[opcode] MB integers,
+    // MB_SCAN_BAD_OPCODE marks opcodes which must not occur; on error the
+    // last appended offset is the one of the offending instruction
+    void scanInstrOffsets(const uint8_t *code, size_t size,
+                          const uint8_t paramCounts[256],
+                          std::vector<size_t> &offsets);
+
     size_t writeMBUInt(uint64_t value, std::ostream &out);
     size_t readMBUInt(std::istream &in, uint64_t &value);
     size_t writeMBInt(int64_t value, std::ostream &out);
@@ -17,6 +17,7 @@ namespace Ant {
     const uint32_t MODULE_PROCS_MAX = MB_UINT_MAX(2);
 
     const size_t PROC_INSTR_MAX = MB_UINT_MAX(4);
+    const size_t INSTR_PARAMS_MAX = 3;
 
     const ptrdiff_t INSTR_OFFSET_MIN = MB_INT_MIN(1);
     const ptrdiff_t INSTR_OFFSET_MAX = MB_INT_MAX(1);
@@ -48,6 +49,8 @@ namespace Ant {
 
     struct Variable {};
 
+    typedef void (*NativeProc)(Variable &io);
+
     template<uint32_t Bytes> struct SVPartBytes { uint8_t bytes[Bytes]; };
     template<> struct SVPartBytes<0> {};
 
@@ -119,6 +122,35 @@ namespace Ant {
       std::vector<VMCodeByte> code;
     };
 
+    enum OptLevel {
+      OPT_O0 = 0, // no optimization
+      OPT_O1, // register promotion and local cleanups
+      OPT_O2, // global redundancy and loop optimizations
+      OPT_O3, // aggressive loop and interprocedural optimizations
+      OPT_LEVEL_COUNT // not a level, must be the last
+    };
+
+    enum UnpackFlag {
+      UFLAG_LAZY = 0x1, // procedures are compiled when first called
+      UFLAG_INTERPRET = 0x2, // procedures are interpreted, nothing compiled
+      UFLAG_TIERED = 0x4, // procedures are interpreted until they get hot
+      UFLAG_FIRST_RESERVED = 0x8
+    };
+
+    enum ProcTier {
+      TIER_INTERPRETED = 0, // run by the interpreter
+      TIER_BASELINE, // compiled with local optimizations only
+      TIER_OPTIMIZED, // compiled at the optimization level of the module
+      TIER_COUNT // not a tier, must be the last
+    };
+
+    enum InlineDecision {
+      INLINE_DONE = 0, // callee has been inlined at the call
+      INLINE_RECURSIVE, // callee may call the caller again
+      INLINE_OVER_BUDGET, // callee is larger than the inlining budget
+      INLINE_REFUSED // code generator could not inline the callee
+    };
+
     enum FrameType { FT_HAND, FT_REGNR, FT_REGR, FT_REG }; // for internal use
 
     struct VarTypeData { // for internal use
@@ -128,12 +160,6 @@ namespace Ant {
       FixedArray<ProcTypeId> prefs;
     };
 
-    struct ProcData { // for internal use
-      uint32_t flags;
-      ProcTypeId ptype;
-      FixedArray<VMCodeByte> code;
-    };
-
     enum OpCode {
       OPCODE_ILL = 0, // ILLegal
       OPCODE_INC, // INCrement
@@ -163,17 +189,164 @@ namespace Ant {
       OPCODE_STR, // STore structure Reference
       OPCODE_CALL, // CALL procedure
       OPCODE_THROW, // THROW exception
-      OPCODE_RET // RETurn
+      OPCODE_RET, // RETurn
+      OPCODE_AADD, // Array ADD
+      OPCODE_ASUB, // Array SUBtract
+      OPCODE_AMUL, // Array MULtiply
+      OPCODE_AMIN, // Array MINimum
+      OPCODE_AMAX, // Array MAXimum
+      OPCODE_ACMPE, // Array CoMPare if Equal
+      OPCODE_ACMPG, // Array CoMPare if Greater
+      OPCODE_ARSUM, // Array Reduction to SUM
+      OPCODE_ARMIN, // Array Reduction to MINimum
+      OPCODE_ARMAX, // Array Reduction to MAXimum
+      OPCODE_AFILL, // Array FILL
+      OPCODE_ADD1, // ADD (1-byte)
+      OPCODE_ADD2, // ADD (2-bytes)
+      OPCODE_ADD4, // ADD (4-bytes)
+      OPCODE_SUB1, // SUBtract (1-byte)
+      OPCODE_SUB2, // SUBtract (2-bytes)
+      OPCODE_SUB4, // SUBtract (4-bytes)
+      OPCODE_MUL1, // MULtiply (1-byte)
+      OPCODE_MUL2, // MULtiply (2-bytes)
+      OPCODE_MUL4, // MULtiply (4-bytes)
+      OPCODE_SDIV1, // Signed DIVide (1-byte)
+      OPCODE_SDIV2, // Signed DIVide (2-bytes)
+      OPCODE_SDIV4, // Signed DIVide (4-bytes)
+      OPCODE_SDIV8, // Signed DIVide (8-bytes)
+      OPCODE_UDIV1, // Unsigned DIVide (1-byte)
+      OPCODE_UDIV2, // Unsigned DIVide (2-bytes)
+      OPCODE_UDIV4, // Unsigned DIVide (4-bytes)
+      OPCODE_UDIV8, // Unsigned DIVide (8-bytes)
+      OPCODE_SREM1, // Signed REMainder (1-byte)
+      OPCODE_SREM2, // Signed REMainder (2-bytes)
+      OPCODE_SREM4, // Signed REMainder (4-bytes)
+      OPCODE_SREM8, // Signed REMainder (8-bytes)
+      OPCODE_UREM1, // Unsigned REMainder (1-byte)
+      OPCODE_UREM2, // Unsigned REMainder (2-bytes)
+      OPCODE_UREM4, // Unsigned REMainder (4-bytes)
+      OPCODE_UREM8, // Unsigned REMainder (8-bytes)
+      OPCODE_SHL1, // SHift Left (1-byte)
+      OPCODE_SHL2, // SHift Left (2-bytes)
+      OPCODE_SHL4, // SHift Left (4-bytes)
+      OPCODE_SHL8, // SHift Left (8-bytes)
+      OPCODE_SHR1, // SHift Right (1-byte)
+      OPCODE_SHR2, // SHift Right (2-bytes)
+      OPCODE_SHR4, // SHift Right (4-bytes)
+      OPCODE_SHR8, // SHift Right (8-bytes)
+      OPCODE_SAR1, // Shift Arithmetic Right (1-byte)
+      OPCODE_SAR2, // Shift Arithmetic Right (2-bytes)
+      OPCODE_SAR4, // Shift Arithmetic Right (4-bytes)
+      OPCODE_SAR8, // Shift Arithmetic Right (8-bytes)
+      OPCODE_AND1, // bitwise AND (1-byte)
+      OPCODE_AND2, // bitwise AND (2-bytes)
+      OPCODE_AND4, // bitwise AND (4-bytes)
+      OPCODE_AND8, // bitwise AND (8-bytes)
+      OPCODE_OR1, // bitwise OR (1-byte)
+      OPCODE_OR2, // bitwise OR (2-bytes)
+      OPCODE_OR4, // bitwise OR (4-bytes)
+      OPCODE_OR8, // bitwise OR (8-bytes)
+      OPCODE_XOR1, // bitwise eXclusive OR (1-byte)
+      OPCODE_XOR2, // bitwise eXclusive OR (2-bytes)
+      OPCODE_XOR4, // bitwise eXclusive OR (4-bytes)
+      OPCODE_XOR8, // bitwise eXclusive OR (8-bytes)
+      OPCODE_FADD4, // Floating-point ADD (4-bytes)
+      OPCODE_FADD8, // Floating-point ADD (8-bytes)
+      OPCODE_FSUB4, // Floating-point SUBtract (4-bytes)
+      OPCODE_FSUB8, // Floating-point SUBtract (8-bytes)
+      OPCODE_FMUL4, // Floating-point MULtiply (4-bytes)
+      OPCODE_FMUL8, // Floating-point MULtiply (8-bytes)
+      OPCODE_FDIV4, // Floating-point DIVide (4-bytes)
+      OPCODE_FDIV8, // Floating-point DIVide (8-bytes)
+      OPCODE_JEI, // Jump if Equal to Immediate
+      OPCODE_JGI, // Jump if Greater than Immediate
+      OPCODE_JNGI, // Jump if Not Greater than Immediate
+      OPCODE_ADDI, // ADD Immediate
+      OPCODE_SUBI, // SUBtract Immediate
+      OPCODE_MULI, // MULtiply by Immediate
+      OPCODE_COUNT // not an opcode, must be the last
+    };
+
+    struct InstrData { // for internal use
+      OpCode opcode;
+      uint64_t params[INSTR_PARAMS_MAX]; // signed ones are two's complement
+      size_t offset; // of instruction code within procedure code
+      bool branches;
+      size_t branchIndex;
+    };
+
+    struct ProcData { // for internal use
+      uint32_t flags;
+      ProcTypeId ptype;
+      FixedArray<VMCodeByte> code;
+      FixedArray<InstrData> instrs;
     };
 
     template<uint8_t> class UOInstrT;
     typedef UOInstrT<OPCODE_INC> INCInstr;
     typedef UOInstrT<OPCODE_DEC> DECInstr;
 
-    template<uint8_t> class BOInstrT;
+    template<uint8_t, class = uint64_t> class BOInstrT;
     typedef BOInstrT<OPCODE_ADD> ADDInstr;
     typedef BOInstrT<OPCODE_SUB> SUBInstr;
     typedef BOInstrT<OPCODE_MUL> MULInstr;
+    typedef BOInstrT<OPCODE_ADD1, uint8_t> ADD1Instr;
+    typedef BOInstrT<OPCODE_ADD2, uint16_t> ADD2Instr;
+    typedef BOInstrT<OPCODE_ADD4, uint32_t> ADD4Instr;
+    typedef BOInstrT<OPCODE_SUB1, uint8_t> SUB1Instr;
+    typedef BOInstrT<OPCODE_SUB2, uint16_t> SUB2Instr;
+    typedef BOInstrT<OPCODE_SUB4, uint32_t> SUB4Instr;
+    typedef BOInstrT<OPCODE_MUL1, uint8_t> MUL1Instr;
+    typedef BOInstrT<OPCODE_MUL2, uint16_t> MUL2Instr;
+    typedef BOInstrT<OPCODE_MUL4, uint32_t> MUL4Instr;
+    typedef BOInstrT<OPCODE_SDIV1, int8_t> SDIV1Instr;
+    typedef BOInstrT<OPCODE_SDIV2, int16_t> SDIV2Instr;
+    typedef BOInstrT<OPCODE_SDIV4, int32_t> SDIV4Instr;
+    typedef BOInstrT<OPCODE_SDIV8, int64_t> SDIV8Instr;
+    typedef BOInstrT<OPCODE_UDIV1, uint8_t> UDIV1Instr;
+    typedef BOInstrT<OPCODE_UDIV2, uint16_t> UDIV2Instr;
+    typedef BOInstrT<OPCODE_UDIV4, uint32_t> UDIV4Instr;
+    typedef BOInstrT<OPCODE_UDIV8, uint64_t> UDIV8Instr;
+    typedef BOInstrT<OPCODE_SREM1, int8_t> SREM1Instr;
+    typedef BOInstrT<OPCODE_SREM2, int16_t> SREM2Instr;
+    typedef BOInstrT<OPCODE_SREM4, int32_t> SREM4Instr;
+    typedef BOInstrT<OPCODE_SREM8, int64_t> SREM8Instr;
+    typedef BOInstrT<OPCODE_UREM1, uint8_t> UREM1Instr;
+    typedef BOInstrT<OPCODE_UREM2, uint16_t> UREM2Instr;
+    typedef BOInstrT<OPCODE_UREM4, uint32_t> UREM4Instr;
+    typedef BOInstrT<OPCODE_UREM8, uint64_t> UREM8Instr;
+    typedef BOInstrT<OPCODE_SHL1, uint8_t> SHL1Instr;
+    typedef BOInstrT<OPCODE_SHL2, uint16_t> SHL2Instr;
+    typedef BOInstrT<OPCODE_SHL4, uint32_t> SHL4Instr;
+    typedef BOInstrT<OPCODE_SHL8, uint64_t> SHL8Instr;
+    typedef BOInstrT<OPCODE_SHR1, uint8_t> SHR1Instr;
+    typedef BOInstrT<OPCODE_SHR2, uint16_t> SHR2Instr;
+    typedef BOInstrT<OPCODE_SHR4, uint32_t> SHR4Instr;
+    typedef BOInstrT<OPCODE_SHR8, uint64_t> SHR8Instr;
+    typedef BOInstrT<OPCODE_SAR1, int8_t> SAR1Instr;
+    typedef BOInstrT<OPCODE_SAR2, int16_t> SAR2Instr;
+    typedef BOInstrT<OPCODE_SAR4, int32_t> SAR4Instr;
+    typedef BOInstrT<OPCODE_SAR8, int64_t> SAR8Instr;
+    typedef BOInstrT<OPCODE_AND1, uint8_t> AND1Instr;
+    typedef BOInstrT<OPCODE_AND2, uint16_t> AND2Instr;
+    typedef BOInstrT<OPCODE_AND4, uint32_t> AND4Instr;
+    typedef BOInstrT<OPCODE_AND8, uint64_t> AND8Instr;
+    typedef BOInstrT<OPCODE_OR1, uint8_t> OR1Instr;
+    typedef BOInstrT<OPCODE_OR2, uint16_t> OR2Instr;
+    typedef BOInstrT<OPCODE_OR4, uint32_t> OR4Instr;
+    typedef BOInstrT<OPCODE_OR8, uint64_t> OR8Instr;
+    typedef BOInstrT<OPCODE_XOR1, uint8_t> XOR1Instr;
+    typedef BOInstrT<OPCODE_XOR2, uint16_t> XOR2Instr;
+    typedef BOInstrT<OPCODE_XOR4, uint32_t> XOR4Instr;
+    typedef BOInstrT<OPCODE_XOR8, uint64_t> XOR8Instr;
+    typedef BOInstrT<OPCODE_FADD4, float> FADD4Instr;
+    typedef BOInstrT<OPCODE_FADD8, double> FADD8Instr;
+    typedef BOInstrT<OPCODE_FSUB4, float> FSUB4Instr;
+    typedef BOInstrT<OPCODE_FSUB8, double> FSUB8Instr;
+    typedef BOInstrT<OPCODE_FMUL4, float> FMUL4Instr;
+    typedef BOInstrT<OPCODE_FMUL8, double> FMUL8Instr;
+    typedef BOInstrT<OPCODE_FDIV4, float> FDIV4Instr;
+    typedef BOInstrT<OPCODE_FDIV8, double> FDIV8Instr;
 
     template<uint8_t> class UJInstrT;
     typedef UJInstrT<OPCODE_JNZ> JNZInstr;
@@ -183,6 +356,16 @@ namespace Ant {
     typedef BJInstrT<OPCODE_JNG> JNGInstr;
     typedef BJInstrT<OPCODE_JE> JEInstr;
 
+    template<uint8_t> class BJIInstrT;
+    typedef BJIInstrT<OPCODE_JEI> JEIInstr;
+    typedef BJIInstrT<OPCODE_JGI> JGIInstr;
+    typedef BJIInstrT<OPCODE_JNGI> JNGIInstr;
+
+    template<uint8_t> class BOIInstrT;
+    typedef BOIInstrT<OPCODE_ADDI> ADDIInstr;
+    typedef BOIInstrT<OPCODE_SUBI> SUBIInstr;
+    typedef BOIInstrT<OPCODE_MULI> MULIInstr;
+
     template<uint8_t, class> class CPIInstrT;
     typedef CPIInstrT<OPCODE_CPI1, uint8_t> CPI1Instr;
     typedef CPIInstrT<OPCODE_CPI2, uint16_t> CPI2Instr;
@@ -207,9 +390,26 @@ namespace Ant {
     class THROWInstr;
     class RETInstr;
 
+    template<uint8_t> class AOInstrT;
+    typedef AOInstrT<OPCODE_AADD> AADDInstr;
+    typedef AOInstrT<OPCODE_ASUB> ASUBInstr;
+    typedef AOInstrT<OPCODE_AMUL> AMULInstr;
+    typedef AOInstrT<OPCODE_AMIN> AMINInstr;
+    typedef AOInstrT<OPCODE_AMAX> AMAXInstr;
+    typedef AOInstrT<OPCODE_ACMPE> ACMPEInstr;
+    typedef AOInstrT<OPCODE_ACMPG> ACMPGInstr;
+
+    template<uint8_t> class ARInstrT;
+    typedef ARInstrT<OPCODE_ARSUM> ARSUMInstr;
+    typedef ARInstrT<OPCODE_ARMIN> ARMINInstr;
+    typedef ARInstrT<OPCODE_ARMAX> ARMAXInstr;
+
+    class AFILLInstr;
+
     enum VMExceptionCode {
       VMECODE_NULL_REFERENCE = -1,
       VMECODE_RANGE = -2,
+      VMECODE_DIVISION_BY_ZERO = -3,
     };
 
   }